@@ -0,0 +1,312 @@
+#include "pch.h"
+#include "ArrowIpc.h"
+
+//-----------------------------------------------------------------------------
+// Flatbuffer access
+//-----------------------------------------------------------------------------
+// The metadata of each IPC message is a flatbuffer (see Message.fbs and Schema.fbs in
+// https://github.com/apache/arrow/tree/main/format).  TFlatBuf reads tables, vectors and strings
+// from it directly, checking all offsets against the bounds of the buffer; if anything is out of
+// bounds, 'ok' is set to false and zeros are returned from then on.  Positions are relative to the
+// start of the buffer; since a table can't be at position 0 (that's where the root offset is),
+// 0 is used to indicate that a field is absent.
+
+namespace {
+
+class TFlatBuf
+{
+public:
+	const char *buf; size_t len; bool ok;
+	TFlatBuf(const char *buf_, size_t len_) : buf(buf_), len(len_), ok(true) { }
+	template<typename T> T Read(size_t pos) {
+		T x; if (! ok || pos > len || len - pos < sizeof(T)) { ok = false; return T(0); }
+		memcpy(&x, buf + pos, sizeof(T)); return x; }
+	size_t Root() { return Read<uint32_t>(0); }
+	// Returns the position of the given field of a table, or 0 if the field is absent.
+	size_t Field(size_t table, int fieldId) {
+		if (table == 0) return 0;
+		const int64_t vtable = int64_t(table) - Read<int32_t>(table); if (! ok || vtable < 0) return ok = false;
+		const size_t entry = 4 + 2 * size_t(fieldId); if (entry + 2 > Read<uint16_t>(size_t(vtable))) return 0;
+		const uint16_t offset = Read<uint16_t>(size_t(vtable) + entry);
+		return (ok && offset != 0) ? table + offset : 0; }
+	template<typename T> T Scalar(size_t table, int fieldId, T defaultValue) { size_t pos = Field(table, fieldId); return pos ? Read<T>(pos) : defaultValue; }
+	// For fields that refer to a table, vector or string: returns the position of the referred object, or 0.
+	size_t Ref(size_t table, int fieldId) { size_t pos = Field(table, fieldId); if (! pos) return 0; size_t target = pos + Read<uint32_t>(pos); return ok ? target : 0; }
+	// Returns the position of the first element of a vector of elements of the given size.
+	size_t Vector(size_t table, int fieldId, size_t eltSize, uint32_t& n) {
+		n = 0; size_t pos = Ref(table, fieldId); if (! pos) return 0;
+		n = Read<uint32_t>(pos); if (! ok || (len - pos - 4) / eltSize < n) { n = 0; return ok = false; }
+		return pos + 4; }
+	// Returns the position of the table referred to by the i'th element of a vector of tables.
+	size_t VectorTable(size_t vector, uint32_t i) { size_t pos = vector + 4 * size_t(i); size_t target = pos + Read<uint32_t>(pos); return ok ? target : 0; }
+	TStr Str(size_t table, int fieldId) {
+		uint32_t n; size_t pos = Vector(table, fieldId, 1, n);
+		TChA s; for (uint32_t i = 0; i < n; ++i) s += buf[pos + i];
+		return s; }
+};
+
+// Message.fbs and Schema.fbs define the following enums.
+enum { MsgHeader_Schema = 1, MsgHeader_DictionaryBatch = 2, MsgHeader_RecordBatch = 3 };
+enum { MetadataVersion_V4 = 3 };
+
+// Returns the number of buffers in a record batch for values of a type without children.
+int GetNBuffers(TArrowType type)
+{
+	switch (type) {
+		case TArrowType::Null: return 0;
+		case TArrowType::Utf8: case TArrowType::LargeUtf8: case TArrowType::Binary: case TArrowType::LargeBinary: return 3;
+		case TArrowType::List: case TArrowType::LargeList: case TArrowType::FixedSizeList: case TArrowType::Struct: case TArrowType::Map: return -1;
+		default: return 2; }
+}
+
+bool ParseField(TFlatBuf& fb, size_t table, TArrowField& field, int depth, TStr& errMsg)
+{
+	if (depth > 64) { errMsg = "The schema is nested too deeply."; return false; }
+	field.name = fb.Str(table, 0);
+	const uint8_t typeType = fb.Scalar<uint8_t>(table, 2, 0); const size_t type = fb.Ref(table, 3);
+	auto TimeUnit = [&fb, type] (int16_t defaultValue) { return TArrowTimeUnit(TInt::GetMx(0, TInt::GetMn(3, fb.Scalar<int16_t>(type, 0, defaultValue)))); };
+	int nOwnBuffers = 2; bool canHaveChildren = false;
+	switch (typeType)
+	{
+		case 1: field.type = TArrowType::Null; nOwnBuffers = 0; break;
+		case 2: field.type = TArrowType::Int; field.bitWidth = fb.Scalar<int32_t>(type, 0, 0); field.isSigned = (fb.Scalar<uint8_t>(type, 1, 0) != 0);
+			if (field.bitWidth != 8 && field.bitWidth != 16 && field.bitWidth != 32 && field.bitWidth != 64) { errMsg = TStr::Fmt("Field \"%s\" has an invalid integer width (%d).", field.name.CStr(), field.bitWidth); return false; }
+			break;
+		case 3: field.type = TArrowType::Float; { int16_t precision = fb.Scalar<int16_t>(type, 0, 0); field.bitWidth = (precision == 0) ? 16 : (precision == 1) ? 32 : 64; } break;
+		case 4: field.type = TArrowType::Binary; nOwnBuffers = 3; break;
+		case 5: field.type = TArrowType::Utf8; nOwnBuffers = 3; break;
+		case 6: field.type = TArrowType::Bool; field.bitWidth = 1; break;
+		case 7: field.type = TArrowType::Decimal; field.bitWidth = fb.Scalar<int32_t>(type, 2, 128); break;
+		case 8: field.type = TArrowType::Date; field.timeUnit = (fb.Scalar<int16_t>(type, 0, 1) == 0) ? TArrowTimeUnit::Day : TArrowTimeUnit::MSec; field.bitWidth = (field.timeUnit == TArrowTimeUnit::Day) ? 32 : 64; break;
+		case 9: field.type = TArrowType::Time; field.timeUnit = TimeUnit(1); field.bitWidth = (fb.Scalar<int32_t>(type, 1, 32) == 64) ? 64 : 32; break;
+		case 10: field.type = TArrowType::Timestamp; field.timeUnit = TimeUnit(0); field.bitWidth = 64; field.isSigned = true; break;
+		case 11: field.type = TArrowType::Interval; break;
+		case 12: field.type = TArrowType::List; canHaveChildren = true; break;
+		case 13: field.type = TArrowType::Struct; nOwnBuffers = 1; canHaveChildren = true; break;
+		case 15: field.type = TArrowType::FixedSizeBinary; break;
+		case 16: field.type = TArrowType::FixedSizeList; nOwnBuffers = 1; canHaveChildren = true; break;
+		case 17: field.type = TArrowType::Map; canHaveChildren = true; break;
+		case 18: field.type = TArrowType::Duration; field.timeUnit = TimeUnit(1); field.bitWidth = 64; field.isSigned = true; break;
+		case 19: field.type = TArrowType::LargeBinary; nOwnBuffers = 3; break;
+		case 20: field.type = TArrowType::LargeUtf8; nOwnBuffers = 3; break;
+		case 21: field.type = TArrowType::LargeList; canHaveChildren = true; break;
+		default: errMsg = TStr::Fmt("Field \"%s\" has an unsupported type (%d).", field.name.CStr(), int(typeType)); return false;
+	}
+	if (field.type == TArrowType::Date || field.type == TArrowType::Time) field.isSigned = true;
+	field.nNodes = 1; field.nBuffers = nOwnBuffers;
+	uint32_t nChildren; size_t children = fb.Vector(table, 5, 4, nChildren);
+	if (nChildren > 0 && ! canHaveChildren) { errMsg = TStr::Fmt("Field \"%s\" has children, which is not valid for its type.", field.name.CStr()); return false; }
+	for (uint32_t i = 0; i < nChildren; ++i) {
+		TArrowField child; if (! ParseField(fb, fb.VectorTable(children, i), child, depth + 1, errMsg)) return false;
+		field.nNodes += child.nNodes; field.nBuffers += child.nBuffers; }
+	// In a record batch, a dictionary-encoded field consists of just the indices.
+	const size_t dict = fb.Ref(table, 4);
+	if (dict) {
+		field.dictId = fb.Scalar<int64_t>(dict, 0, 0); const size_t indexType = fb.Ref(dict, 1);
+		field.indexBitWidth = indexType ? fb.Scalar<int32_t>(indexType, 0, 0) : 32;
+		field.indexSigned = indexType ? (fb.Scalar<uint8_t>(indexType, 1, 0) != 0) : true;
+		if (field.indexBitWidth != 8 && field.indexBitWidth != 16 && field.indexBitWidth != 32 && field.indexBitWidth != 64) { errMsg = TStr::Fmt("Field \"%s\" has an invalid dictionary index width (%d).", field.name.CStr(), field.indexBitWidth); return false; }
+		field.nNodes = 1; field.nBuffers = 2; }
+	if (! fb.ok) { errMsg = "Invalid schema metadata."; return false; }
+	return true;
+}
+
+int64_t FloorDiv(int64_t x, int64_t d) { int64_t q = x / d; return (x % d < 0) ? q - 1 : q; }
+
+}
+
+//-----------------------------------------------------------------------------
+// TArrowField, TArrowArray
+//-----------------------------------------------------------------------------
+
+TStr TArrowField::GetTypeStr() const
+{
+	static const char *units[] = { "s", "ms", "us", "ns", "d" };
+	TStr s;
+	switch (type) {
+		case TArrowType::Null: s = "null"; break;
+		case TArrowType::Bool: s = "bool"; break;
+		case TArrowType::Int: s = TStr::Fmt("%sint%d", isSigned ? "" : "u", bitWidth); break;
+		case TArrowType::Float: s = TStr::Fmt("float%d", bitWidth); break;
+		case TArrowType::Utf8: s = "utf8"; break;
+		case TArrowType::LargeUtf8: s = "large_utf8"; break;
+		case TArrowType::Binary: s = "binary"; break;
+		case TArrowType::LargeBinary: s = "large_binary"; break;
+		case TArrowType::FixedSizeBinary: s = "fixed_size_binary"; break;
+		case TArrowType::Decimal: s = TStr::Fmt("decimal%d", bitWidth); break;
+		case TArrowType::Date: s = TStr::Fmt("date%d", bitWidth); break;
+		case TArrowType::Time: s = TStr::Fmt("time%d[%s]", bitWidth, units[int(timeUnit)]); break;
+		case TArrowType::Timestamp: s = TStr::Fmt("timestamp[%s]", units[int(timeUnit)]); break;
+		case TArrowType::Duration: s = TStr::Fmt("duration[%s]", units[int(timeUnit)]); break;
+		case TArrowType::Interval: s = "interval"; break;
+		case TArrowType::List: s = "list"; break;
+		case TArrowType::LargeList: s = "large_list"; break;
+		case TArrowType::FixedSizeList: s = "fixed_size_list"; break;
+		case TArrowType::Struct: s = "struct"; break;
+		case TArrowType::Map: s = "map"; break;
+		default: s = "unknown"; }
+	if (IsDictEncoded()) s = TStr::Fmt("dictionary<%sint%d, %s>", indexSigned ? "" : "u", indexBitWidth, s.CStr());
+	return s;
+}
+
+void TArrowArray::GetSecNs(int64_t i, int64_t& sec, int& ns) const
+{
+	int64_t x; GetInt(i, x);
+	switch (timeUnit) {
+		case TArrowTimeUnit::Day: sec = x * 86400; ns = 0; break;
+		case TArrowTimeUnit::Sec: sec = x; ns = 0; break;
+		case TArrowTimeUnit::MSec: sec = FloorDiv(x, 1000); ns = int(x - sec * 1000) * 1000000; break;
+		case TArrowTimeUnit::USec: sec = FloorDiv(x, 1000000); ns = int(x - sec * 1000000) * 1000; break;
+		case TArrowTimeUnit::NSec: sec = FloorDiv(x, 1000000000); ns = int(x - sec * 1000000000); break;
+		default: Assert(false); sec = 0; ns = 0; }
+}
+
+//-----------------------------------------------------------------------------
+// TArrowIpcReader
+//-----------------------------------------------------------------------------
+
+bool TArrowIpcReader::Open(const char *data_, size_t len_)
+{
+	data = data_; len = len_; messages.Clr(); dicts.Clr(); fields.Clr(); nextMsg = 0; nRows = 0; errMsg = "";
+	static const char Magic[6] = { 'A', 'R', 'R', 'O', 'W', '1' };
+	if (len >= sizeof(Magic) && memcmp(data, Magic, sizeof(Magic)) == 0)
+	{
+		// The file format: magic, padding to 8 bytes, the stream format, footer, footer length, magic.
+		// The footer repeats the locations of the messages; we simply read the stream instead.
+		if (len < 8 + 4 + sizeof(Magic) || memcmp(data + len - sizeof(Magic), Magic, sizeof(Magic)) != 0) return Error("The Arrow file is truncated.");
+		int32_t footerLen; memcpy(&footerLen, data + len - sizeof(Magic) - 4, 4);
+		if (footerLen < 0 || size_t(footerLen) > len - 8 - 4 - sizeof(Magic)) return Error("The Arrow file footer is invalid.");
+		return ParseMessages(8, len - sizeof(Magic) - 4 - size_t(footerLen));
+	}
+	return ParseMessages(0, len);
+}
+
+bool TArrowIpcReader::ParseMessages(size_t pos, size_t end)
+{
+	bool haveSchema = false;
+	while (end - pos >= 4)
+	{
+		// Each message starts with 0xFFFFFFFF and the length of the metadata (before version 0.15,
+		// the 0xFFFFFFFF was missing).  The metadata is padded so that the body starts at a multiple of 8 bytes.
+		int32_t metaLen; memcpy(&metaLen, data + pos, 4); pos += 4;
+		if (metaLen == -1) { if (end - pos < 4) break; memcpy(&metaLen, data + pos, 4); pos += 4; }
+		if (metaLen == 0) break; // end of stream
+		if (metaLen < 0 || size_t(metaLen) > end - pos) return Error(TStr::Fmt("Invalid Arrow message at offset %llu.", (unsigned long long) pos));
+		TMessage msg; msg.metaStart = pos; msg.metaLen = size_t(metaLen); msg.nRows = 0;
+		TFlatBuf fb { data + pos, msg.metaLen };
+		const size_t root = fb.Root();
+		const int16_t version = fb.Scalar<int16_t>(root, 0, 0);
+		const uint8_t headerType = fb.Scalar<uint8_t>(root, 1, 0);
+		msg.header = fb.Ref(root, 2);
+		const int64_t bodyLen = fb.Scalar<int64_t>(root, 3, 0);
+		if (! fb.ok || msg.header == 0) return Error(TStr::Fmt("Invalid Arrow message metadata at offset %llu.", (unsigned long long) pos));
+		if (version < MetadataVersion_V4) return Error("Arrow data older than metadata version V4 (Arrow 0.8) is not supported.");
+		pos += msg.metaLen;
+		if (bodyLen < 0 || uint64_t(bodyLen) > end - pos) return Error(TStr::Fmt("The body of the Arrow message at offset %llu is truncated.", (unsigned long long) msg.metaStart));
+		msg.body = data + pos; msg.bodyLen = size_t(bodyLen); pos += msg.bodyLen;
+		if (headerType == MsgHeader_Schema)
+		{
+			if (haveSchema) continue; // the file format may repeat the schema in the footer, but not in the stream
+			haveSchema = true;
+			if (fb.Scalar<int16_t>(msg.header, 0, 0) != 0) return Error("Big-endian Arrow data is not supported.");
+			uint32_t nFields; size_t vFields = fb.Vector(msg.header, 1, 4, nFields);
+			for (uint32_t i = 0; i < nFields; ++i) {
+				fields.Add(); if (! ParseField(fb, fb.VectorTable(vFields, i), fields.Last(), 0, errMsg)) return false; }
+		}
+		else if (headerType == MsgHeader_DictionaryBatch || headerType == MsgHeader_RecordBatch)
+		{
+			if (! haveSchema) return Error("The Arrow data doesn't start with a schema.");
+			msg.isDict = (headerType == MsgHeader_DictionaryBatch);
+			if (! msg.isDict) msg.nRows = fb.Scalar<int64_t>(msg.header, 0, 0);
+			if (! fb.ok || msg.nRows < 0) return Error(TStr::Fmt("Invalid Arrow message metadata at offset %llu.", (unsigned long long) msg.metaStart));
+			// Unless all the fields are nulls or nested, each row takes up at least one bit of the body;
+			// this keeps a corrupted length from making the caller allocate space for too many rows.
+			if (uint64_t(msg.nRows) / 8 > msg.bodyLen && fields.Len() > 0) {
+				bool allEmpty = true; for (const TArrowField& field : fields) if (field.IsDictEncoded() || GetNBuffers(field.type) > 0) allEmpty = false;
+				if (! allEmpty) return Error(TStr::Fmt("The length of the Arrow record batch at offset %llu is invalid.", (unsigned long long) msg.metaStart)); }
+			nRows += msg.nRows;
+			messages.Add(msg);
+		}
+		else return Error(TStr::Fmt("Unsupported Arrow message type %d.", int(headerType)));
+	}
+	if (! haveSchema) return Error("The Arrow data contains no schema.");
+	return true;
+}
+
+bool TArrowIpcReader::ReadRecordBatch(const TMessage& msg, size_t recordBatch, const TArrowFieldV& fields_, TArrowArrayV& arrays, int64_t& length)
+{
+	TFlatBuf fb { data + msg.metaStart, msg.metaLen };
+	length = fb.Scalar<int64_t>(recordBatch, 0, 0);
+	if (fb.Ref(recordBatch, 3)) return Error("Compressed Arrow record batches are not supported.");
+	uint32_t nNodes, nBuffers;
+	const size_t nodes = fb.Vector(recordBatch, 1, 16, nNodes), buffers = fb.Vector(recordBatch, 2, 16, nBuffers);
+	if (! fb.ok) return Error("Invalid Arrow record batch metadata.");
+	arrays.Gen(fields_.Len());
+	uint32_t nodeNo = 0, bufNo = 0;
+	for (int fieldNo = 0; fieldNo < fields_.Len(); ++fieldNo)
+	{
+		const TArrowField &field = fields_[fieldNo]; TArrowArray &array = arrays[fieldNo];
+		if (nodeNo + uint32_t(field.nNodes) > nNodes || bufNo + uint32_t(field.nBuffers) > nBuffers) return Error("An Arrow record batch has fewer buffers than its schema requires.");
+		array.length = fb.Read<int64_t>(nodes + 16 * nodeNo); array.nullCount = fb.Read<int64_t>(nodes + 16 * nodeNo + 8);
+		if (array.length != length || array.nullCount < 0 || array.nullCount > array.length) return Error(TStr::Fmt("Invalid length of field \"%s\" in an Arrow record batch.", field.name.CStr()));
+		const char *bufs[3] = { nullptr, nullptr, nullptr }; size_t bufLens[3] = { 0, 0, 0 };
+		for (int i = 0; i < TInt::GetMn(3, field.nBuffers); ++i) {
+			const int64_t offset = fb.Read<int64_t>(buffers + 16 * (bufNo + i)), bufLen = fb.Read<int64_t>(buffers + 16 * (bufNo + i) + 8);
+			if (offset < 0 || bufLen < 0 || uint64_t(offset) > msg.bodyLen || uint64_t(bufLen) > msg.bodyLen - uint64_t(offset)) return Error(TStr::Fmt("A buffer of field \"%s\" lies outside the Arrow record batch.", field.name.CStr()));
+			bufs[i] = msg.body + offset; bufLens[i] = size_t(bufLen); }
+		nodeNo += field.nNodes; bufNo += field.nBuffers;
+		if (field.IsDictEncoded()) { array.type = TArrowType::Int; array.bitWidth = field.indexBitWidth; array.isSigned = field.indexSigned; }
+		else { array.type = field.type; array.bitWidth = field.bitWidth; array.isSigned = field.isSigned; array.timeUnit = field.timeUnit; }
+		if (array.type == TArrowType::Null) continue;
+		if (array.nullCount > 0) {
+			if (bufLens[0] < size_t((array.length + 7) / 8)) return Error(TStr::Fmt("The validity bitmap of field \"%s\" is too short.", field.name.CStr()));
+			array.validity = (const uint8_t *) bufs[0]; }
+		array.values = bufs[1]; array.valuesLen = bufLens[1];
+		// Check the lengths of those buffers that TArrowArray provides access to.
+		size_t minLen = 0;
+		if (array.type == TArrowType::Bool) minLen = size_t((array.length + 7) / 8);
+		else if (array.IsIntBased() || array.type == TArrowType::Float) minLen = size_t(array.length) * size_t(array.bitWidth / 8);
+		else if (array.IsStr()) {
+			minLen = (array.length == 0) ? 0 : size_t(array.length + 1) * ((array.type == TArrowType::LargeUtf8 || array.type == TArrowType::LargeBinary) ? 8 : 4);
+			array.data = bufs[2]; array.dataLen = bufLens[2]; }
+		if (array.valuesLen < minLen) return Error(TStr::Fmt("The values buffer of field \"%s\" is too short.", field.name.CStr()));
+	}
+	if (! fb.ok) return Error("Invalid Arrow record batch metadata.");
+	return true;
+}
+
+bool TArrowIpcReader::NextBatch(TArrowArrayV& arrays, int64_t& length)
+{
+	errMsg = "";
+	while (nextMsg < messages.Len())
+	{
+		const int msgNo = nextMsg++; const TMessage &msg = messages[msgNo];
+		if (! msg.isDict) return ReadRecordBatch(msg, msg.header, fields, arrays, length);
+		TFlatBuf fb { data + msg.metaStart, msg.metaLen };
+		TDict dict; dict.id = fb.Scalar<int64_t>(msg.header, 0, 0); dict.msgNo = msgNo; dict.isDelta = (fb.Scalar<uint8_t>(msg.header, 2, 0) != 0);
+		int i = 0; while (i < dicts.Len() && dicts[i].id != dict.id) ++i;
+		if (i < dicts.Len()) { if (dict.isDelta) dicts[i].isDelta = true; else dicts[i] = dict; }
+		else dicts.Add(dict);
+	}
+	return false;
+}
+
+bool TArrowIpcReader::GetDict(int64_t dictId, TArrowArray& values, int& version)
+{
+	int i = 0; while (i < dicts.Len() && dicts[i].id != dictId) ++i;
+	if (i >= dicts.Len()) return Error(TStr::Fmt("Arrow dictionary %lld is missing.", (long long) dictId));
+	if (dicts[i].isDelta) return Error(TStr::Fmt("Arrow dictionary %lld has deltas, which are not supported.", (long long) dictId));
+	int fieldNo = 0; while (fieldNo < fields.Len() && fields[fieldNo].dictId != dictId) ++fieldNo;
+	if (fieldNo >= fields.Len()) return Error(TStr::Fmt("No field uses Arrow dictionary %lld.", (long long) dictId));
+	// The dictionary batch contains a record batch with a single field, which has the value type.
+	TArrowFieldV valueFields; valueFields.Add(fields[fieldNo]);
+	TArrowField &valueField = valueFields[0]; valueField.dictId = -1; valueField.nNodes = 1; valueField.nBuffers = GetNBuffers(valueField.type);
+	if (valueField.nBuffers < 0) return Error(TStr::Fmt("The values of Arrow dictionary %lld have a nested type, which is not supported.", (long long) dictId));
+	const TMessage &msg = messages[dicts[i].msgNo];
+	TFlatBuf fb { data + msg.metaStart, msg.metaLen };
+	const size_t recordBatch = fb.Ref(msg.header, 1); if (! recordBatch) return Error(TStr::Fmt("Arrow dictionary %lld has no data.", (long long) dictId));
+	TArrowArrayV arrays; int64_t length;
+	if (! ReadRecordBatch(msg, recordBatch, valueFields, arrays, length)) return false;
+	values = arrays[0]; version = dicts[i].msgNo;
+	return true;
+}
@@ -0,0 +1,108 @@
+#ifndef __ARROWIPC_H_INCLUDED__
+#define __ARROWIPC_H_INCLUDED__
+
+//-----------------------------------------------------------------------------
+// Apache Arrow IPC reader
+//-----------------------------------------------------------------------------
+// A self-contained reader for the Arrow IPC file and stream formats, see
+// https://arrow.apache.org/docs/format/Columnar.html#serialization-and-interprocess-communication-ipc
+// It decodes just enough of the flatbuffer metadata to locate the buffers of each top-level
+// field; the values are accessed in place, in the caller's buffer, which must stay alive
+// (and unchanged) as long as the reader and the arrays obtained from it are in use.
+// Only uncompressed little-endian data is supported.  Nested fields are skipped over,
+// but their values can't be accessed.
+
+enum class TArrowType { Null, Bool, Int, Float, Utf8, LargeUtf8, Binary, LargeBinary, FixedSizeBinary,
+	Decimal, Date, Time, Timestamp, Duration, Interval, List, LargeList, FixedSizeList, Struct, Map };
+enum class TArrowTimeUnit { Sec, MSec, USec, NSec, Day };
+
+class TArrowField;
+typedef TVec<TArrowField> TArrowFieldV;
+
+class TArrowField
+{
+public:
+	TStr name;
+	TArrowType type;
+	int bitWidth; // Bool: 1; Int, Float, Date, Time, Timestamp, Duration: the width of a value
+	bool isSigned; // Int only
+	TArrowTimeUnit timeUnit; // Date, Time, Timestamp, Duration
+	// If the field is dictionary-encoded, 'type' etc. describe the dictionary values,
+	// while the record batches contain indices, which are Ints of the following width.
+	int64_t dictId; int indexBitWidth; bool indexSigned;
+	int nNodes, nBuffers; // how many field nodes and buffers this field (including its children) takes up in a record batch
+	TArrowField() : type(TArrowType::Null), bitWidth(0), isSigned(false), timeUnit(TArrowTimeUnit::Sec), dictId(-1), indexBitWidth(0), indexSigned(false), nNodes(1), nBuffers(0) { }
+	bool IsDictEncoded() const { return dictId >= 0; }
+	TStr GetTypeStr() const; // e.g. "int64", "timestamp[ms]", "dictionary<int32, utf8>"; for error messages
+};
+
+// The values of one field in a record batch (or in a dictionary).
+class TArrowArray
+{
+public:
+	TArrowType type; int bitWidth; bool isSigned; TArrowTimeUnit timeUnit;
+	int64_t length, nullCount;
+	const uint8_t *validity; // nullptr if there are no nulls
+	const char *values; size_t valuesLen; // for Utf8, LargeUtf8, Binary and LargeBinary, these are the offsets
+	const char *data; size_t dataLen; // Utf8, LargeUtf8, Binary and LargeBinary only: the contents of the strings
+	TArrowArray() : type(TArrowType::Null), bitWidth(0), isSigned(false), timeUnit(TArrowTimeUnit::Sec), length(0), nullCount(0), validity(nullptr), values(nullptr), valuesLen(0), data(nullptr), dataLen(0) { }
+	bool IsNull(int64_t i) const { return type == TArrowType::Null || (validity && ! ((validity[i >> 3] >> (i & 7)) & 1)); }
+	bool IsIntBased() const { return type == TArrowType::Bool || type == TArrowType::Int || type == TArrowType::Date || type == TArrowType::Time || type == TArrowType::Timestamp || type == TArrowType::Duration; }
+	bool IsStr() const { return type == TArrowType::Utf8 || type == TArrowType::LargeUtf8 || type == TArrowType::Binary || type == TArrowType::LargeBinary; }
+	// For Bool, Int, Date, Time, Timestamp and Duration: the value as stored (without conversion into seconds or
+	// the like).  Fails if the value is an unsigned 64-bit integer that doesn't fit into an int64_t.
+	bool GetInt(int64_t i, int64_t& x) const {
+		if (type == TArrowType::Bool) { x = (values[i >> 3] >> (i & 7)) & 1; return true; }
+		switch (bitWidth) {
+			case 8: x = isSigned ? int64_t(Load<int8_t>(i)) : int64_t(Load<uint8_t>(i)); return true;
+			case 16: x = isSigned ? int64_t(Load<int16_t>(i)) : int64_t(Load<uint16_t>(i)); return true;
+			case 32: x = isSigned ? int64_t(Load<int32_t>(i)) : int64_t(Load<uint32_t>(i)); return true;
+			default: if (isSigned) { x = Load<int64_t>(i); return true; } else { uint64_t u = Load<uint64_t>(i); x = int64_t(u); return u <= uint64_t(INT64_MAX); } } }
+	// For Float, Bool and Int.
+	double GetFlt(int64_t i) const {
+		if (type == TArrowType::Float) return (bitWidth == 32) ? double(Load<float>(i)) : Load<double>(i);
+		if (type == TArrowType::Int && ! isSigned && bitWidth == 64) return double(Load<uint64_t>(i));
+		int64_t x; GetInt(i, x); return double(x); }
+	// For Utf8, LargeUtf8, Binary and LargeBinary.  Fails if the offsets are invalid.  The string is not null-terminated.
+	bool GetStr(int64_t i, const char *&p, size_t& len) const {
+		int64_t from, to;
+		if (type == TArrowType::LargeUtf8 || type == TArrowType::LargeBinary) from = Load<int64_t>(i), to = Load<int64_t>(i + 1);
+		else from = Load<int32_t>(i), to = Load<int32_t>(i + 1);
+		if (from < 0 || from > to || uint64_t(to) > dataLen) return false;
+		p = data + from; len = size_t(to - from); return true; }
+	// Converts the value of a Date, Timestamp or Time into seconds and nanoseconds; a Time is the time since midnight.
+	void GetSecNs(int64_t i, int64_t& sec, int& ns) const;
+protected:
+	template<typename T> T Load(int64_t i) const { T x; memcpy(&x, values + i * sizeof(T), sizeof(T)); return x; }
+};
+typedef TVec<TArrowArray> TArrowArrayV;
+
+class TArrowIpcReader
+{
+protected:
+	class TMessage { public: bool isDict; size_t metaStart, metaLen, header; const char *body; size_t bodyLen; int64_t nRows; };
+	class TDict { public: int64_t id; int msgNo; bool isDelta; };
+	const char *data; size_t len;
+	TVec<TMessage> messages; // dictionary and record batches, in file order
+	TVec<TDict> dicts; // the most recent dictionary batch with each id
+	int nextMsg;
+	int64_t nRows;
+	bool Error(const TStr& msg) { errMsg = msg; return false; }
+	bool ParseMessages(size_t pos, size_t end);
+	bool ReadRecordBatch(const TMessage& msg, size_t recordBatch, const TArrowFieldV& fields_, TArrowArrayV& arrays, int64_t& length);
+public:
+	TArrowFieldV fields; // top-level fields of the schema
+	TStr errMsg; // describes the error if a method returns false
+	TArrowIpcReader() : data(nullptr), len(0), nextMsg(0), nRows(0) { }
+	// Parses the schema and the metadata of all the messages.  'data_' may be in either the file or the stream format.
+	bool Open(const char *data_, size_t len_);
+	int64_t GetNRows() const { return nRows; } // the total length of all record batches
+	// Moves on to the next record batch and initializes 'arrays' (one per field) from it.  Returns false
+	// at the end of data, and also in case of an error, in which case 'errMsg' is not empty.
+	bool NextBatch(TArrowArrayV& arrays, int64_t& length);
+	// Returns the dictionary that is valid for the current record batch.  'version' changes
+	// whenever the dictionary is replaced by a new one.
+	bool GetDict(int64_t dictId, TArrowArray& values, int& version);
+};
+
+#endif // __ARROWIPC_H_INCLUDED__
@@ -0,0 +1,329 @@
+#include "pch.h"
+#include "DistKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	#define SS2_X86
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
+#endif
+
+// MSVC accepts intrinsics for any instruction set anywhere, while GCC and Clang only accept
+// them in functions that are compiled for that instruction set.
+#if defined(SS2_X86) && (defined(__GNUC__) || defined(__clang__))
+	#define SS2_TARGET(x) __attribute__((target(x)))
+#else
+	#define SS2_TARGET(x)
+#endif
+
+//-----------------------------------------------------------------------------
+// Scalar kernels
+//-----------------------------------------------------------------------------
+
+namespace {
+
+template<typename T>
+void Dist2Scalar(const T *x, const T *centroids, int nCentroids, int stride, double *dist2)
+{
+	for (int j = 0; j < nCentroids; ++j, centroids += stride) {
+		double sum = 0; for (int i = 0; i < stride; ++i) { const double d = double(x[i]) - double(centroids[i]); sum += d * d; }
+		dist2[j] = sum; }
+}
+
+void Dist2ScalarF64(const double *x, const double *centroids, int nCentroids, int stride, double *dist2) { Dist2Scalar(x, centroids, nCentroids, stride, dist2); }
+void Dist2ScalarF32(const float *x, const float *centroids, int nCentroids, int stride, double *dist2) { Dist2Scalar(x, centroids, nCentroids, stride, dist2); }
+
+#ifdef SS2_X86
+
+//-----------------------------------------------------------------------------
+// SSE2 kernels
+//-----------------------------------------------------------------------------
+// All the vector kernels compare 'x' with four centroids at a time, so that each
+// vector of 'x' is loaded once per four centroids and the four sums are independent.
+
+SS2_TARGET("sse2") inline double HSum(__m128d v) { return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v))); }
+
+SS2_TARGET("sse2") void Dist2Sse2F64(const double *x, const double *centroids, int nCentroids, int stride, double *dist2)
+{
+	int j = 0;
+	for ( ; j + 4 <= nCentroids; j += 4) {
+		const double *c0 = centroids + size_t(j) * stride, *c1 = c0 + stride, *c2 = c1 + stride, *c3 = c2 + stride;
+		__m128d s0 = _mm_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+		for (int i = 0; i < stride; i += 2) {
+			const __m128d v = _mm_loadu_pd(x + i); __m128d d;
+			d = _mm_sub_pd(v, _mm_loadu_pd(c0 + i)); s0 = _mm_add_pd(s0, _mm_mul_pd(d, d));
+			d = _mm_sub_pd(v, _mm_loadu_pd(c1 + i)); s1 = _mm_add_pd(s1, _mm_mul_pd(d, d));
+			d = _mm_sub_pd(v, _mm_loadu_pd(c2 + i)); s2 = _mm_add_pd(s2, _mm_mul_pd(d, d));
+			d = _mm_sub_pd(v, _mm_loadu_pd(c3 + i)); s3 = _mm_add_pd(s3, _mm_mul_pd(d, d)); }
+		dist2[j] = HSum(s0); dist2[j + 1] = HSum(s1); dist2[j + 2] = HSum(s2); dist2[j + 3] = HSum(s3); }
+	for ( ; j < nCentroids; ++j) {
+		const double *c = centroids + size_t(j) * stride; __m128d s = _mm_setzero_pd();
+		for (int i = 0; i < stride; i += 2) { const __m128d d = _mm_sub_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(c + i)); s = _mm_add_pd(s, _mm_mul_pd(d, d)); }
+		dist2[j] = HSum(s); }
+}
+
+// The float kernels compute the squares of the differences in float and add them up in float vectors 
+// for up to F32BlockLen features; these partial sums are then converted to double and accumulated in double.
+// This way the float kernels process twice as many values per instruction as the double ones,
+// while the rounding errors stay small (each float partial sum has at most F32BlockLen / (vector width) terms).
+enum { F32BlockLen = 256 };
+
+SS2_TARGET("sse2") inline __m128d AddToF64(__m128d acc, __m128 s) { return _mm_add_pd(acc, _mm_add_pd(_mm_cvtps_pd(s), _mm_cvtps_pd(_mm_movehl_ps(s, s)))); }
+
+SS2_TARGET("sse2") void Dist2Sse2F32(const float *x, const float *centroids, int nCentroids, int stride, double *dist2)
+{
+	int j = 0;
+	for ( ; j + 4 <= nCentroids; j += 4) {
+		const float *c0 = centroids + size_t(j) * stride, *c1 = c0 + stride, *c2 = c1 + stride, *c3 = c2 + stride;
+		__m128d a0 = _mm_setzero_pd(), a1 = a0, a2 = a0, a3 = a0;
+		for (int i0 = 0; i0 < stride; i0 += F32BlockLen) {
+			const int i1 = TInt::GetMn(i0 + F32BlockLen, stride);
+			__m128 s0 = _mm_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+			for (int i = i0; i < i1; i += 4) {
+				const __m128 v = _mm_loadu_ps(x + i); __m128 d;
+				d = _mm_sub_ps(v, _mm_loadu_ps(c0 + i)); s0 = _mm_add_ps(s0, _mm_mul_ps(d, d));
+				d = _mm_sub_ps(v, _mm_loadu_ps(c1 + i)); s1 = _mm_add_ps(s1, _mm_mul_ps(d, d));
+				d = _mm_sub_ps(v, _mm_loadu_ps(c2 + i)); s2 = _mm_add_ps(s2, _mm_mul_ps(d, d));
+				d = _mm_sub_ps(v, _mm_loadu_ps(c3 + i)); s3 = _mm_add_ps(s3, _mm_mul_ps(d, d)); }
+			a0 = AddToF64(a0, s0); a1 = AddToF64(a1, s1); a2 = AddToF64(a2, s2); a3 = AddToF64(a3, s3); }
+		dist2[j] = HSum(a0); dist2[j + 1] = HSum(a1); dist2[j + 2] = HSum(a2); dist2[j + 3] = HSum(a3); }
+	for ( ; j < nCentroids; ++j) {
+		const float *c = centroids + size_t(j) * stride; __m128d a = _mm_setzero_pd();
+		for (int i0 = 0; i0 < stride; i0 += F32BlockLen) {
+			const int i1 = TInt::GetMn(i0 + F32BlockLen, stride); __m128 s = _mm_setzero_ps();
+			for (int i = i0; i < i1; i += 4) { const __m128 d = _mm_sub_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(c + i)); s = _mm_add_ps(s, _mm_mul_ps(d, d)); }
+			a = AddToF64(a, s); }
+		dist2[j] = HSum(a); }
+}
+
+//-----------------------------------------------------------------------------
+// AVX2 kernels
+//-----------------------------------------------------------------------------
+
+SS2_TARGET("avx2,fma") inline double HSum(__m256d v) { return HSum(_mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1))); }
+
+SS2_TARGET("avx2,fma") void Dist2Avx2F64(const double *x, const double *centroids, int nCentroids, int stride, double *dist2)
+{
+	int j = 0;
+	for ( ; j + 4 <= nCentroids; j += 4) {
+		const double *c0 = centroids + size_t(j) * stride, *c1 = c0 + stride, *c2 = c1 + stride, *c3 = c2 + stride;
+		__m256d s0 = _mm256_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+		for (int i = 0; i < stride; i += 4) {
+			const __m256d v = _mm256_loadu_pd(x + i); __m256d d;
+			d = _mm256_sub_pd(v, _mm256_loadu_pd(c0 + i)); s0 = _mm256_fmadd_pd(d, d, s0);
+			d = _mm256_sub_pd(v, _mm256_loadu_pd(c1 + i)); s1 = _mm256_fmadd_pd(d, d, s1);
+			d = _mm256_sub_pd(v, _mm256_loadu_pd(c2 + i)); s2 = _mm256_fmadd_pd(d, d, s2);
+			d = _mm256_sub_pd(v, _mm256_loadu_pd(c3 + i)); s3 = _mm256_fmadd_pd(d, d, s3); }
+		dist2[j] = HSum(s0); dist2[j + 1] = HSum(s1); dist2[j + 2] = HSum(s2); dist2[j + 3] = HSum(s3); }
+	for ( ; j < nCentroids; ++j) {
+		const double *c = centroids + size_t(j) * stride; __m256d s = _mm256_setzero_pd();
+		for (int i = 0; i < stride; i += 4) { const __m256d d = _mm256_sub_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(c + i)); s = _mm256_fmadd_pd(d, d, s); }
+		dist2[j] = HSum(s); }
+}
+
+SS2_TARGET("avx2,fma") inline __m256d AddToF64(__m256d acc, __m256 s) { 
+	return _mm256_add_pd(acc, _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(s)), _mm256_cvtps_pd(_mm256_extractf128_ps(s, 1)))); }
+
+SS2_TARGET("avx2,fma") void Dist2Avx2F32(const float *x, const float *centroids, int nCentroids, int stride, double *dist2)
+{
+	int j = 0;
+	for ( ; j + 4 <= nCentroids; j += 4) {
+		const float *c0 = centroids + size_t(j) * stride, *c1 = c0 + stride, *c2 = c1 + stride, *c3 = c2 + stride;
+		__m256d a0 = _mm256_setzero_pd(), a1 = a0, a2 = a0, a3 = a0;
+		for (int i0 = 0; i0 < stride; i0 += F32BlockLen) {
+			const int i1 = TInt::GetMn(i0 + F32BlockLen, stride);
+			__m256 s0 = _mm256_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+			for (int i = i0; i < i1; i += 8) {
+				const __m256 v = _mm256_loadu_ps(x + i); __m256 d;
+				d = _mm256_sub_ps(v, _mm256_loadu_ps(c0 + i)); s0 = _mm256_fmadd_ps(d, d, s0);
+				d = _mm256_sub_ps(v, _mm256_loadu_ps(c1 + i)); s1 = _mm256_fmadd_ps(d, d, s1);
+				d = _mm256_sub_ps(v, _mm256_loadu_ps(c2 + i)); s2 = _mm256_fmadd_ps(d, d, s2);
+				d = _mm256_sub_ps(v, _mm256_loadu_ps(c3 + i)); s3 = _mm256_fmadd_ps(d, d, s3); }
+			a0 = AddToF64(a0, s0); a1 = AddToF64(a1, s1); a2 = AddToF64(a2, s2); a3 = AddToF64(a3, s3); }
+		dist2[j] = HSum(a0); dist2[j + 1] = HSum(a1); dist2[j + 2] = HSum(a2); dist2[j + 3] = HSum(a3); }
+	for ( ; j < nCentroids; ++j) {
+		const float *c = centroids + size_t(j) * stride; __m256d a = _mm256_setzero_pd();
+		for (int i0 = 0; i0 < stride; i0 += F32BlockLen) {
+			const int i1 = TInt::GetMn(i0 + F32BlockLen, stride); __m256 s = _mm256_setzero_ps();
+			for (int i = i0; i < i1; i += 8) { const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(c + i)); s = _mm256_fmadd_ps(d, d, s); }
+			a = AddToF64(a, s); }
+		dist2[j] = HSum(a); }
+}
+
+//-----------------------------------------------------------------------------
+// AVX-512 kernels
+//-----------------------------------------------------------------------------
+
+SS2_TARGET("avx512f") void Dist2Avx512F64(const double *x, const double *centroids, int nCentroids, int stride, double *dist2)
+{
+	int j = 0;
+	for ( ; j + 4 <= nCentroids; j += 4) {
+		const double *c0 = centroids + size_t(j) * stride, *c1 = c0 + stride, *c2 = c1 + stride, *c3 = c2 + stride;
+		__m512d s0 = _mm512_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+		for (int i = 0; i < stride; i += 8) {
+			const __m512d v = _mm512_loadu_pd(x + i); __m512d d;
+			d = _mm512_sub_pd(v, _mm512_loadu_pd(c0 + i)); s0 = _mm512_fmadd_pd(d, d, s0);
+			d = _mm512_sub_pd(v, _mm512_loadu_pd(c1 + i)); s1 = _mm512_fmadd_pd(d, d, s1);
+			d = _mm512_sub_pd(v, _mm512_loadu_pd(c2 + i)); s2 = _mm512_fmadd_pd(d, d, s2);
+			d = _mm512_sub_pd(v, _mm512_loadu_pd(c3 + i)); s3 = _mm512_fmadd_pd(d, d, s3); }
+		dist2[j] = _mm512_reduce_add_pd(s0); dist2[j + 1] = _mm512_reduce_add_pd(s1); dist2[j + 2] = _mm512_reduce_add_pd(s2); dist2[j + 3] = _mm512_reduce_add_pd(s3); }
+	for ( ; j < nCentroids; ++j) {
+		const double *c = centroids + size_t(j) * stride; __m512d s = _mm512_setzero_pd();
+		for (int i = 0; i < stride; i += 8) { const __m512d d = _mm512_sub_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(c + i)); s = _mm512_fmadd_pd(d, d, s); }
+		dist2[j] = _mm512_reduce_add_pd(s); }
+}
+
+SS2_TARGET("avx512f") inline __m512d AddToF64(__m512d acc, __m512 s) { 
+	const __m256 hi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(s), 1));
+	return _mm512_add_pd(acc, _mm512_add_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(s)), _mm512_cvtps_pd(hi))); }
+
+SS2_TARGET("avx512f") void Dist2Avx512F32(const float *x, const float *centroids, int nCentroids, int stride, double *dist2)
+{
+	int j = 0;
+	for ( ; j + 4 <= nCentroids; j += 4) {
+		const float *c0 = centroids + size_t(j) * stride, *c1 = c0 + stride, *c2 = c1 + stride, *c3 = c2 + stride;
+		__m512d a0 = _mm512_setzero_pd(), a1 = a0, a2 = a0, a3 = a0;
+		for (int i0 = 0; i0 < stride; i0 += F32BlockLen) {
+			const int i1 = TInt::GetMn(i0 + F32BlockLen, stride);
+			__m512 s0 = _mm512_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+			for (int i = i0; i < i1; i += 16) {
+				const __m512 v = _mm512_loadu_ps(x + i); __m512 d;
+				d = _mm512_sub_ps(v, _mm512_loadu_ps(c0 + i)); s0 = _mm512_fmadd_ps(d, d, s0);
+				d = _mm512_sub_ps(v, _mm512_loadu_ps(c1 + i)); s1 = _mm512_fmadd_ps(d, d, s1);
+				d = _mm512_sub_ps(v, _mm512_loadu_ps(c2 + i)); s2 = _mm512_fmadd_ps(d, d, s2);
+				d = _mm512_sub_ps(v, _mm512_loadu_ps(c3 + i)); s3 = _mm512_fmadd_ps(d, d, s3); }
+			a0 = AddToF64(a0, s0); a1 = AddToF64(a1, s1); a2 = AddToF64(a2, s2); a3 = AddToF64(a3, s3); }
+		dist2[j] = _mm512_reduce_add_pd(a0); dist2[j + 1] = _mm512_reduce_add_pd(a1); dist2[j + 2] = _mm512_reduce_add_pd(a2); dist2[j + 3] = _mm512_reduce_add_pd(a3); }
+	for ( ; j < nCentroids; ++j) {
+		const float *c = centroids + size_t(j) * stride; __m512d a = _mm512_setzero_pd();
+		for (int i0 = 0; i0 < stride; i0 += F32BlockLen) {
+			const int i1 = TInt::GetMn(i0 + F32BlockLen, stride); __m512 s = _mm512_setzero_ps();
+			for (int i = i0; i < i1; i += 16) { const __m512 d = _mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(c + i)); s = _mm512_fmadd_ps(d, d, s); }
+			a = AddToF64(a, s); }
+		dist2[j] = _mm512_reduce_add_pd(a); }
+}
+
+#endif // SS2_X86
+
+//-----------------------------------------------------------------------------
+// Kernel selection
+//-----------------------------------------------------------------------------
+
+enum class TDistKernelLevel { Scalar, Sse2, Avx2, Avx512 };
+
+const TDistKernels AllKernels[] = {
+#ifdef SS2_X86
+	{ "avx512", Dist2Avx512F64, Dist2Avx512F32 },
+	{ "avx2", Dist2Avx2F64, Dist2Avx2F32 },
+	{ "sse2", Dist2Sse2F64, Dist2Sse2F32 },
+#endif
+	{ "scalar", Dist2ScalarF64, Dist2ScalarF32 } };
+const TDistKernelLevel AllKernelLevels[] = {
+#ifdef SS2_X86
+	TDistKernelLevel::Avx512, TDistKernelLevel::Avx2, TDistKernelLevel::Sse2,
+#endif
+	TDistKernelLevel::Scalar };
+
+// Returns the best instruction set that both the CPU and the OS support
+// (the OS must save the AVX and AVX-512 registers on context switches).
+TDistKernelLevel GetCpuLevel()
+{
+#if defined(SS2_X86) && defined(_MSC_VER)
+	int info[4]; __cpuid(info, 0); const int maxLeaf = info[0];
+	__cpuid(info, 1); const bool sse2 = (info[3] >> 26) & 1, fma = (info[2] >> 12) & 1, osxsave = (info[2] >> 27) & 1;
+	bool avx2 = false, avx512f = false;
+	if (maxLeaf >= 7) { __cpuidex(info, 7, 0); avx2 = (info[1] >> 5) & 1; avx512f = (info[1] >> 16) & 1; }
+	const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	const bool osAvx = (xcr0 & 0x06) == 0x06, osAvx512 = (xcr0 & 0xe6) == 0xe6;
+	if (avx512f && osAvx512) return TDistKernelLevel::Avx512;
+	if (avx2 && fma && osAvx) return TDistKernelLevel::Avx2;
+	if (sse2) return TDistKernelLevel::Sse2;
+	return TDistKernelLevel::Scalar;
+#elif defined(SS2_X86)
+	// __builtin_cpu_supports checks the OS support as well.
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return TDistKernelLevel::Avx512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return TDistKernelLevel::Avx2;
+	if (__builtin_cpu_supports("sse2")) return TDistKernelLevel::Sse2;
+	return TDistKernelLevel::Scalar;
+#else
+	return TDistKernelLevel::Scalar;
+#endif
+}
+
+} // namespace
+
+void TDistKernels::GetAll(TVec<const TDistKernels*>& dest)
+{
+	const TDistKernelLevel cpuLevel = GetCpuLevel(); dest.Clr();
+	for (int i = 0; i < int(sizeof(AllKernels) / sizeof(AllKernels[0])); ++i)
+		if (AllKernelLevels[i] <= cpuLevel) dest.Add(&AllKernels[i]);
+}
+
+const TDistKernels& TDistKernels::SelectBest()
+{
+	TVec<const TDistKernels*> all; GetAll(all);
+	NotifyInfo("TDistKernels: using the %s distance kernels.\n", all[0]->name);
+	return *all[0];
+}
+
+//-----------------------------------------------------------------------------
+// Benchmark
+//-----------------------------------------------------------------------------
+
+namespace {
+
+// Times 'kernel' on every row of 'rows' against all of 'centroids'; returns the seconds per pass
+// over the rows.  The results of the last pass are left in 'dist2' (nRows * nCentroids values).
+template<typename T, typename TKernel>
+double TimeDistKernel(TKernel kernel, const T *rows, int nRows, const T *centroids, int nCentroids, int stride, std::vector<double>& dist2)
+{
+	dist2.resize(size_t(nRows) * nCentroids);
+	int nPasses = 0; auto t0 = std::chrono::steady_clock::now(); double sec = 0;
+	do {
+		for (int rowNo = 0; rowNo < nRows; ++rowNo) kernel(rows + size_t(rowNo) * stride, centroids, nCentroids, stride, &dist2[size_t(rowNo) * nCentroids]);
+		++nPasses; sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count(); }
+	while (sec < 0.2);
+	return sec / nPasses;
+}
+
+double MaxRelDiff(const std::vector<double>& x, const std::vector<double>& y)
+{
+	double result = 0;
+	for (size_t i = 0; i < x.size(); ++i) { double d = fabs(x[i] - y[i]) / TFlt::GetMx(fabs(y[i]), 1e-300); if (d > result) result = d; }
+	return result;
+}
+
+} // namespace
+
+void BenchDistKernels()
+{
+	TVec<const TDistKernels*> kernels; TDistKernels::GetAll(kernels);
+	const TDistKernels &scalar = *kernels.Last();
+	printf("BenchDistKernels: best kernels on this CPU: %s.\n", kernels[0]->name);
+	// Each shape is (number of features, number of centroids); the number of rows is chosen
+	// so that the row matrix takes up about 32 MB in double precision.
+	const int shapes[][2] = { { 8, 10 }, { 16, 30 }, { 64, 30 }, { 256, 100 }, { 1000, 10 } };
+	TRnd rnd(1);
+	for (const auto &shape : shapes)
+	{
+		const int nFeatures = shape[0], nCentroids = shape[1], S = TDistKernels::StrideMultipleF32; // also a multiple of StrideMultipleF64
+		const int stride = (nFeatures + S - 1) / S * S, nRows = TInt::GetMx(1000, (32 << 20) / int(sizeof(double)) / stride);
+		std::vector<double> rows(size_t(nRows) * stride, 0), centroids(size_t(nCentroids) * stride, 0);
+		for (int rowNo = 0; rowNo < nRows; ++rowNo) for (int i = 0; i < nFeatures; ++i) rows[size_t(rowNo) * stride + i] = rnd.GetNrmDev();
+		for (int j = 0; j < nCentroids; ++j) for (int i = 0; i < nFeatures; ++i) centroids[size_t(j) * stride + i] = rnd.GetNrmDev();
+		std::vector<float> rowsF(rows.begin(), rows.end()), centroidsF(centroids.begin(), centroids.end());
+		// Each distance takes a subtraction, a multiplication and an addition per feature.
+		const double flops = 3.0 * double(nRows) * nCentroids * stride;
+		printf("  %d features (stride %d), %d centroids, %d rows:\n", nFeatures, stride, nCentroids, nRows);
+		std::vector<double> ref64, ref32, dist2;
+		TimeDistKernel(scalar.dist2F64, rows.data(), nRows, centroids.data(), nCentroids, stride, ref64);
+		TimeDistKernel(scalar.dist2F32, rowsF.data(), nRows, centroidsF.data(), nCentroids, stride, ref32);
+		for (const TDistKernels *k : kernels) {
+			const double sec64 = TimeDistKernel(k->dist2F64, rows.data(), nRows, centroids.data(), nCentroids, stride, dist2); const double diff64 = MaxRelDiff(dist2, ref64);
+			const double sec32 = TimeDistKernel(k->dist2F32, rowsF.data(), nRows, centroidsF.data(), nCentroids, stride, dist2); const double diff32 = MaxRelDiff(dist2, ref32);
+			printf("    %-7s double: %6.2f GFLOP/s (max. rel. diff. %.1e)   float: %6.2f GFLOP/s (max. rel. diff. %.1e)\n",
+				k->name, flops / sec64 * 1e-9, diff64, flops / sec32 * 1e-9, diff32); }
+	}
+}
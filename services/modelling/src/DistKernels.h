@@ -0,0 +1,42 @@
+#ifndef __DISTKERNELS_H_INCLUDED__
+#define __DISTKERNELS_H_INCLUDED__
+
+//-----------------------------------------------------------------------------
+// Distance kernels
+//-----------------------------------------------------------------------------
+// Squared Euclidean distances from one row to many centroids, as needed by k-means and
+// classification.  There is one implementation per instruction set (AVX-512, AVX2 + FMA,
+// SSE2, and plain C++ for everything else); the best one that the CPU supports is chosen
+// via CPUID when the kernels are first used, so the binary doesn't have to be built for
+// any particular CPU.
+//
+// A kernel sets dist2[j] = sum_i (x[i] - centroids[j * stride + i])^2 for 0 <= j < nCentroids.
+// 'stride' must be a multiple of StrideMultipleF64 or StrideMultipleF32 (the caller pads the vectors
+// with zeros); the vectors don't need to be aligned, but loads from aligned vectors are faster.
+// The float kernels compute the terms in float, but accumulate them in double (in blocks of a
+// few hundred features), so their results have a relative error of about 1e-6 at most.
+// The kernels may add up the terms in different orders, so their results can differ in the last few bits.
+
+class TDistKernels
+{
+public:
+	enum { StrideMultipleF64 = 8, StrideMultipleF32 = 16 };
+	typedef void (*TDist2F64)(const double *x, const double *centroids, int nCentroids, int stride, double *dist2);
+	typedef void (*TDist2F32)(const float *x, const float *centroids, int nCentroids, int stride, double *dist2);
+	const char *name; // "avx512", "avx2", "sse2" or "scalar"
+	TDist2F64 dist2F64;
+	TDist2F32 dist2F32;
+protected:
+	static const TDistKernels& SelectBest();
+public:
+	// Returns the best kernels that this CPU supports.
+	static const TDistKernels& Get() { static const TDistKernels& best = SelectBest(); return best; }
+	// Returns all the kernels that this CPU supports, the best ones first.
+	static void GetAll(TVec<const TDistKernels*>& dest);
+};
+
+// Runs all the supported kernels on a few matrix shapes and prints their speed in GFLOP/s
+// and the largest relative difference from the results of the scalar kernels.
+void BenchDistKernels();
+
+#endif // __DISTKERNELS_H_INCLUDED__
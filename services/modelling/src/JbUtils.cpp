@@ -1,5 +1,21 @@
 #include "pch.h"
 #include "JbUtils.h"
+#ifdef GLib_UNIX
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <errno.h>
+	#include <locale.h>
+	#ifdef __APPLE__
+		#include <xlocale.h>
+	#endif
+#endif
+#ifdef SS2_ZLIB
+	#include <zlib.h>
+#endif
+#ifdef SS2_ZSTD
+	#include <zstd.h>
+#endif
 using namespace std;
 
 //-----------------------------------------------------------------------------
@@ -284,6 +300,467 @@ bool ListDir(const TStr& dirName, TStrV& dest, bool includeSubDirNames, bool clr
 #endif
 }
 
+int64_t GetFileLen(const TStr& fileName)
+{
+#ifdef GLib_WIN
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	if (! GetFileAttributesExA(fileName.CStr(), GetFileExInfoStandard, &fad)) return -1;
+	return (int64_t(fad.nFileSizeHigh) << 32) | int64_t(fad.nFileSizeLow);
+#elif defined(GLib_UNIX)
+	struct stat st;
+	if (stat(fileName.CStr(), &st) != 0) return -1;
+	return (int64_t) st.st_size;
+#else
+#error Unsupported operating system.
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Memory-mapped files
+//-----------------------------------------------------------------------------
+
+bool TMappedFile::Open(const TStr& fileName)
+{
+	Close();
+#ifdef GLib_WIN
+	HANDLE hFile = CreateFileA(fileName.CStr(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER fileSize; if (! GetFileSizeEx(hFile, &fileSize)) { CloseHandle(hFile); return false; }
+	len = (size_t) fileSize.QuadPart;
+	SYSTEM_INFO si; GetSystemInfo(&si);
+	if (len > 0 && len % si.dwPageSize != 0)
+	{
+		HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		// The view keeps the mapping object alive, so we can close its handle right away.
+		if (hMapping) { data = (char *) MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0); CloseHandle(hMapping); }
+		mapped = (data != nullptr);
+	}
+	if (! mapped)
+	{
+		data = (char *) malloc(len + 1); if (! data) { CloseHandle(hFile); len = 0; return false; }
+		size_t pos = 0; while (pos < len) {
+			DWORD toRead = (DWORD) TMath::Mn<size_t>(len - pos, 1 << 30), nRead = 0;
+			if (! ReadFile(hFile, data + pos, toRead, &nRead, NULL) || nRead == 0) { CloseHandle(hFile); Close(); return false; }
+			pos += nRead; }
+	}
+	CloseHandle(hFile);
+#elif defined(GLib_UNIX)
+	int fd = open(fileName.CStr(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st; if (fstat(fd, &st) != 0) { close(fd); return false; }
+	len = (size_t) st.st_size;
+	const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+	if (len > 0 && len % pageSize != 0)
+	{
+		void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) { data = (char *) p; mapped = true; madvise(p, len, MADV_SEQUENTIAL); }
+	}
+	if (! mapped)
+	{
+		data = (char *) malloc(len + 1); if (! data) { close(fd); len = 0; return false; }
+		size_t pos = 0; while (pos < len) {
+			ssize_t nRead = read(fd, data + pos, len - pos);
+			if (nRead < 0 && errno == EINTR) continue;
+			if (nRead <= 0) { close(fd); Close(); return false; }
+			pos += (size_t) nRead; }
+	}
+	close(fd);
+#else
+#error Unsupported operating system.
+#endif
+	return true;
+}
+
+void TMappedFile::Close()
+{
+	if (data)
+	{
+#ifdef GLib_WIN
+		if (mapped) UnmapViewOfFile(data); else free(data);
+#else
+		if (mapped) munmap(data, len); else free(data);
+#endif
+	}
+	data = nullptr; len = 0; mapped = false;
+}
+
+//-----------------------------------------------------------------------------
+// Decompression
+//-----------------------------------------------------------------------------
+
+TCompression GetCompression(const TStr& fileName, const char *data, size_t len)
+{
+	if (len >= 2 && uchar(data[0]) == 0x1f && uchar(data[1]) == 0x8b) return TCompression::Gzip;
+	if (len >= 4 && uchar(data[0]) == 0x28 && uchar(data[1]) == 0xb5 && uchar(data[2]) == 0x2f && uchar(data[3]) == 0xfd) return TCompression::Zstd;
+	const TStr lc = fileName.ToLc();
+	if (lc.EndsWith(".gz") || lc.EndsWith(".gzip")) return TCompression::Gzip;
+	if (lc.EndsWith(".zst") || lc.EndsWith(".zstd")) return TCompression::Zstd;
+	return TCompression::None;
+}
+
+TStr StripCompressionExt(const TStr& fileName)
+{
+	const TStr lc = fileName.ToLc();
+	for (const char *ext : { ".gz", ".gzip", ".zst", ".zstd" })
+		if (lc.EndsWith(ext)) return Slice(fileName, 0, fileName.Len() - int(strlen(ext)));
+	return fileName;
+}
+
+TDecompressor::TDecompressor(TCompression compression_, const char *data_, size_t len_, size_t blockSize_, int maxBlocks) :
+	compression(compression_), data(data_), len(len_), blockSize(blockSize_), head(0), nFull(0), finished(false), cancelled(false)
+{
+	blocks.resize(std::max(maxBlocks, 1));
+	thread = std::thread([this] () { Run(); });
+}
+
+TDecompressor::~TDecompressor()
+{
+	{ std::unique_lock<std::mutex> lock { mutex }; cancelled = true; }
+	cvFree.notify_all();
+	thread.join();
+}
+
+char *TDecompressor::GetFreeBlock()
+{
+	std::unique_lock<std::mutex> lock { mutex };
+	cvFree.wait(lock, [this] () { return cancelled || nFull < int(blocks.size()); });
+	if (cancelled) return nullptr;
+	std::vector<char> &block = blocks[(head + nFull) % blocks.size()];
+	block.resize(blockSize); return block.data();
+}
+
+void TDecompressor::PutBlock(size_t n)
+{
+	{ std::unique_lock<std::mutex> lock { mutex };
+	  blocks[(head + nFull) % blocks.size()].resize(n); ++nFull; }
+	cvFull.notify_one();
+}
+
+bool TDecompressor::Read(TChA& dest)
+{
+	std::unique_lock<std::mutex> lock { mutex };
+	cvFull.wait(lock, [this] () { return nFull > 0 || finished; });
+	if (nFull == 0) { errMsg = error; return false; }
+	// The producer doesn't touch the block at 'head' while it's full, so it can be copied without holding the lock.
+	std::vector<char> &block = blocks[head];
+	lock.unlock();
+	if (! block.empty()) dest.AddBf(block.data(), int(block.size()));
+	lock.lock(); head = (head + 1) % int(blocks.size()); --nFull; lock.unlock();
+	cvFree.notify_one();
+	return true;
+}
+
+void TDecompressor::Run()
+{
+	TStr err; char *out = nullptr; size_t outLen = 0;
+	// Queues the current block if it is full (or if 'flush' is set and it's not empty), and gets a new one if necessary.
+	auto NextOut = [this, &out, &outLen] (bool flush) {
+		if (out && (outLen == blockSize || (flush && outLen > 0))) { PutBlock(outLen); out = nullptr; }
+		if (! out && ! flush) { out = GetFreeBlock(); outLen = 0; }
+		return flush || out != nullptr; };
+	if (compression == TCompression::Gzip)
+	{
+#ifdef SS2_ZLIB
+		z_stream zs; memset(&zs, 0, sizeof(zs));
+		// 15 + 32: the largest window size, and automatic detection of the gzip or zlib header.
+		if (inflateInit2(&zs, 15 + 32) != Z_OK) err = "Error initializing zlib.";
+		size_t inPos = 0;
+		while (err.Empty() && NextOut(false))
+		{
+			// zlib's lengths are 32-bit, so large inputs are fed to it in pieces.
+			if (zs.avail_in == 0 && inPos < len) { const size_t n = std::min(len - inPos, size_t(1) << 30); zs.next_in = (Bytef *) (data + inPos); zs.avail_in = uInt(n); inPos += n; }
+			zs.next_out = (Bytef *) (out + outLen); zs.avail_out = uInt(blockSize - outLen);
+			const int rc = inflate(&zs, Z_NO_FLUSH);
+			outLen = blockSize - zs.avail_out;
+			if (rc == Z_STREAM_END) {
+				// A gzip file may consist of several members, which should be concatenated.
+				if (zs.avail_in == 0 && inPos >= len) break;
+				inflateReset(&zs); }
+			else if (rc == Z_BUF_ERROR && zs.avail_in == 0 && inPos >= len) err = "The gzip data is truncated.";
+			else if (rc != Z_OK && rc != Z_BUF_ERROR) err = TStr::Fmt("Error in gzip data: %s", zs.msg ? zs.msg : "unknown error.");
+		}
+		inflateEnd(&zs);
+#else
+		err = "This build does not support gzip-compressed data (compile with SS2_ZLIB).";
+#endif
+	}
+	else if (compression == TCompression::Zstd)
+	{
+#ifdef SS2_ZSTD
+		ZSTD_DStream *zs = ZSTD_createDStream();
+		if (! zs || ZSTD_isError(ZSTD_initDStream(zs))) err = "Error initializing zstd.";
+		ZSTD_inBuffer in = { data, len, 0 }; size_t rc = 0; bool outFull = false;
+		while (err.Empty() && NextOut(false))
+		{
+			// If the output buffer was filled, zstd may still have some output pending even after consuming all the input.
+			if (in.pos >= in.size && ! outFull) {
+				// rc == 0 means that the last frame has been completed.
+				if (rc != 0) err = "The zstd data is truncated.";
+				break; }
+			ZSTD_outBuffer outBuf = { out, blockSize, outLen };
+			rc = ZSTD_decompressStream(zs, &outBuf, &in);
+			outFull = (outBuf.pos == outBuf.size); outLen = outBuf.pos;
+			if (ZSTD_isError(rc)) err = TStr::Fmt("Error in zstd data: %s", ZSTD_getErrorName(rc));
+		}
+		ZSTD_freeDStream(zs);
+#else
+		err = "This build does not support zstd-compressed data (compile with SS2_ZSTD).";
+#endif
+	}
+	else err = "Unknown compression format.";
+	if (err.Empty()) NextOut(true);
+	{ std::unique_lock<std::mutex> lock { mutex }; finished = true; error = err; }
+	cvFull.notify_all();
+}
+
+//-----------------------------------------------------------------------------
+// Number parsing
+//-----------------------------------------------------------------------------
+
+namespace {
+
+inline bool IsBlank(char c) { return c == ' ' || c == '\t'; }
+
+inline void TrimBlanks(const char *&p, const char *&end) {
+	while (p < end && IsBlank(*p)) ++p;
+	while (end > p && IsBlank(end[-1])) --end; }
+
+// Parses [sign] digits; the caller should trim the blanks first.
+// Returns false if there are no digits, if there is anything after them,
+// or if the value is not in [-maxNeg, maxPos].
+bool ParseIntCore(const char *p, const char *end, uint64_t maxPos, uint64_t maxNeg, bool& neg, uint64_t& absValue)
+{
+	neg = false;
+	if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+	if (p >= end) return false;
+	const uint64_t maxAbs = neg ? maxNeg : maxPos;
+	uint64_t x = 0;
+	for ( ; p < end; ++p) {
+		const unsigned d = unsigned(uchar(*p) - '0'); if (d > 9) return false;
+		if (x > (maxAbs - d) / 10) return false;
+		x = x * 10 + d; }
+	absValue = x; return true;
+}
+
+// The high 64 bits of the 128-bit product a * b; the low 64 bits are stored into 'lo'.
+inline uint64_t MulHi64(uint64_t a, uint64_t b, uint64_t& lo)
+{
+#if defined(__SIZEOF_INT128__)
+	const unsigned __int128 r = (unsigned __int128) a * b; lo = (uint64_t) r; return (uint64_t) (r >> 64);
+#elif defined(_M_X64)
+	uint64_t hi; lo = _umul128(a, b, &hi); return hi;
+#else
+	const uint64_t aLo = uint32_t(a), aHi = a >> 32, bLo = uint32_t(b), bHi = b >> 32;
+	const uint64_t ll = aLo * bLo, lh = aLo * bHi, hl = aHi * bLo, hh = aHi * bHi;
+	const uint64_t mid = (ll >> 32) + uint32_t(lh) + uint32_t(hl);
+	lo = (mid << 32) | uint32_t(ll);
+	return hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+inline int CountLeadingZeros64(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long i; _BitScanReverse64(&i, x); return 63 - int(i);
+#elif defined(_MSC_VER)
+	unsigned long i; if (_BitScanReverse(&i, uint32_t(x >> 32))) return 31 - int(i);
+	_BitScanReverse(&i, uint32_t(x)); return 63 - int(i);
+#else
+	return __builtin_clzll(x);
+#endif
+}
+
+// The powers 5^q for MinPow5 <= q <= MaxPow5, as needed by the Eisel-Lemire algorithm: 
+// each one is normalized (multiplied by a power of 2 so that it lies in [2^127, 2^128)) and 
+// truncated to 128 bits.  The table is computed with exact big-integer arithmetic when it is first needed.
+class TPow5Table
+{
+public:
+	enum { MinPow5 = -342, MaxPow5 = 308 };
+	uint64_t hi[MaxPow5 - MinPow5 + 1], lo[MaxPow5 - MinPow5 + 1];
+	TPow5Table();
+	static const TPow5Table& Get() { static const TPow5Table table; return table; }
+protected:
+	typedef std::vector<uint32_t> TBigNum; // little-endian
+	static int BitLen(const TBigNum& x) { 
+		int n = int(x.size()); while (n > 0 && x[n - 1] == 0) --n; if (n == 0) return 0;
+		int b = 32; while (! (x[n - 1] >> (b - 1))) --b; return 32 * (n - 1) + b; }
+	static bool GetBit(const TBigNum& x, int i) { return (i >> 5) < int(x.size()) && ((x[i >> 5] >> (i & 31)) & 1); }
+};
+
+TPow5Table::TPow5Table()
+{
+	// Non-negative powers: take the top 128 bits of the exact value of 5^q.
+	TBigNum pow5 { 1 };
+	for (int q = 0; q <= MaxPow5; ++q)
+	{
+		if (q > 0) { uint64_t carry = 0; 
+			for (uint32_t& w : pow5) { uint64_t t = uint64_t(w) * 5 + carry; w = uint32_t(t); carry = t >> 32; } 
+			if (carry) pow5.push_back(uint32_t(carry)); }
+		const int len = BitLen(pow5); uint64_t h = 0, l = 0;
+		for (int i = 0; i < 128; ++i) {
+			const int bit = len - 1 - i; const bool b = (bit >= 0) && GetBit(pow5, bit);
+			h = (h << 1) | (l >> 63); l = (l << 1) | (b ? 1 : 0); }
+		hi[q - MinPow5] = h; lo[q - MinPow5] = l;
+	}
+	// Negative powers: 2^k / 5^-q by binary long division, skipping the leading zero bits of the quotient.
+	pow5 = { 1 };
+	for (int q = -1; q >= MinPow5; --q)
+	{
+		uint64_t carry = 0;
+		for (uint32_t& w : pow5) { uint64_t t = uint64_t(w) * 5 + carry; w = uint32_t(t); carry = t >> 32; }
+		if (carry) pow5.push_back(uint32_t(carry));
+		// The remainder always stays below 2 * 5^-q.
+		TBigNum rem(pow5.size() + 1, 0); rem[0] = 1;
+		uint64_t h = 0, l = 0; int nBits = 0;
+		while (nBits < 128)
+		{
+			// rem <<= 1
+			uint32_t c = 0; for (uint32_t& w : rem) { uint32_t nc = w >> 31; w = (w << 1) | c; c = nc; }
+			// if (rem >= pow5) { rem -= pow5; bit = 1; }
+			bool ge = true;
+			for (int i = int(rem.size()) - 1; i >= 0; --i) {
+				const uint32_t a = rem[i], b = (i < int(pow5.size())) ? pow5[i] : 0;
+				if (a != b) { ge = (a > b); break; } }
+			if (ge) { int64_t borrow = 0;
+				for (int i = 0; i < int(rem.size()); ++i) {
+					int64_t t = int64_t(rem[i]) - ((i < int(pow5.size())) ? pow5[i] : 0) - borrow;
+					borrow = (t < 0) ? 1 : 0; rem[i] = uint32_t(t + (borrow << 32)); } }
+			if (nBits == 0 && ! ge) continue;
+			h = (h << 1) | (l >> 63); l = (l << 1) | (ge ? 1 : 0); ++nBits;
+		}
+		hi[q - MinPow5] = h; lo[q - MinPow5] = l;
+	}
+}
+
+// Computes w * 10^q using the Eisel-Lemire algorithm.  Returns false (and the caller
+// should fall back to a slower method) if the result might not be correctly rounded
+// or would be subnormal or infinite.
+bool EiselLemire(uint64_t w, int q, bool neg, double& value)
+{
+	if (w == 0 || q < TPow5Table::MinPow5 || q > TPow5Table::MaxPow5) return false;
+	// Exact halfway cases with q < 0 are only possible for q >= -4; the truncated 
+	// negative powers of 5 can't detect them, so these are left to the fallback.
+	if (-4 <= q && q < 0) return false;
+	const TPow5Table& table = TPow5Table::Get();
+	const int lz = CountLeadingZeros64(w); w <<= lz;
+	uint64_t zLo, zHi = MulHi64(w, table.hi[q - TPow5Table::MinPow5], zLo);
+	if ((zHi & 0x1ff) == 0x1ff && zLo + w < zLo)
+	{
+		uint64_t yLo, yHi = MulHi64(w, table.lo[q - TPow5Table::MinPow5], yLo);
+		const uint64_t mergedLo = zLo + yHi; if (mergedLo < zLo) ++zHi;
+		if ((zHi & 0x1ff) == 0x1ff && mergedLo + 1 == 0 && yLo + w < yLo) return false;
+		zLo = mergedLo;
+	}
+	const int upperBit = int(zHi >> 63);
+	uint64_t m = zHi >> (upperBit + 9);
+	if (zLo == 0 && (zHi & 0x1ff) == 0 && (m & 3) == 1) return false; // possible tie
+	m += m & 1; m >>= 1;
+	// floor(q * log2(10)) == (217706 * q) >> 16 for the range of q that we support
+	int exp2 = int((int64_t(217706) * q) >> 16) + 63 + upperBit - lz + 1023;
+	if (m >= (uint64_t(1) << 53)) { m = uint64_t(1) << 52; ++exp2; }
+	if (exp2 <= 0 || exp2 >= 0x7ff) return false;
+	const uint64_t bits = (m & ((uint64_t(1) << 52) - 1)) | (uint64_t(exp2) << 52) | (uint64_t(neg ? 1 : 0) << 63);
+	memcpy(&value, &bits, sizeof(value)); return true;
+}
+
+bool ParseFlt_Fallback(const char *p, const char *end, double& value)
+{
+	// strtod needs a NUL-terminated string.
+	char buf[128]; std::string longBuf; const size_t len = end - p; const char *s;
+	if (len < sizeof(buf)) { memcpy(buf, p, len); buf[len] = 0; s = buf; }
+	else { longBuf.assign(p, len); s = longBuf.c_str(); }
+	char *sEnd = nullptr;
+#ifdef GLib_WIN
+	static _locale_t cLocale = _create_locale(LC_NUMERIC, "C");
+	value = _strtod_l(s, &sEnd, cLocale);
+#else
+	static locale_t cLocale = newlocale(LC_NUMERIC_MASK, "C", (locale_t) 0);
+	value = strtod_l(s, &sEnd, cLocale);
+#endif
+	return sEnd == s + len && len > 0;
+}
+
+}
+
+bool ParseInt(const char *p, const char *end, int& value)
+{
+	TrimBlanks(p, end); bool neg; uint64_t x;
+	if (! ParseIntCore(p, end, uint64_t(INT_MAX), uint64_t(INT_MAX) + 1, neg, x)) return false;
+	value = neg ? int(-int64_t(x)) : int(x); return true;
+}
+
+bool ParseInt64(const char *p, const char *end, int64_t& value)
+{
+	TrimBlanks(p, end); bool neg; uint64_t x;
+	if (! ParseIntCore(p, end, uint64_t(INT64_MAX), uint64_t(INT64_MAX) + 1, neg, x)) return false;
+	value = neg ? int64_t(0 - x) : int64_t(x); return true;
+}
+
+bool ParseFlt(const char *p, const char *end, double& value)
+{
+	TrimBlanks(p, end);
+	const char *s = p; bool neg = false;
+	if (s < end && (*s == '-' || *s == '+')) neg = (*s++ == '-');
+	// Mantissa: up to 19 significant digits fit into a uint64_t.
+	uint64_t w = 0; int nSigDigits = 0, exp10 = 0; bool anyDigits = false;
+	while (s < end && *s == '0') { ++s; anyDigits = true; }
+	for ( ; s < end && unsigned(uchar(*s) - '0') <= 9; ++s) { w = w * 10 + unsigned(uchar(*s) - '0'); ++nSigDigits; anyDigits = true; }
+	if (s < end && *s == '.')
+	{
+		++s;
+		if (w == 0) while (s < end && *s == '0') { ++s; --exp10; anyDigits = true; }
+		for ( ; s < end && unsigned(uchar(*s) - '0') <= 9; ++s) { w = w * 10 + unsigned(uchar(*s) - '0'); ++nSigDigits; --exp10; anyDigits = true; }
+	}
+	if (! anyDigits || nSigDigits > 19) return ParseFlt_Fallback(p, end, value);
+	if (s < end && (*s == 'e' || *s == 'E'))
+	{
+		++s; bool expNeg = false;
+		if (s < end && (*s == '-' || *s == '+')) expNeg = (*s++ == '-');
+		if (s >= end) return false;
+		int e = 0;
+		for ( ; s < end && unsigned(uchar(*s) - '0') <= 9; ++s) if (e < 100000) e = e * 10 + (*s - '0');
+		exp10 += expNeg ? -e : e;
+	}
+	if (s != end) return ParseFlt_Fallback(p, end, value);
+	if (w == 0) { value = neg ? -0.0 : 0.0; return true; }
+	// Clinger's fast path: both w and 10^|exp10| are exactly representable, so a single 
+	// multiplication or division gives a correctly rounded result.
+	static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	if (w <= (uint64_t(1) << 53) && -22 <= exp10 && exp10 <= 22) {
+		double x = double(w); x = (exp10 < 0) ? x / pow10[-exp10] : x * pow10[exp10];
+		value = neg ? -x : x; return true; }
+	if (EiselLemire(w, exp10, neg, value)) return true;
+	return ParseFlt_Fallback(p, end, value);
+}
+
+//-----------------------------------------------------------------------------
+// Base64
+//-----------------------------------------------------------------------------
+
+bool DecodeBase64(const char *p, const char *end, TChA& dest)
+{
+	unsigned int bits = 0; int nBits = 0, nPad = 0;
+	for ( ; p < end; ++p)
+	{
+		const char c = *p; int v;
+		if (c >= 'A' && c <= 'Z') v = c - 'A';
+		else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+		else if (c >= '0' && c <= '9') v = c - '0' + 52;
+		else if (c == '+') v = 62;
+		else if (c == '/') v = 63;
+		else if (c == '=') { ++nPad; continue; }
+		else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') continue;
+		else return false;
+		if (nPad > 0) return false; // data after the padding
+		bits = (bits << 6) | unsigned(v); nBits += 6;
+		if (nBits >= 8) { nBits -= 8; dest += char((bits >> nBits) & 0xff); }
+	}
+	// A single leftover character (6 bits) can't encode a whole byte.
+	return nBits < 6 && nPad <= 2;
+}
+
 // ----------------------------------------------------------------------------
 // Time-related utilities - implementation
 // ----------------------------------------------------------------------------
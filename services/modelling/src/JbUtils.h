@@ -63,6 +63,158 @@ inline bool TDir_Exists(const TStr& FPathFNm)
 // 'dirName' may contain a trailing '/' (on unix) or '\\' (on windows), but doesn't have to.
 bool ListDir(const TStr& dirName, TStrV& dest, bool includeSubDirNames, bool clrDest = true);
 
+// Returns the size of the file in bytes, or -1 if it doesn't exist or can't be accessed.
+int64_t GetFileLen(const TStr& fileName);
+
+//-----------------------------------------------------------------------------
+// Memory-mapped files
+//-----------------------------------------------------------------------------
+// Maps an entire file into memory for reading.  The mapping is private (copy-on-write),
+// so the caller may modify the data in place (e.g. to unescape and NUL-terminate fields
+// while parsing) without affecting the file.  There is always at least one writable byte
+// after the end of the data, i.e. GetData()[Len()] may be overwritten.  If the file size
+// is an exact multiple of the page size, a mapping would have no such slack, so in that
+// case (and if the mapping fails for any other reason) the file is read into a heap buffer.
+
+class TMappedFile
+{
+protected:
+	char *data;
+	size_t len;
+	bool mapped; // true if 'data' is a memory mapping; false if it's a heap buffer allocated by malloc
+	TMappedFile(const TMappedFile&) = delete;
+	TMappedFile& operator = (const TMappedFile&) = delete;
+public:
+	TMappedFile() : data(nullptr), len(0), mapped(false) { }
+	~TMappedFile() { Close(); }
+	bool Open(const TStr& fileName);
+	void Close();
+	bool IsOpen() const { return data != nullptr; }
+	bool IsMapped() const { return mapped; }
+	char *GetData() const { return data; }
+	size_t Len() const { return len; }
+};
+
+//-----------------------------------------------------------------------------
+// Decompression
+//-----------------------------------------------------------------------------
+// TDecompressor decompresses gzip or zstd data on a background thread, which puts the
+// decompressed data, in blocks of 'blockSize' bytes, into a queue of at most 'maxBlocks' blocks;
+// the consumer takes them from there with Read.  The decompression of the next few blocks thus
+// overlaps with the processing of the current one, while the amount of memory used stays bounded.
+// The compressed data must stay alive as long as the decompressor.  Support for gzip (zlib) and
+// zstd is only compiled in if SS2_ZLIB and SS2_ZSTD, respectively, are defined.
+
+enum class TCompression { None, Gzip, Zstd };
+
+// Recognizes the format by the magic bytes at the start of the data or, failing that, by the file name extension.
+TCompression GetCompression(const TStr& fileName, const char *data, size_t len);
+// Removes the extension of a compressed file, e.g. "data.csv.gz" -> "data.csv".
+TStr StripCompressionExt(const TStr& fileName);
+
+class TDecompressor
+{
+protected:
+	const TCompression compression; const char *data; const size_t len;
+	const size_t blockSize;
+	std::vector<std::vector<char>> blocks; // a circular queue; the blocks from 'head' to 'head + nFull - 1' are ready for the consumer
+	int head, nFull;
+	bool finished, cancelled; // finished = the producer has queued its last block
+	TStr error;
+	std::mutex mutex; std::condition_variable cvFull, cvFree;
+	std::thread thread;
+	// Called by the background thread: GetFreeBlock waits until a block is free and returns it (or nullptr if 
+	// the decompressor is being destroyed); PutBlock queues it after 'n' bytes have been written into it.
+	char *GetFreeBlock();
+	void PutBlock(size_t n);
+	void Run();
+	TDecompressor(const TDecompressor&) = delete;
+	TDecompressor& operator = (const TDecompressor&) = delete;
+public:
+	TStr errMsg; // set if Read returns false because of an error
+	TDecompressor(TCompression compression_, const char *data_, size_t len_, size_t blockSize_ = size_t(4) << 20, int maxBlocks = 8);
+	~TDecompressor();
+	// Waits for the next block of decompressed data and appends it to 'dest'.
+	// Returns false (and appends nothing) at the end of the data or in case of an error.
+	bool Read(TChA& dest);
+};
+
+//-----------------------------------------------------------------------------
+// Number parsing
+//-----------------------------------------------------------------------------
+// Locale-independent parsers for the characters [p, end).  Leading and trailing spaces
+// and tabs are allowed, anything else besides the number itself is an error.
+// The integer parsers fail if the value is out of range.  ParseFlt is correctly rounded;
+// it handles the common cases itself (using Clinger's fast path and the Eisel-Lemire
+// algorithm) and leaves the rest (e.g. inf, nan, hexadecimal notation, more than 19
+// significant digits, subnormal results) to strtod in the "C" locale.
+
+bool ParseInt(const char *p, const char *end, int& value);
+bool ParseInt64(const char *p, const char *end, int64_t& value);
+bool ParseFlt(const char *p, const char *end, double& value);
+
+//-----------------------------------------------------------------------------
+// Base64
+//-----------------------------------------------------------------------------
+// Decodes the standard base64 encoding (RFC 4648) of [p, end) and appends the result to 'dest'.
+// Whitespace is skipped and the padding at the end is optional.  Returns false if the input
+// contains any other characters or is truncated.
+
+bool DecodeBase64(const char *p, const char *end, TChA& dest);
+
+//-----------------------------------------------------------------------------
+// Parallel loops
+//-----------------------------------------------------------------------------
+// Resolves a user-specified number of threads: a value <= 0 means "one per hardware thread".
+inline int GetNumThreads(int nThreads) {
+	if (nThreads > 0) return nThreads;
+	int n = (int) std::thread::hardware_concurrency(); return (n > 0) ? n : 1; }
+
+// Calls f(i) for i = 0, 1, ..., n - 1 using up to 'nThreads' threads (including the calling one;
+// see GetNumThreads for the meaning of nThreads <= 0).  The indices are handed out dynamically,
+// so the calls may differ in cost.  If only one thread is used, the calls are made in order on the
+// calling thread.  'f' must be safe to call concurrently for different indices and must not throw.
+template<typename TFunc>
+void ParallelFor(int n, int nThreads, const TFunc& f)
+{
+	nThreads = GetNumThreads(nThreads); if (nThreads > n) nThreads = n;
+	if (nThreads <= 1) { for (int i = 0; i < n; ++i) f(i); return; }
+	std::atomic<int> next { 0 };
+	auto Worker = [&next, n, &f] () { for (int i = next++; i < n; i = next++) f(i); };
+	std::vector<std::thread> threads; threads.reserve(nThreads - 1);
+	for (int t = 1; t < nThreads; ++t) threads.emplace_back(Worker);
+	Worker();
+	for (std::thread& thread : threads) thread.join();
+}
+
+// Sorts v[0..n - 1] stably by 'less' using up to 'nThreads' threads: the vector is split into one block per thread,
+// the blocks are sorted in parallel, and then adjacent runs are merged pairwise (also in parallel) until one run is left.
+// Small vectors are sorted on the calling thread.
+template<typename T, typename TLess>
+void ParallelStableSort(TVec<T>& v, int nThreads, const TLess& less)
+{
+	const int n = v.Len(), MinBlockLen = 1 << 14;
+	int nBlocks = TInt::GetMn(GetNumThreads(nThreads), n / MinBlockLen); 
+	if (nBlocks <= 1) { if (n > 1) std::stable_sort(&v[0], &v[0] + n, less); return; }
+	TIntV bounds; for (int i = 0; i <= nBlocks; ++i) bounds.Add(int(int64_t(n) * i / nBlocks));
+	ParallelFor(nBlocks, nBlocks, [&v, &bounds, &less] (int i) { std::stable_sort(&v[0] + bounds[i], &v[0] + bounds[i + 1], less); });
+	TVec<T> buf(n); T *src = &v[0], *dest = &buf[0];
+	while (bounds.Len() > 2)
+	{
+		// Merge runs 2k and 2k + 1 into one; an odd run at the end is copied.  std::merge takes equal
+		// elements from the first run first, so the result is stable.
+		const int nRuns = bounds.Len() - 1, nPairs = (nRuns + 1) / 2;
+		ParallelFor(nPairs, nThreads, [src, dest, nRuns, &bounds, &less] (int k) {
+			const int from = bounds[2 * k], mid = bounds[2 * k + 1], to = bounds[TInt::GetMn(2 * k + 2, nRuns)];
+			if (2 * k + 1 < nRuns) std::merge(src + from, src + mid, src + mid, src + to, dest + from, less);
+			else std::copy(src + from, src + mid, dest + from); });
+		TIntV newBounds; for (int i = 0; i < bounds.Len(); i += 2) newBounds.Add(bounds[i]);
+		if (newBounds.Last() != n) newBounds.Add(n);
+		bounds = newBounds; std::swap(src, dest);
+	}
+	if (src != &v[0]) std::copy(src, src + n, &v[0]);
+}
+
 //-----------------------------------------------------------------------------
 // String slicing
 //-----------------------------------------------------------------------------
@@ -159,10 +159,13 @@ public:
 		// Initialize the dataset.
 		PDataset dataset = new TDataset();
 		dataset->InitColsFromConfig(config);
-		if (! dataset->ReadDataFromJsonDataSourceSpec(req.inJson->GetObjKey("dataSource"), req.errList)) { req.status = "error"; return false; }
-		if (! dataset->ApplyOps(req.errList)) { req.status = "error"; return false; }
+		TDatasetSnapshot snapshot { *dataset, req.inJson->GetObjKey("dataSource"), true };
+		const bool fromSnapshot = snapshot.Load(req.errList);
+		if (! fromSnapshot) {
+			if (! dataset->ReadDataFromJsonDataSourceSpec(req.inJson->GetObjKey("dataSource"), req.errList)) { req.status = "error"; return false; }
+			if (! dataset->ApplyOps(req.errList)) { req.status = "error"; return false; } }
 		if (dataset->nRows < config->numInitialStates) { req.status = "error"; req.errList.Add(TStr::Fmt("Not enough data (%d initial states were requested, %d rows are available).", config->numInitialStates, dataset->nRows)); return false; }
-		dataset->CalcDefaultDistWeights();
+		if (! fromSnapshot) { dataset->CalcDefaultDistWeights(); snapshot.Save(req.errList); }
 		// Build the model.
 		PModel model = new TModel(dataset);
 		TKMeansRunner::BuildInitialStates(*model);
@@ -211,8 +214,13 @@ public:
 		// Initialize the dataset.
 		PDataset dataset = new TDataset();
 		dataset->InitColsFromConfig(config);
-		if (! dataset->ReadDataFromJsonDataSourceSpec(req.inJson->GetObjKey("dataSource"), req.errList)) { req.status = "error"; return false; }
-		if (! dataset->ApplyOps(req.errList)) { req.status = "error"; return false; }
+		// Classification only needs the columns used by the distance function, so ops that don't contribute to them can be skipped.
+		for (const TDataColumn& col : dataset->cols) dataset->neededCols.Add(col.distWeight != 0 && col.type != TAttrType::Time);
+		TDatasetSnapshot snapshot { *dataset, req.inJson->GetObjKey("dataSource"), false };
+		if (! snapshot.Load(req.errList)) {
+			if (! dataset->ReadDataFromJsonDataSourceSpec(req.inJson->GetObjKey("dataSource"), req.errList)) { req.status = "error"; return false; }
+			if (! dataset->ApplyOps(req.errList)) { req.status = "error"; return false; }
+			snapshot.Save(req.errList); }
 		// if (dataset->nRows < config->numInitialStates) { req.status = "error"; req.errList.Add(TStr::Fmt("Not enough data (%d initial states were requested, %d rows are available).", config->numInitialStates, dataset->nRows)); return false; }
 		// dataset->CalcDefaultDistWeights(); // the config we loaded from the model has the actual distance weights used when building the model
 		// Initialize the model.
@@ -222,6 +230,10 @@ public:
 		TIntV allRowNos, predictions; for (int i = 0; i < dataset->nRows; ++i) allRowNos.Add(i);
 		if (! model->ClassifyInstances(*dataset, allRowNos, predictions, req.errList)) { req.status = "error"; return false; }
 		//
+		// If the rows were reordered or merged after reading, report one prediction per input row, in the order of the input rows.
+		if (! dataset->inputRowMap.Empty()) { 
+			TIntV v; for (int rowNo : dataset->inputRowMap) v.Add(predictions[rowNo]);
+			predictions.Swap(v); }
 		req.outJson->AddToObj("classifications", TJsonVal::NewArr(predictions));
 		req.status = "ok"; return true;
 	}
@@ -247,6 +259,8 @@ int TestBuildModelRequest()
 
 void TestStrPFTime();
 void TestLinRegr();
+void TestDuplicateTimesWithOps();
+void BenchNumConv();
 
 //-----------------------------------------------------------------------------
 
@@ -265,8 +279,9 @@ int main(int argc, char** argv)
 	TStr logFileName = Env.GetIfArgPrefixStr("-logfile:", "", "Log file name (use * to get a suitable default filename)");
 	bool logStdOut = Env.GetIfArgPrefixBool("-logstdout:", true, "Log to stdout");
 	TStr fnUnicodeDef = Env.GetIfArgPrefixStr("-fnUnicodeDef:", "UnicodeDef.bin", "UnicodeDef.bin path and file name");
-	TStr command = Env.GetIfArgPrefixStr("-cmd:", "runServer", "What to do (runServer)");
+	TStr command = Env.GetIfArgPrefixStr("-cmd:", "runServer", "What to do (runServer, benchConv, benchDist, testDuplicateTimes)");
 	TStr fnSettingsJson = Env.GetIfArgPrefixStr("-fnSettingsJson:", "settingsStreamStory2.json", "JSON settings file name");
+	TStr snapshotDir = Env.GetIfArgPrefixStr("-snapshotDir:", "", "Directory for dataset snapshots (empty = don't use snapshots)");
     if (Env.IsEndOfRun()) { return 0; }
 
 	TUnicodeDef::Load(fnUnicodeDef);
@@ -277,6 +292,9 @@ int main(int argc, char** argv)
 	if (logFileName.StartsWith("*")) logFileName = "StreamStory2-serverLog.txt";
 	if (! logFileName.Empty()) { PNotify fileNotify = new TFileNotify(logFileName); NotifyVAdd(fileNotify); }
 
+	if (! snapshotDir.Empty() && ! TDir_Exists(snapshotDir)) TDir::GenDir(snapshotDir);
+	TDatasetSnapshot::dirName = snapshotDir;
+
 	if (false) return TestBuildModelRequest();
 	if (command == "runServer")
 	{
@@ -295,6 +313,9 @@ int main(int argc, char** argv)
 		TLoop::Run();
 		uvAsync.CleanUpNotificationHandler();
 	}
+	else if (command == "benchConv") BenchNumConv();
+	else if (command == "benchDist") BenchDistKernels();
+	else if (command == "testDuplicateTimes") TestDuplicateTimesWithOps();
 
     return 0;
 }
@@ -1,6 +1,44 @@
 #include "pch.h"
 #include "StreamStory2.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define SS2_SSE2
+#endif
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+// Returns the index of the lowest set bit of 'x', which must not be 0.
+inline int LowestSetBit(unsigned x) 
+{
+#ifdef _MSC_VER
+	unsigned long i; _BitScanForward(&i, x); return (int) i;
+#else
+	return __builtin_ctz(x);
+#endif
+}
+
+// Returns the index of the highest set bit of 'x', which must not be 0.
+inline int HighestSetBit(unsigned x) 
+{
+#ifdef _MSC_VER
+	unsigned long i; _BitScanReverse(&i, x); return (int) i;
+#else
+	return 31 - __builtin_clz(x);
+#endif
+}
+
+// Returns the number of set bits in 'x'.
+inline int BitCount(unsigned x) 
+{
+#ifdef _MSC_VER
+	int n = 0; while (x) { x &= x - 1; ++n; } return n; // __popcnt requires a CPU with POPCNT
+#else
+	return __builtin_popcount(x);
+#endif
+}
+
 bool Json_GetObjStr(const PJsonVal& jsonVal, const char *key, bool allowMissing, const TStr& defaultValue, TStr& value, const TStr& whereForErrorMsg, TStrV& errList)
 {
 	if (jsonVal.Empty()) { errList.Add("Unexpected empty value in " + whereForErrorMsg + "."); return false; }
@@ -101,7 +139,11 @@ POpDesc TOpDesc::New(const PJsonVal& jsonVal, TStrV& errList)
 	TStr opStr; if (! Json_GetObjStr(jsonVal, "op", false, {}, opStr, "an op description", errList)) return {};
 	POpDesc o;
 	if (opStr == "linMap") o = new TOpDesc_AttrLinMap();
-	else if (opStr == "timeShift" || opStr == "timeDelta" || opStr == "linTrend") o = new TOpDesc_TimeWindow();
+	else if (opStr == "standardize") o = new TOpDesc_AttrStdMap();
+	else if (opStr == "restrictRange") o = new TOpDesc_AttrRestrictRange();
+	else if (opStr == "timeCategorical") o = new TOpDesc_TimeCategorical();
+	else if (opStr == "timeShift" || opStr == "timeDelta" || opStr == "linTrend" || opStr.StartsWith("rolling")) o = new TOpDesc_TimeWindow();
+	else if (opStr == "resample") o = new TOpDesc_Resample();
 	// ToDo: add other op types here.
 	else { errList.Add("Invalid op type: \"" + opStr + "\"."); return {}; }
 	if (! o->InitFromJson(jsonVal, errList)) return {};
@@ -117,6 +159,11 @@ PJsonVal TOpDesc_TimeWindow::SaveToJson() const
 	TStr opStr; if (op == TTimeWindowOp::Shift) opStr = "timeShift";
 	else if (op == TTimeWindowOp::Delta) opStr = "timeDelta";
 	else if (op == TTimeWindowOp::LinTrend) opStr = "linTrend"; 
+	else if (op == TTimeWindowOp::Mean) opStr = "rollingMean"; 
+	else if (op == TTimeWindowOp::Std) opStr = "rollingStd"; 
+	else if (op == TTimeWindowOp::Min) opStr = "rollingMin"; 
+	else if (op == TTimeWindowOp::Max) opStr = "rollingMax"; 
+	else if (op == TTimeWindowOp::Count) opStr = "rollingCount"; 
 	else IAssert(false);
 	jsonVal->AddToObj("op", opStr);
 	if (windowType == TTimeWindowType::Samples) {
@@ -137,6 +184,28 @@ PJsonVal TOpDesc_TimeWindow::SaveToJson() const
 	return jsonVal;
 }
 
+// Parses the unit of a window size or time step (case-insensitive).  For units of time, 'unitMultiplier' is set to the number of seconds in the unit.
+static bool ParseTimeUnit(TStr s, TTimeWindowType& type, int64_t& unitMultiplier)
+{
+	s.ToLc(); unitMultiplier = 1;
+	if (s == "samples") type = TTimeWindowType::Samples;
+	else if (s == "num" || s == "numeric") type = TTimeWindowType::TimeNumeric;
+	else if (s == "s" || s == "sec" || s == "second" || s == "seconds") type = TTimeWindowType::Time;
+	else if (s == "m" || s == "min" || s == "minute" || s == "minutes") type = TTimeWindowType::Time, unitMultiplier = 60;
+	else if (s == "h" || s == "hour" || s == "hours") type = TTimeWindowType::Time, unitMultiplier = 60 * 60;
+	else if (s == "d" || s == "day" || s == "days") type = TTimeWindowType::Time, unitMultiplier = 60 * 60 * 24;
+	else return false;
+	return true;
+}
+
+// Sets 'span' to 'x' units, each of which is 'unitMultiplier' seconds or numeric time units long; it is an Int if possible, and a Flt otherwise.
+static void SetTimeSpan(double x, int64_t unitMultiplier, TTimeStamp& span)
+{
+	typedef decltype(span.sec) T;
+	T ix = (T) x; if (ix == x) span.SetInt(ix * unitMultiplier);
+	else span.SetFlt(x * unitMultiplier);
+}
+
 bool TOpDesc_TimeWindow::InitFromJson(const PJsonVal& jsonVal, TStrV& errList) 
 { 
 	if (! TOpDesc::InitFromJson(jsonVal, errList)) return false;
@@ -147,18 +216,16 @@ bool TOpDesc_TimeWindow::InitFromJson(const PJsonVal& jsonVal, TStrV& errList)
 	if (s == "timeShift") op = TTimeWindowOp::Shift;
 	else if (s == "timeDelta") op = TTimeWindowOp::Delta;
 	else if (s == "linTrend") op = TTimeWindowOp::LinTrend;
+	else if (s == "rollingMean") op = TTimeWindowOp::Mean;
+	else if (s == "rollingStd") op = TTimeWindowOp::Std;
+	else if (s == "rollingMin") op = TTimeWindowOp::Min;
+	else if (s == "rollingMax") op = TTimeWindowOp::Max;
+	else if (s == "rollingCount") op = TTimeWindowOp::Count;
 	else { errList.Add("Invalid op type for a time window op: \"" + s + "\"."); return {}; }
 	//
-	int64_t unitMultiplier = 1, unitDivisor = 1; TStr key = "windowUnit";
+	int64_t unitMultiplier = 1; TStr key = "windowUnit";
 	if (! Json_GetObjStr(jsonVal, key.CStr(), false, {}, s, WhereForErrMsg(), errList)) return false;
-	s.ToLc();
-	if (s == "samples") windowType = TTimeWindowType::Samples;
-	else if (s == "num" || s == "numeric") windowType = TTimeWindowType::TimeNumeric;
-	else if (s == "s" || s == "sec" || s == "second" || s == "seconds") windowType = TTimeWindowType::Time;
-	else if (s == "m" || s == "min" || s == "minute" || s == "minutes") windowType = TTimeWindowType::Time, unitMultiplier = 60;
-	else if (s == "h" || s == "hour" || s == "hours") windowType = TTimeWindowType::Time, unitMultiplier = 60 * 60;
-	else if (s == "d" || s == "day" || s == "days") windowType = TTimeWindowType::Time, unitMultiplier = 60 * 60 * 24;
-	else { errList.Add(TStr("The value of \"") + key + "\" in " + WhereForErrMsg() + " is invalid: \"" + s.GetSubStrSafe(0, 100) + "\"."); return false; }
+	if (! ParseTimeUnit(s, windowType, unitMultiplier)) { errList.Add(TStr("The value of \"") + key + "\" in " + WhereForErrMsg() + " is invalid: \"" + s.GetSubStrSafe(0, 100) + "\"."); return false; }
 	//
 	if (windowType == TTimeWindowType::Samples)
 	{
@@ -171,9 +238,7 @@ bool TOpDesc_TimeWindow::InitFromJson(const PJsonVal& jsonVal, TStrV& errList)
 	else
 	{
 		double x; if (! Json_GetObjNum(jsonVal, "windowSize", true, 1, x, WhereForErrMsg(), errList)) return false;
-		typedef decltype(windowSize.sec) T;
-		T ix = (T) x; if (ix == x && (ix * unitMultiplier) % unitDivisor == 0) windowSize.SetInt((ix * unitMultiplier) / unitDivisor);
-		else windowSize.SetFlt(x * unitMultiplier / double(unitDivisor));
+		SetTimeSpan(x, unitMultiplier, windowSize);
 	}
 	return true; 
 }
@@ -193,13 +258,15 @@ bool TOpDesc_TimeWindow::AddAttrsFromOps(TModelConfig& config, TStrV& errors)
 		const TAttrDesc &IA = config.attrs[inAttrIdx]; TAttrDesc &OA = config.attrs[outAttrIdx];
 		OA = IA; OA.source = TAttrSource::Synthetic; 
 		// Linear regression will likely return non-integer slopes even if the input attribute was an integer.
-		if (op == TTimeWindowOp::LinTrend) OA.subType = TAttrSubtype::Flt; 
+		if (op == TTimeWindowOp::LinTrend || op == TTimeWindowOp::Mean || op == TTimeWindowOp::Std) OA.subType = TAttrSubtype::Flt; 
+		if (op == TTimeWindowOp::Count) OA.subType = TAttrSubtype::Int; 
 		// Similarly, the delta and shift operations might require interpolation unless the window is defined in samples.
 		if ((op == TTimeWindowOp::Delta || op == TTimeWindowOp::Shift) && windowType == TTimeWindowType::Samples) OA.subType = TAttrSubtype::Flt; 
 		if (! outAttr.Empty()) OA.name = outAttr;
 		else {
 			OA.name = ""; // prevent interfering with SuggestUniqueAttrName
-			OA.name = config.SuggestUniqueAttrName(TStr::Fmt("%s %s", IA.name.CStr(), op == TTimeWindowOp::Delta ? "Delta" : op == TTimeWindowOp::Shift ? "Shifted" : op == TTimeWindowOp::LinTrend ? "Trend" : "????")); 
+			OA.name = config.SuggestUniqueAttrName(TStr::Fmt("%s %s", IA.name.CStr(), op == TTimeWindowOp::Delta ? "Delta" : op == TTimeWindowOp::Shift ? "Shifted" : op == TTimeWindowOp::LinTrend ? "Trend" : 
+				op == TTimeWindowOp::Mean ? "Mean" : op == TTimeWindowOp::Std ? "Std" : op == TTimeWindowOp::Min ? "Min" : op == TTimeWindowOp::Max ? "Max" : op == TTimeWindowOp::Count ? "Count" : "????")); 
 			outAttr = OA.name; }}
 	// If timeAttr has been specified, make sure it exists and is a suitable time attribute.
 	int timeAttrIdx = config.GetAttrIdx(timeAttr);
@@ -285,6 +352,57 @@ void TLinRegression::Results(double &linCoef, double &constTerm, double &rmse) c
 	else { rmse = J / sum_w; if (rmse < eps) rmse = 0; else rmse = sqrt(rmse); }
 }
 
+// Least-squares line through a window of (x, y) points, from which the oldest points can also be removed.
+// Instead of the raw sums of x, x^2 and xy, which would cancel catastrophically when x is a time in seconds 
+// since the epoch, it keeps the means and the centred sums of squares and products, updated as in Welford's 
+// algorithm.  The means are relative to the last point added, so that they stay small, too.
+class TSlidingLinRegression
+{
+protected:
+	int n = 0; 
+	double x0 = 0, y0 = 0; // the last point added
+	double meanX = 0, meanY = 0; // relative to (x0, y0)
+	double sXX = 0, sXY = 0; // sXX = sum_i (x_i - meanX)^2, sXY = sum_i (x_i - meanX)(y_i - meanY)
+public:
+	void Clr() { n = 0; x0 = 0; y0 = 0; meanX = 0; meanY = 0; sXX = 0; sXY = 0; }
+	int Len() const { return n; }
+	void Add(double x, double y) { 
+		meanX -= x - x0; meanY -= y - y0; x0 = x; y0 = y; ++n; 
+		// Now the point is (0, 0) relative to the new origin.
+		const double dx = -meanX; meanX += dx / n; meanY -= meanY / n;
+		sXX -= dx * meanX; sXY -= dx * meanY; }
+	// Removes a point that has been added before.
+	void Remove(double x, double y) {
+		if (n <= 1) { Clr(); return; }
+		x -= x0; y -= y0; --n; 
+		const double dxOld = x - meanX, dy = y - meanY; meanX -= dxOld / n; meanY -= dy / n;
+		const double dx = x - meanX; sXX -= dxOld * dx; sXY -= dx * dy; 
+		if (sXX < 0) sXX = 0; }
+	// Returns the slope of the line, or 0 if the x values are all the same (up to rounding errors).
+	double GetSlope() const { return (sXX > 1e-24 * n * x0 * x0) ? sXY / sXX : 0; }
+};
+
+// The mean and variance of a window of values, from which the oldest values can also be removed (Welford's algorithm).
+class TSlidingMoments
+{
+protected:
+	int n = 0;
+	double mean = 0, sDev2 = 0; // sDev2 = sum_i (y_i - mean)^2
+public:
+	void Clr() { n = 0; mean = 0; sDev2 = 0; }
+	int Len() const { return n; }
+	void Add(double y) { ++n; const double dOld = y - mean; mean += dOld / n; sDev2 += dOld * (y - mean); }
+	// Removes a value that has been added before.
+	void Remove(double y) {
+		if (n <= 1) { Clr(); return; }
+		--n; const double dOld = y - mean; mean -= dOld / n; sDev2 -= dOld * (y - mean);
+		if (sDev2 < 0) sDev2 = 0; }
+	double GetMean() const { return mean; }
+	// If all the remaining values are the same, the removals can leave some rounding noise in sDev2, of the order of 
+	// eps^2 * mean^2 per update; that is treated as 0.  (Larger errors are bounded by the periodic rebuild of the window.)
+	double GetStd() const { return (n > 0 && sDev2 > 1e-30 * n * mean * mean) ? sqrt(sDev2 / n) : 0; }
+};
+
 double LinInterp(double x1, double y1, double x2, double y2, double x)
 {
 	// y = ((x2 - x) y1 + (x - x1) y2) / (x2 - x1)
@@ -312,82 +430,659 @@ void TestLinRegr()
 	}
 }
 
+// A true timestamp as seconds and nanoseconds (0 <= ns < 10^9).  Unlike a count of nanoseconds in an int64_t, which 
+// overflows after the year 2262, this covers any date (including sentinels such as 9999-12-31).
+class TSecNs
+{
+public:
+	int64_t sec = 0; int ns = 0;
+	TSecNs() { }
+	TSecNs(int64_t sec_, int ns_) : sec(sec_), ns(ns_) { }
+	explicit TSecNs(const TTimeStamp& ts) { ts.GetSecTm(sec, ns); }
+	bool operator==(const TSecNs& other) const { return sec == other.sec && ns == other.ns; }
+	bool operator<(const TSecNs& other) const { return sec < other.sec || (sec == other.sec && ns < other.ns); }
+	bool operator<=(const TSecNs& other) const { return ! (other < *this); }
+	TSecNs operator-(const TSecNs& other) const { 
+		TSecNs r(sec - other.sec, ns - other.ns); if (r.ns < 0) { r.ns += 1000000000; --r.sec; } return r; }
+	// Returns the number of nanoseconds as a double, which is exact for up to about 104 days.
+	double GetNs() const { return double(sec) * 1e9 + ns; }
+	// Returns this time plus 'x' nanoseconds, rounded to the nearest nanosecond.
+	TSecNs AddNs(double x) const { 
+		int64_t s = (int64_t) floor(x / 1e9); int64_t n = ns + llround(x - double(s) * 1e9);
+		s += n / 1000000000; n %= 1000000000; if (n < 0) { n += 1000000000; --s; }
+		return TSecNs(sec + s, int(n)); }
+};
+
+// Finds the first row of the window that ends at each row in turn, within the rows [firstRowNo, endRowNo)
+// of one series.  The times are converted once into a single value per row (a TSecNs for true timestamps).  
+// If they are non-decreasing, the start of the window only ever moves forward, so finding it costs O(1) per row 
+// on average; otherwise the window extends backwards from each row up to the first earlier row that is too early, as before.
+class TTimeWindowBounds
+{
+protected:
+	TTimeWindowType windowType; 
+	int firstRowNo;
+	int nSamples = 0; // for windowType == Samples
+	bool useFlt = false, sorted = true;
+	// The times are indexed by rowNo - firstRowNo.
+	TVec<TSecNs> secNsTimes; TSecNs secNsWindow; // for windowType == Time
+	TVec<int64_t> intTimes; int64_t intWindow = 0; // for TimeNumeric with an Int time attribute
+	TVec<double> fltTimes; double fltWindow = 0; // for TimeNumeric with a Flt time attribute
+	int fromRowNo = 0;
+	template<typename T> bool IsSorted(const TVec<T>& times) const { 
+		for (int i = 1; i < times.Len(); ++i) if (! (times[i - 1] <= times[i])) return false; 
+		return true; }
+	template<typename T> int Find(const TVec<T>& times, T window, int rowNo) {
+		const T minTime = times[rowNo] - window;
+		if (sorted) { while (fromRowNo < rowNo && times[fromRowNo] < minTime) ++fromRowNo; return fromRowNo; }
+		int from = rowNo; while (from > 0 && minTime <= times[from - 1]) --from; 
+		return from; }
+public:
+	TTimeWindowBounds(const TOpDesc_TimeWindow& op, const TDataColumn *TC, int firstRowNo_, int endRowNo);
+	// Must be called for rowNo = firstRowNo, firstRowNo + 1, ... in this order.
+	int GetFromRowNo(int rowNo) { 
+		if (windowType == TTimeWindowType::Samples) return TInt::GetMx(firstRowNo, rowNo - nSamples); 
+		else if (windowType == TTimeWindowType::Time) return firstRowNo + Find(secNsTimes, secNsWindow, rowNo - firstRowNo); 
+		else if (useFlt) return firstRowNo + Find(fltTimes, fltWindow, rowNo - firstRowNo); 
+		else return firstRowNo + Find(intTimes, intWindow, rowNo - firstRowNo); }
+};
+
+TTimeWindowBounds::TTimeWindowBounds(const TOpDesc_TimeWindow& op, const TDataColumn *TC, int firstRowNo_, int endRowNo) : windowType(op.windowType), firstRowNo(firstRowNo_)
+{
+	const int n = endRowNo - firstRowNo;
+	if (windowType == TTimeWindowType::Samples) nSamples = (int) op.windowSize.GetInt();
+	else if (windowType == TTimeWindowType::TimeNumeric)
+	{
+		if (TC->timeType == TTimeType::Int) {
+			intTimes.Gen(n); for (int i = 0; i < n; ++i) intTimes[i] = TC->timeVals[firstRowNo + i].GetInt();
+			intWindow = op.windowSize.GetInt(); sorted = IsSorted(intTimes); }
+		else if (TC->timeType == TTimeType::Flt) {
+			useFlt = true; fltTimes.Gen(n); for (int i = 0; i < n; ++i) fltTimes[i] = TC->timeVals[firstRowNo + i].GetFlt();
+			fltWindow = op.windowSize.GetFlt(); sorted = IsSorted(fltTimes); }
+		else IAssert(false);
+	}
+	else if (windowType == TTimeWindowType::Time)
+	{
+		IAssert(TC->timeType == TTimeType::Time);
+		secNsTimes.Gen(n); for (int i = 0; i < n; ++i) secNsTimes[i] = TSecNs(TC->timeVals[firstRowNo + i]);
+		secNsWindow = TSecNs(op.windowSize); sorted = IsSorted(secNsTimes); 
+	}
+	else IAssert(false);
+}
+
+// Applies one TOpDesc_TimeWindow to the rows of one series of a dataset, one row at a time.
+class TTimeWindowOpRunner
+{
+protected:
+	const TOpDesc_TimeWindow *op;
+	const TDataColumn *IC; TDataColumn *OC; const TDataColumn *TC;
+	int firstRowNo = 0; // the first row of the series
+	// The rows [winFrom, winTo) of the previous window, which are in 'linRegr' (for LinTrend), 'moments' (for Mean and Std) 
+	// or 'deque' (for Min and Max) and are updated as the window moves.
+	int winFrom = 0, winTo = 0, nRemoved = 0;
+	TSlidingLinRegression linRegr; 
+	TSlidingMoments moments;
+	// For Min and Max: the rows of the window whose values are smaller (for Min) or greater (for Max) than those 
+	// of all the later rows of the window, in increasing order; the ones before deque[dequeHead] have already left the window.
+	TIntV deque; int dequeHead = 0;
+	double GetX(int i) const { return (TC) ? TC->timeVals[i].GetFlt() : double(i); }
+	double GetY(int i) const { 
+		if (IC->subType == TAttrSubtype::Int) return (double) IC->intVals[i];
+		else if (IC->subType == TAttrSubtype::Flt) return (double) IC->fltVals[i];
+		else { IAssert(false); return 0.0; } }
+	void AddRow(TSlidingLinRegression& acc, int i) const { acc.Add(GetX(i), GetY(i)); }
+	void RemoveRow(TSlidingLinRegression& acc, int i) const { acc.Remove(GetX(i), GetY(i)); }
+	void AddRow(TSlidingMoments& acc, int i) const { acc.Add(GetY(i)); }
+	void RemoveRow(TSlidingMoments& acc, int i) const { acc.Remove(GetY(i)); }
+	// Moves the rows in 'acc' from [winFrom, winTo) to [fromRowNo, rowNo].
+	template<typename TAcc> void MoveWindow(TAcc& acc, int fromRowNo, int rowNo);
+	void MoveDeque(int fromRowNo, int rowNo, bool isMax);
+public:
+	TTimeWindowOpRunner() : op(nullptr), IC(nullptr), OC(nullptr), TC(nullptr) { }
+	TTimeWindowOpRunner(const TOpDesc_TimeWindow& op_, TDataset& dataset) : op(&op_), IC(&dataset.GetCol(op_.inAttr)), OC(&dataset.GetCol(op_.outAttr)), TC(nullptr) {
+		int i = dataset.GetColIdx(op_.timeAttr); if (i >= 0) TC = &dataset.cols[i]; }
+	const TDataColumn *GetTimeCol() const { return TC; }
+	void Gen(int nRows) { OC->Gen(nRows); }
+	// Prepares for a series that starts at 'firstRowNo_'.
+	void StartSeries(int firstRowNo_) { 
+		firstRowNo = firstRowNo_; winFrom = firstRowNo; winTo = firstRowNo; nRemoved = 0; 
+		linRegr.Clr(); moments.Clr(); deque.Clr(); dequeHead = 0; }
+	// Computes the value of the output attribute in 'rowNo', whose window starts at 'fromRowNo'.
+	void ApplyToRow(int rowNo, int fromRowNo);
+};
+
+void TTimeWindowOpRunner::ApplyToRow(int rowNo, int fromRowNo)
+{
+	// We use OC->PutNumVal to store the result because the subtype may not be what we expect - the user
+	// could have overridden it by adding a definition of the output column to config.attributes.
+	if (op->op == TTimeWindowOp::Shift || op->op == TTimeWindowOp::Delta) {
+		if (op->windowType == TTimeWindowType::Samples) {
+			if (op->op == TTimeWindowOp::Shift) {
+				if (IC->subType == TAttrSubtype::Int) OC->PutNumVal(rowNo, IC->intVals[fromRowNo]);
+				else if (IC->subType == TAttrSubtype::Flt) OC->PutNumVal(rowNo, IC->fltVals[fromRowNo]);
+				else IAssert(false); }
+			else if (op->op == TTimeWindowOp::Delta) {
+				if (IC->subType == TAttrSubtype::Int) OC->PutNumVal(rowNo, IC->intVals[rowNo] - IC->intVals[fromRowNo]);
+				else if (IC->subType == TAttrSubtype::Flt) OC->PutNumVal(rowNo, IC->fltVals[rowNo] - IC->fltVals[fromRowNo]);
+				else IAssert(false); } }
+		else {
+			// Interpolation may be needed, and the result will always be a float.
+			int beforeRowNo = (fromRowNo > firstRowNo) ? fromRowNo - 1 : fromRowNo;
+			double t1 = TC->timeVals[beforeRowNo].GetFlt(), t2 = TC->timeVals[fromRowNo].GetFlt();
+			double t0 = TC->timeVals[rowNo].GetFlt() - op->windowSize.GetFlt();
+			double startValue = LinInterp(t1, GetY(beforeRowNo), t2, GetY(fromRowNo), t0); 
+			if (op->op == TTimeWindowOp::Shift) OC->PutNumVal(rowNo, startValue);
+			else if (op->op == TTimeWindowOp::Delta) OC->PutNumVal(rowNo, GetY(rowNo) - startValue); 
+			else IAssert(false); }}
+	else if (op->op == TTimeWindowOp::LinTrend) 
+	{
+		MoveWindow(linRegr, fromRowNo, rowNo);
+		OC->PutNumVal(rowNo, (fromRowNo >= rowNo) ? 0.0 : linRegr.GetSlope());
+	}
+	else if (op->op == TTimeWindowOp::Mean || op->op == TTimeWindowOp::Std)
+	{
+		MoveWindow(moments, fromRowNo, rowNo);
+		OC->PutNumVal(rowNo, (op->op == TTimeWindowOp::Mean) ? moments.GetMean() : moments.GetStd());
+	}
+	else if (op->op == TTimeWindowOp::Min || op->op == TTimeWindowOp::Max)
+	{
+		MoveDeque(fromRowNo, rowNo, op->op == TTimeWindowOp::Max);
+		OC->PutNumVal(rowNo, GetY(deque[dequeHead]));
+	}
+	else if (op->op == TTimeWindowOp::Count) OC->PutNumVal(rowNo, rowNo - fromRowNo + 1);
+	else IAssert(false);
+}
+
+template<typename TAcc> 
+void TTimeWindowOpRunner::MoveWindow(TAcc& acc, int fromRowNo, int rowNo)
+{
+	while (winTo <= rowNo) { AddRow(acc, winTo); ++winTo; }
+	while (winFrom < fromRowNo) { RemoveRow(acc, winFrom); ++winFrom; ++nRemoved; }
+	while (winFrom > fromRowNo) { --winFrom; AddRow(acc, winFrom); }
+	// The removals accumulate rounding errors, so 'acc' is rebuilt from scratch once as many
+	// rows have been removed from it as it contains; this still costs O(1) per row on average.
+	if (nRemoved > acc.Len()) { 
+		acc.Clr(); nRemoved = 0;
+		for (int i = winFrom; i < winTo; ++i) AddRow(acc, i); }
+}
+
+void TTimeWindowOpRunner::MoveDeque(int fromRowNo, int rowNo, bool isMax)
+{
+	// If the times are not sorted, the window can move backwards; then the deque is rebuilt from scratch.
+	if (fromRowNo < winFrom) { deque.Clr(); dequeHead = 0; winTo = fromRowNo; }
+	for ( ; winTo <= rowNo; ++winTo) {
+		const double y = GetY(winTo);
+		while (deque.Len() > dequeHead && (isMax ? GetY(deque.Last()) <= y : GetY(deque.Last()) >= y)) deque.DelLast();
+		deque.Add(winTo); }
+	while (deque[dequeHead] < fromRowNo) ++dequeHead;
+	winFrom = fromRowNo;
+}
+
 bool TOpDesc_TimeWindow::Apply(TDataset& dataset, TStrV& errors) 
 {
-	const TDataColumn &IC = dataset.GetCol(inAttr);
-	TDataColumn &OC = dataset.GetCol(outAttr);
-	TDataColumn *TC = nullptr; { int i = dataset.GetColIdx(timeAttr); if (i >= 0) TC = &dataset.cols[i]; }
-	const int nRows = dataset.nRows; OC.Gen(nRows);
+	TVec<TOpDesc_TimeWindow *> ops; ops.Add(this);
+	return ApplyAll(dataset, ops, dataset.config->numThreads, errors);
+}
+
+bool TOpDesc_TimeWindow::CanSharePassWith(const TOpDesc_TimeWindow& prev) const
+{
+	if (timeAttr != prev.timeAttr || windowType != prev.windowType) return false;
+	if (windowSize.type != prev.windowSize.type || windowSize.sec != prev.windowSize.sec || windowSize.ns != prev.windowSize.ns || windowSize.GetFlt() != prev.windowSize.GetFlt()) return false;
+	// Since the rows are processed in order, this op may read the output of 'prev', but not overwrite
+	// its input or output.  (An op whose output is its own input is always applied on its own.)
+	return outAttr != inAttr && prev.outAttr != prev.inAttr && outAttr != prev.inAttr && outAttr != prev.outAttr;
+}
+
+bool TOpDesc_TimeWindow::GetAttrDeps(TStrV& inAttrs, TStrV& outAttrs) const
+{
+	inAttrs.Add(inAttr); if (! timeAttr.Empty()) inAttrs.Add(timeAttr);
+	outAttrs.Add(outAttr); return true;
+}
+
+bool TOpDesc_TimeWindow::ApplyAll(TDataset& dataset, const TVec<TOpDesc_TimeWindow *>& ops, int nThreads, TStrV& errors)
+{
+	if (ops.Empty()) return true;
+	const int nRows = dataset.nRows; 
+	TVec<TTimeWindowOpRunner> runners; runners.Reserve(ops.Len());
+	for (const TOpDesc_TimeWindow *op : ops) { runners.Add(TTimeWindowOpRunner(*op, dataset)); runners.Last().Gen(nRows); }
+	// Each series gets its own copy of the runners; they write to disjoint rows of the output columns.
+	ParallelFor(dataset.GetNumSeries(), nThreads, [&dataset, &ops, &runners] (int seriesNo) {
+		const int firstRowNo = dataset.GetSeriesStart(seriesNo), endRowNo = dataset.GetSeriesEnd(seriesNo);
+		TVec<TTimeWindowOpRunner> seriesRunners = runners;
+		for (TTimeWindowOpRunner& runner : seriesRunners) runner.StartSeries(firstRowNo);
+		TTimeWindowBounds bounds { *ops[0], seriesRunners[0].GetTimeCol(), firstRowNo, endRowNo };
+		for (int rowNo = firstRowNo; rowNo < endRowNo; ++rowNo)
+		{
+			const int fromRowNo = bounds.GetFromRowNo(rowNo);
+			for (TTimeWindowOpRunner& runner : seriesRunners) runner.ApplyToRow(rowNo, fromRowNo);
+		} });
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// TOpDesc_NumericAttrMap
+//
+//-----------------------------------------------------------------------------
+
+double TFltEx::Eval(const TColStats& stats) const
+{
+	switch (type) {
+		case Flt: return value;
+		case Min: return stats.min;
+		case Max: return stats.max;
+		case Avg: return stats.avg;
+		case Std: return stats.std;
+		default: IAssert(false); return 0; }
+}
+
+bool TFltEx::InitFromJson(const PJsonVal& jsonVal, const char *key, bool allowMissing, double defaultValue, const TStr& whereForErrorMsg, TStrV& errList)
+{
+	type = Flt; value = defaultValue;
+	if (jsonVal->IsObjKey(key) && jsonVal->GetObjKey(key)->IsStr())
+	{
+		TStr s = jsonVal->GetObjKey(key)->GetStr(); s.ToLc();
+		if (s == "min") type = Min; else if (s == "max") type = Max; 
+		else if (s == "avg" || s == "mean") type = Avg; else if (s == "std") type = Std;
+		else { errList.Add(TStr("The value of \"") + key + "\" in " + whereForErrorMsg + " should be a number, \"min\", \"max\", \"avg\" or \"std\"."); return false; }
+		return true;
+	}
+	double x; if (! Json_GetObjNum(jsonVal, key, allowMissing, defaultValue, x, whereForErrorMsg, errList)) return false;
+	value = x; return true;
+}
+
+PJsonVal TFltEx::SaveToJson() const
+{
+	switch (type) {
+		case Flt: return TJsonVal::NewNum(value);
+		case Min: return TJsonVal::NewStr("min");
+		case Max: return TJsonVal::NewStr("max");
+		case Avg: return TJsonVal::NewStr("avg");
+		case Std: return TJsonVal::NewStr("std");
+		default: IAssert(false); return {}; }
+}
+
+bool TOpDesc_NumericAttrMap::AddAttrsFromOps(TModelConfig& config, TStrV& errors)
+{
+	// Make sure that the input attribute exists and is numeric.
+	int inAttrIdx = config.GetAttrIdx(inAttrName); 
+	if (inAttrIdx < 0) { errors.Add("Error in an op definition: input attribute \"" + inAttrName + "\" not found."); return false; }
+	if (config.attrs[inAttrIdx].type != TAttrType::Numeric) { errors.Add("Error in an op definition: the input attribute \"" + inAttrName + "\" must be numeric."); return false; } 
+	// If the output attribute doesn't exist, we'll create it.  The mapped values are rarely integers, so it will be a float attribute.
+	int outAttrIdx = config.GetAttrIdx(outAttrName); 
+	if (outAttrIdx >= 0) { 
+		if (config.attrs[outAttrIdx].type != TAttrType::Numeric) { errors.Add("Error in an op definition: the output attribute \"" + outAttrName + "\" must be numeric."); return false; } }
+	else {
+		outAttrIdx = config.attrs.Add();
+		const TAttrDesc &IA = config.attrs[inAttrIdx]; TAttrDesc &OA = config.attrs[outAttrIdx];
+		OA = IA; OA.source = TAttrSource::Synthetic; OA.subType = TAttrSubtype::Flt; OA.name = outAttrName; }
+	return true;
+}
+
+// Sets y[i] = min(max(a * x[i] + b, lo), hi) for 0 <= i < n; 'y' may be the same array as 'x'.
+template<typename TIn>
+static void MapNumVals(const TIn *x, double *y, int n, double a, double b, double lo, double hi)
+{
+	#pragma omp simd
+	for (int i = 0; i < n; ++i) { double v = a * x[i] + b; v = (v < lo) ? lo : v; y[i] = (v > hi) ? hi : v; }
+}
+
+// Like the above, but rounds the results to integers.
+template<typename TIn>
+static void MapNumVals(const TIn *x, int *y, int n, double a, double b, double lo, double hi)
+{
+	#pragma omp simd
+	for (int i = 0; i < n; ++i) { double v = a * x[i] + b; v = (v < lo) ? lo : v; y[i] = (int) floor(((v > hi) ? hi : v) + 0.5); }
+}
+
+bool TOpDesc_NumericAttrMap::Apply(TDataset& dataset, TStrV& errors)
+{
+	const int nRows = dataset.nRows, inColIdx = dataset.GetColIdx(inAttrName);
+	TDataColumn &IC = dataset.cols[inColIdx], &OC = dataset.GetCol(outAttrName);
+	// ApplyOps will usually have computed the statistics already.
+	TColStats stats; if (NeedsStats()) { if (inColIdx < dataset.colStats.Len() && dataset.colStats[inColIdx].valid) stats = dataset.colStats[inColIdx]; else stats.Calc(IC); }
+	double a, b, lo, hi; if (! GetMap(stats, a, b, lo, hi, errors)) return false;
+	if (&OC != &IC) OC.Gen(nRows); 
+	if (nRows <= 0) return true;
+	if (OC.subType == TAttrSubtype::Flt && IC.subType == TAttrSubtype::Flt) MapNumVals(&IC.fltVals[0].Val, &OC.fltVals[0].Val, nRows, a, b, lo, hi);
+	else if (OC.subType == TAttrSubtype::Flt && IC.subType == TAttrSubtype::Int) MapNumVals(&IC.intVals[0].Val, &OC.fltVals[0].Val, nRows, a, b, lo, hi);
+	else if (OC.subType == TAttrSubtype::Int && IC.subType == TAttrSubtype::Flt) MapNumVals(&IC.fltVals[0].Val, &OC.intVals[0].Val, nRows, a, b, lo, hi);
+	else if (OC.subType == TAttrSubtype::Int && IC.subType == TAttrSubtype::Int) MapNumVals(&IC.intVals[0].Val, &OC.intVals[0].Val, nRows, a, b, lo, hi);
+	else IAssert(false);
+	return true;
+}
+
+bool TOpDesc_AttrLinMap::InitFromJson(const PJsonVal& jsonVal, TStrV& errList)
+{
+	if (! TOpDesc_NumericAttrMap::InitFromJson(jsonVal, errList)) return false;
+	if (! x1.InitFromJson(jsonVal, "x1", false, 0, WhereForErrMsg(), errList)) return false;
+	if (! y1.InitFromJson(jsonVal, "y1", false, 0, WhereForErrMsg(), errList)) return false;
+	if (! x2.InitFromJson(jsonVal, "x2", false, 0, WhereForErrMsg(), errList)) return false;
+	if (! y2.InitFromJson(jsonVal, "y2", false, 0, WhereForErrMsg(), errList)) return false;
+	return true;
+}
+
+PJsonVal TOpDesc_AttrLinMap::SaveToJson() const
+{
+	PJsonVal jsonVal = SaveAttrsToJson("linMap");
+	jsonVal->AddToObj("x1", x1.SaveToJson()); jsonVal->AddToObj("y1", y1.SaveToJson());
+	jsonVal->AddToObj("x2", x2.SaveToJson()); jsonVal->AddToObj("y2", y2.SaveToJson());
+	return jsonVal;
+}
+
+bool TOpDesc_AttrLinMap::GetMap(const TColStats& stats, double& a, double& b, double& lo, double& hi, TStrV& errors) const
+{
+	const double X1 = x1.Eval(stats), Y1 = y1.Eval(stats), X2 = x2.Eval(stats), Y2 = y2.Eval(stats);
+	if (X1 == X2) { errors.Add(TStr::Fmt("Error in a linMap op on \"%s\": x1 and x2 are both %g.", inAttrName.CStr(), X1)); return false; }
+	a = (Y2 - Y1) / (X2 - X1); b = Y1 - a * X1;
+	lo = -std::numeric_limits<double>::infinity(); hi = std::numeric_limits<double>::infinity();
+	return true;
+}
+
+bool TOpDesc_AttrStdMap::InitFromJson(const PJsonVal& jsonVal, TStrV& errList)
+{
+	if (! TOpDesc_NumericAttrMap::InitFromJson(jsonVal, errList)) return false;
+	if (! newMean.InitFromJson(jsonVal, "mean", true, 0, WhereForErrMsg(), errList)) return false;
+	if (! newStd.InitFromJson(jsonVal, "std", true, 1, WhereForErrMsg(), errList)) return false;
+	return true;
+}
+
+PJsonVal TOpDesc_AttrStdMap::SaveToJson() const
+{
+	PJsonVal jsonVal = SaveAttrsToJson("standardize");
+	jsonVal->AddToObj("mean", newMean.SaveToJson()); jsonVal->AddToObj("std", newStd.SaveToJson());
+	return jsonVal;
+}
+
+bool TOpDesc_AttrStdMap::GetMap(const TColStats& stats, double& a, double& b, double& lo, double& hi, TStrV& errors) const
+{
+	// If all the values are the same, they are all mapped to the new mean.
+	const double M = newMean.Eval(stats), S = newStd.Eval(stats);
+	a = (stats.std > 0) ? S / stats.std : 0; b = M - a * stats.avg;
+	lo = -std::numeric_limits<double>::infinity(); hi = std::numeric_limits<double>::infinity();
+	return true;
+}
+
+bool TOpDesc_AttrRestrictRange::InitFromJson(const PJsonVal& jsonVal, TStrV& errList)
+{
+	if (! TOpDesc_NumericAttrMap::InitFromJson(jsonVal, errList)) return false;
+	const double inf = std::numeric_limits<double>::infinity();
+	if (! newMin.InitFromJson(jsonVal, "min", true, -inf, WhereForErrMsg(), errList)) return false;
+	if (! newMax.InitFromJson(jsonVal, "max", true, inf, WhereForErrMsg(), errList)) return false;
+	return true;
+}
+
+PJsonVal TOpDesc_AttrRestrictRange::SaveToJson() const
+{
+	PJsonVal jsonVal = SaveAttrsToJson("restrictRange");
+	if (newMin.type != TFltEx::Flt || ! isinf(newMin.value)) jsonVal->AddToObj("min", newMin.SaveToJson()); 
+	if (newMax.type != TFltEx::Flt || ! isinf(newMax.value)) jsonVal->AddToObj("max", newMax.SaveToJson());
+	return jsonVal;
+}
+
+bool TOpDesc_AttrRestrictRange::GetMap(const TColStats& stats, double& a, double& b, double& lo, double& hi, TStrV& errors) const
+{
+	a = 1; b = 0; lo = newMin.Eval(stats); hi = newMax.Eval(stats);
+	if (lo > hi) { errors.Add(TStr::Fmt("Error in a restrictRange op on \"%s\": min (%g) is greater than max (%g).", inAttrName.CStr(), lo, hi)); return false; }
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// TOpDesc_TimeCategorical
+//
+//-----------------------------------------------------------------------------
+
+static const char *timeCategoricalUnitNames[] = { "sec", "min", "hour", "dayOfWeek", "month" };
+
+bool TOpDesc_TimeCategorical::InitFromJson(const PJsonVal& jsonVal, TStrV& errList)
+{
+	if (! TOpDesc_SingleAttrMap::InitFromJson(jsonVal, errList)) return false;
+	// The output can't replace the input, since it is of a different type; AddAttrsFromOps will choose a name for it.
+	if (! jsonVal->IsObjKey("outAttr")) outAttrName = "";
+	TStr s; if (! Json_GetObjStr(jsonVal, "unit", false, {}, s, WhereForErrMsg(), errList)) return false;
+	int i = 0; while (i < 5 && s != timeCategoricalUnitNames[i]) ++i;
+	if (i >= 5) { errList.Add("The value of \"unit\" in " + WhereForErrMsg() + " is invalid: \"" + s.GetSubStrSafe(0, 100) + "\"."); return false; }
+	unit = TTimeCategoricalUnit(i);
+	return true;
+}
+
+PJsonVal TOpDesc_TimeCategorical::SaveToJson() const
+{
+	PJsonVal jsonVal = SaveAttrsToJson("timeCategorical");
+	jsonVal->AddToObj("unit", timeCategoricalUnitNames[int(unit)]);
+	return jsonVal;
+}
+
+bool TOpDesc_TimeCategorical::AddAttrsFromOps(TModelConfig& config, TStrV& errors)
+{
+	// Make sure that the input attribute exists and is a true timestamp.
+	int inAttrIdx = config.GetAttrIdx(inAttrName); 
+	if (inAttrIdx < 0) { errors.Add("Error in a timeCategorical op definition: input attribute \"" + inAttrName + "\" not found."); return false; }
+	if (config.attrs[inAttrIdx].type != TAttrType::Time || config.attrs[inAttrIdx].timeType != TTimeType::Time) { errors.Add("Error in a timeCategorical op definition: the input attribute \"" + inAttrName + "\" must be a time attribute with timeType = \"time\"."); return false; } 
+	// If the output attribute doesn't exist, we'll create it; the days of the week and the months will be given by name.
+	int outAttrIdx = config.GetAttrIdx(outAttrName); 
+	if (outAttrIdx >= 0) { 
+		if (config.attrs[outAttrIdx].type != TAttrType::Categorical) { errors.Add("Error in a timeCategorical op definition: the output attribute \"" + outAttrName + "\" must be categorical."); return false; } }
+	else {
+		outAttrIdx = config.attrs.Add();
+		const TAttrDesc &IA = config.attrs[inAttrIdx]; TAttrDesc &OA = config.attrs[outAttrIdx];
+		OA = IA; OA.source = TAttrSource::Synthetic; OA.type = TAttrType::Categorical; OA.formatStr = ""; 
+		OA.subType = (unit == TTimeCategoricalUnit::DayOfWeek || unit == TTimeCategoricalUnit::Month) ? TAttrSubtype::String : TAttrSubtype::Int;
+		if (outAttrName.Empty()) { 
+			OA.name = ""; // prevent interfering with SuggestUniqueAttrName
+			outAttrName = config.SuggestUniqueAttrName(TStr::Fmt("%s %s", IA.name.CStr(), timeCategoricalUnitNames[int(unit)])); }
+		OA.name = outAttrName; OA.userFriendlyLabel = outAttrName; }
+	return true;
+}
+
+bool TOpDesc_TimeCategorical::Apply(TDataset& dataset, TStrV& errors)
+{
+	const int nRows = dataset.nRows;
+	const TDataColumn &IC = dataset.GetCol(inAttrName); TDataColumn &OC = dataset.GetCol(outAttrName);
+	// ApplyOps will usually have computed the calendar codes already.
+	TCalendarCodes localCal; const TCalendarCodes *cal = &IC.calendar;
+	if (unit != TTimeCategoricalUnit::Sec && unit != TTimeCategoricalUnit::Min && cal->Len() != nRows) { localCal.Calc(IC.timeVals); cal = &localCal; }
+	// The keys are added in the order of their values, so that the keyId of a value is its position in that order.
+	const int nKeys = (unit == TTimeCategoricalUnit::Sec || unit == TTimeCategoricalUnit::Min) ? 60 : (unit == TTimeCategoricalUnit::Hour) ? 24 : 
+		(unit == TTimeCategoricalUnit::DayOfWeek) ? 7 : 12;
+	OC.Gen(nRows);
+	for (int keyId = 0; keyId < nKeys; ++keyId) {
+		// The days of the week and the months are numbered from 1, as in TSecTm.
+		const int key = (unit == TTimeCategoricalUnit::DayOfWeek || unit == TTimeCategoricalUnit::Month) ? keyId + 1 : keyId;
+		int id = -1;
+		if (OC.subType == TAttrSubtype::Int) id = OC.intKeyMap.AddKey(key); 
+		else if (OC.subType == TAttrSubtype::String) id = OC.strKeyMap.AddKey(
+			(unit == TTimeCategoricalUnit::DayOfWeek) ? TTimeStamp::GetDowName(key) : (unit == TTimeCategoricalUnit::Month) ? TTimeStamp::GetMonthName(key) : TInt::GetStr(key));
+		IAssert(id == keyId); }
+	TIntV counts; counts.Gen(nKeys); counts.PutAll(0);
 	for (int rowNo = 0; rowNo < nRows; ++rowNo)
 	{
-		// Determine how far back the time window extends from the rowNo'th datapoint.
-		int fromRowNo = rowNo;
-		if (windowType == TTimeWindowType::Samples) fromRowNo = TInt::GetMx(0, rowNo - windowSize.GetInt()); 
-		else if (windowType == TTimeWindowType::TimeNumeric)
-		{
-			TTimeStamp curTs = TC->timeVals[rowNo];
-			if (TC->timeType == TTimeType::Int) {
-				auto minTime = curTs.GetInt(); minTime -= windowSize.GetInt();
-				while (fromRowNo > 0 && minTime <= TC->timeVals[fromRowNo - 1].GetInt()) --fromRowNo; }
-			else if (TC->timeType == TTimeType::Flt) {
-				double minTime = curTs.GetFlt() - windowSize.GetFlt();
-				while (fromRowNo > 0 && minTime <= TC->timeVals[fromRowNo - 1].GetFlt()) --fromRowNo; }
-			else IAssert(false);
-		}
-		else if (windowType == TTimeWindowType::Time)
-		{
-			int64_t curSec; int curNs; TC->timeVals[rowNo].GetSecTm(curSec, curNs);
-			int64_t winSec; int winNs; windowSize.GetSecTm(winSec, winNs);
-			int64_t minSec = curSec - winSec; int minNs = curNs - winNs;
-			if (minNs < 0) { minSec -= 1; minNs += 1000000000; }
-			IAssert(TC->timeType == TTimeType::Time);
-			while (fromRowNo > 0) {
-				int64_t prevSec; int prevNs; TC->timeVals[fromRowNo - 1].GetSecTm(prevSec, prevNs);
-				if (minSec > prevSec || (minSec == prevSec && minNs > prevNs)) break;
-				--fromRowNo; }
-		}
-		// Perform the desired operation on the window.
-		// We use OC.PutNumVal to store the result because the subtype may not be what we expect - the user
-		// could have overridden it by adding a definition of the output column to config.attributes.
-		if (op == TTimeWindowOp::Shift || op == TTimeWindowOp::Delta) {
-			if (windowType == TTimeWindowType::Samples) {
-				if (op == TTimeWindowOp::Shift) {
-					if (IC.subType == TAttrSubtype::Int) OC.PutNumVal(rowNo, IC.intVals[fromRowNo]);
-					else if (IC.subType == TAttrSubtype::Flt) OC.PutNumVal(rowNo, IC.fltVals[fromRowNo]);
-					else IAssert(false); }
-				else if (op == TTimeWindowOp::Delta) {
-					if (IC.subType == TAttrSubtype::Int) OC.PutNumVal(rowNo, IC.intVals[rowNo] - IC.intVals[fromRowNo]);
-					else if (IC.subType == TAttrSubtype::Flt) OC.PutNumVal(rowNo, IC.fltVals[rowNo] - IC.fltVals[fromRowNo]);
-					else IAssert(false); } }
-			else {
-				// Interpolation may be needed, and the result will always be a float.
-				int beforeRowNo = (fromRowNo > 0) ? fromRowNo - 1 : fromRowNo;
-				double t1 = TC->timeVals[beforeRowNo].GetFlt(), t2 = TC->timeVals[fromRowNo].GetFlt();
-				double t0 = TC->timeVals[rowNo].GetFlt() - windowSize.GetFlt();
-				double val1, val2; if (IC.subType == TAttrSubtype::Int) val1 = IC.intVals[beforeRowNo], val2 = IC.intVals[fromRowNo];
-				else val1 = IC.fltVals[beforeRowNo], val2 = IC.fltVals[fromRowNo];
-				double startValue = LinInterp(t1, val1, t2, val2, t0); 
-				if (op == TTimeWindowOp::Shift) OC.PutNumVal(rowNo, startValue);
-				else if (op == TTimeWindowOp::Delta) {
-					double curValue = (IC.subType == TAttrSubtype::Flt) ? double(IC.fltVals[rowNo]) : double(OC.fltVals[rowNo]);
-					OC.PutNumVal(rowNo, curValue - startValue); }
-				else IAssert(false); }}
-		else if (op == TTimeWindowOp::LinTrend) 
-		{
-			TLinRegression linRegr;
-			for (int i = fromRowNo; i <= rowNo; ++i)
-			{
-				double x = (TC) ? TC->timeVals[i].GetFlt() : double(i);
-				double y; if (IC.subType == TAttrSubtype::Int) y = (double) IC.intVals[i];
-				else if (IC.subType == TAttrSubtype::Flt) y = (double) IC.fltVals[i];
-				else IAssert(false);
-				linRegr.Add(1.0, x, y);
-			}
-			double linCoef, constTerm, rmse; linRegr.Results(linCoef, constTerm, rmse);
-			if (fromRowNo >= rowNo) linCoef = 0;
-			OC.PutNumVal(rowNo, linCoef);
-		}
+		int keyId;
+		if (unit == TTimeCategoricalUnit::Sec || unit == TTimeCategoricalUnit::Min) {
+			const TTimeStamp &ts = IC.timeVals[rowNo];
+			int64_t sec = (ts.type == TTimeType::Flt) ? (int64_t) floor(ts.flt) : ts.sec;
+			if (unit == TTimeCategoricalUnit::Min) sec = (sec - (((sec % 60) + 60) % 60)) / 60;
+			keyId = int(((sec % 60) + 60) % 60); }
+		else if (unit == TTimeCategoricalUnit::Hour) keyId = cal->hour[rowNo];
+		else if (unit == TTimeCategoricalUnit::DayOfWeek) keyId = cal->dayOfWeek[rowNo];
+		else keyId = cal->month[rowNo];
+		OC.intVals[rowNo] = keyId; ++counts[keyId];
+	}
+	for (int keyId = 0; keyId < nKeys; ++keyId) if (OC.subType == TAttrSubtype::Int) OC.intKeyMap[keyId] = counts[keyId]; else OC.strKeyMap[keyId] = counts[keyId];
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// TOpDesc_Resample
+//
+//-----------------------------------------------------------------------------
+
+bool TOpDesc_Resample::InitFromJson(const PJsonVal& jsonVal, TStrV& errList)
+{
+	if (! TOpDesc::InitFromJson(jsonVal, errList)) return false;
+	if (! Json_GetObjStr(jsonVal, "timeAttr", true, {}, timeAttr, WhereForErrMsg(), errList)) return false;
+	const bool hasStep = jsonVal->IsObjKey("timeStep"), hasNumSamples = jsonVal->IsObjKey("numSamples");
+	if (hasStep == hasNumSamples) { errList.Add("Exactly one of \"timeStep\" and \"numSamples\" must be specified in a resample op description."); return false; }
+	numericStep = false; numSamples = -1;
+	if (hasNumSamples)
+	{
+		resampleType = TResampleType::SetNumSamples;
+		if (! Json_GetObjInt(jsonVal, "numSamples", false, 0, numSamples, WhereForErrMsg(), errList)) return false;
+		if (numSamples <= 0) { errList.Add("The value of \"numSamples\" in " + WhereForErrMsg() + " should be > 0."); return false; }
+	}
+	else
+	{
+		resampleType = TResampleType::SetTimeStep;
+		TStr s; if (! Json_GetObjStr(jsonVal, "timeUnit", true, "sec", s, WhereForErrMsg(), errList)) return false;
+		TTimeWindowType unitType; int64_t unitMultiplier; 
+		if (! ParseTimeUnit(s, unitType, unitMultiplier) || unitType == TTimeWindowType::Samples) { errList.Add("The value of \"timeUnit\" in " + WhereForErrMsg() + " is invalid: \"" + s.GetSubStrSafe(0, 100) + "\"."); return false; }
+		numericStep = (unitType == TTimeWindowType::TimeNumeric);
+		double x; if (! Json_GetObjNum(jsonVal, "timeStep", false, 0, x, WhereForErrMsg(), errList)) return false;
+		if (! (x > 0)) { errList.Add("The value of \"timeStep\" in " + WhereForErrMsg() + " should be > 0."); return false; }
+		SetTimeSpan(x, unitMultiplier, timeStep);
+	}
+	TStr s; if (! Json_GetObjStr(jsonVal, "aggregation", true, "interpolate", s, WhereForErrMsg(), errList)) return false;
+	s.ToLc();
+	if (s == "interpolate") aggregation = TResampleAggregation::Interpolate;
+	else if (s == "mean") aggregation = TResampleAggregation::Mean;
+	else if (s == "min") aggregation = TResampleAggregation::Min;
+	else if (s == "max") aggregation = TResampleAggregation::Max;
+	else { errList.Add("The value of \"aggregation\" in " + WhereForErrMsg() + " is invalid: \"" + s.GetSubStrSafe(0, 100) + "\"."); return false; }
+	return true;
+}
+
+bool TOpDesc_Resample::AddAttrsFromOps(TModelConfig& config, TStrV& errors)
+{
+	if (! config.seriesAttr.Empty()) { errors.Add("Error in a resample op definition: resampling is not supported for datasets with several series (config.seriesAttr)."); return false; }
+	int timeAttrIdx = config.GetAttrIdx(timeAttr);
+	if (timeAttrIdx < 0)
+	{
+		if (! timeAttr.Empty()) { errors.Add("Error in a resample op definition: time attribute \"" + timeAttr + "\" not found."); return false; }
+		for (int i = 0; i < config.attrs.Len(); ++i) if (config.attrs[i].type == TAttrType::Time) { timeAttrIdx = i; break; }
+		if (timeAttrIdx < 0) { errors.Add("Error in a resample op definition: no time attribute found."); return false; } 
+		timeAttr = config.attrs[timeAttrIdx].name; 
+	}
+	const TAttrDesc &TA = config.attrs[timeAttrIdx];
+	if (TA.type != TAttrType::Time) { errors.Add("Error in a resample op definition: the attribute \"" + timeAttr + "\" is not a time attribute."); return false; } 
+	if (resampleType == TResampleType::SetTimeStep && numericStep && TA.timeType == TTimeType::Time) { errors.Add("Error in a resample op definition: the time attribute \"" + timeAttr + "\" is a true timestamp, so the time step must be given in units of time rather than as a numeric value."); return false; } 
+	if (resampleType == TResampleType::SetTimeStep && ! numericStep && TA.timeType != TTimeType::Time) { errors.Add("Error in a resample op definition: the time attribute \"" + timeAttr + "\" is not a true timestamp, as required by the time step specification."); return false; } 
+	return true;
+}
+
+PJsonVal TOpDesc_Resample::SaveToJson() const
+{
+	PJsonVal jsonVal = TJsonVal::NewObj();
+	jsonVal->AddToObj("op", "resample");
+	if (timeAttr != "") jsonVal->AddToObj("timeAttr", timeAttr);
+	if (resampleType == TResampleType::SetNumSamples) jsonVal->AddToObj("numSamples", numSamples);
+	else if (resampleType == TResampleType::SetTimeStep) {
+		jsonVal->AddToObj("timeUnit", numericStep ? "numeric" : "seconds"); 
+		jsonVal->AddToObj("timeStep", timeStep.GetFlt()); }
+	else IAssert(false);
+	const char *agg = (aggregation == TResampleAggregation::Mean) ? "mean" : (aggregation == TResampleAggregation::Min) ? "min" : (aggregation == TResampleAggregation::Max) ? "max" : "interpolate";
+	jsonVal->AddToObj("aggregation", agg);
+	return jsonVal;
+}
+
+bool TOpDesc_Resample::Apply(TDataset& dataset, TStrV& errors)
+{
+	const int nRows = dataset.nRows; if (nRows <= 0) return true;
+	const int timeColNo = dataset.GetColIdx(timeAttr); IAssert(timeColNo >= 0);
+	const TDataColumn &TC = dataset.cols[timeColNo];
+	// The times as TSecNs if timeType == Time, as integers if timeType == Int, or as floating-point numbers if timeType == Flt.
+	const bool fltTime = (TC.timeType == TTimeType::Flt), trueTime = (TC.timeType == TTimeType::Time); 
+	TVec<TSecNs> secNsTimes; TVec<int64_t> intTimes; TVec<double> fltTimes; 
+	if (fltTime) { fltTimes.Gen(nRows); for (int rowNo = 0; rowNo < nRows; ++rowNo) fltTimes[rowNo] = TC.timeVals[rowNo].GetFlt(); }
+	else if (trueTime) { secNsTimes.Gen(nRows); for (int rowNo = 0; rowNo < nRows; ++rowNo) secNsTimes[rowNo] = TSecNs(TC.timeVals[rowNo]); }
+	else { intTimes.Gen(nRows); for (int rowNo = 0; rowNo < nRows; ++rowNo) intTimes[rowNo] = TC.timeVals[rowNo].GetInt(); }
+	// 'relTimes' are relative to the first time (in nanoseconds if timeType == Time), so that they can be compared with the new times precisely.
+	TVec<double> relTimes(nRows); 
+	for (int rowNo = 0; rowNo < nRows; ++rowNo) {
+		relTimes[rowNo] = fltTime ? fltTimes[rowNo] - fltTimes[0] : trueTime ? (secNsTimes[rowNo] - secNsTimes[0]).GetNs() : double(intTimes[rowNo] - intTimes[0]);
+		if (rowNo > 0 && ! (relTimes[rowNo - 1] <= relTimes[rowNo])) { errors.Add(TStr::Fmt("Error in a resample op: the rows are not sorted by \"%s\" (see row %d).", timeAttr.CStr(), rowNo)); return false; } }
+	// Determine the new times.
+	const double span = relTimes.Last(); double step; int64_t nNewRows;
+	if (resampleType == TResampleType::SetNumSamples) { nNewRows = numSamples; step = (nNewRows > 1) ? span / (nNewRows - 1) : 0; }
+	else if (resampleType == TResampleType::SetTimeStep) {
+		if (TC.timeType == TTimeType::Time) { int64_t sec; int ns; timeStep.GetSecTm(sec, ns); step = double(sec) * 1e9 + ns; }
+		else step = timeStep.GetFlt();
+		const double n = floor(span / step) + 1; 
+		if (! (n <= TInt::Mx)) { errors.Add(TStr::Fmt("Error in a resample op: the time step is too small (the result would have %g rows).", n)); return false; }
+		nNewRows = (int64_t) n; }
+	else { IAssert(false); return false; }
+	const int nNew = (int) nNewRows;
+	TVec<double> newRelTimes(nNew); TTimeStampV newTimes(nNew);
+	for (int k = 0; k < nNew; ++k) {
+		if (fltTime) { newRelTimes[k] = k * step; newTimes[k].SetFlt(fltTimes[0] + newRelTimes[k]); }
+		else if (trueTime) { const TSecNs t = secNsTimes[0].AddNs(k * step); newRelTimes[k] = (t - secNsTimes[0]).GetNs(); newTimes[k].SetTime(t.sec, t.ns); }
+		else { const int64_t t = intTimes[0] + (int64_t) llround(k * step); newRelTimes[k] = double(t - intTimes[0]); newTimes[k].SetInt(t); } }
+	// For each new row, find the rows from which its values will come: 'lastRows[k]' is the last row at or before newRelTimes[k] 
+	// (with an aggregation: before newRelTimes[k + 1]), and the interpolation is between it and the next row, with weight 'weights[k]'
+	// on the latter.  With an aggregation, the rows in [firstRows[k], firstRows[k + 1]) are aggregated into the k'th new row.
+	const bool aggregate = (aggregation != TResampleAggregation::Interpolate);
+	TIntV interpRows(nNew), lastRows(nNew), firstRows(aggregate ? nNew + 1 : 0); TVec<double> weights(nNew);
+	for (int k = 0, rowNo = 0, firstRow = 0; k < nNew; ++k)
+	{
+		const double t = newRelTimes[k];
+		while (rowNo + 1 < nRows && relTimes[rowNo + 1] <= t) ++rowNo;
+		interpRows[k] = rowNo; lastRows[k] = rowNo;
+		weights[k] = (rowNo + 1 < nRows && relTimes[rowNo] < t) ? (t - relTimes[rowNo]) / (relTimes[rowNo + 1] - relTimes[rowNo]) : 0;
+		if (aggregate) {
+			while (firstRow < nRows && relTimes[firstRow] < t) ++firstRow; 
+			firstRows[k] = firstRow; }
+	}
+	if (aggregate) { 
+		firstRows[nNew] = nRows;
+		for (int k = 0; k < nNew; ++k) lastRows[k] = TInt::GetMx(interpRows[k], firstRows[k + 1] - 1); }
+	// Rebuild the columns.  Those that have no values yet (the outputs of later ops) are left alone.
+	for (TDataColumn &col : dataset.cols)
+	{
+		if (&col == &TC) { col.timeVals = newTimes; continue; }
+		if (col.type == TAttrType::Numeric && col.subType == TAttrSubtype::Flt && col.fltVals.Len() == nRows) {
+			TFltV newVals(nNew);
+			for (int k = 0; k < nNew; ++k) {
+				const int from = aggregate ? firstRows[k].Val : 0, to = aggregate ? firstRows[k + 1].Val : 0;
+				if (from < to) {
+					double x = col.fltVals[from]; 
+					if (aggregation == TResampleAggregation::Mean) { for (int i = from + 1; i < to; ++i) x += col.fltVals[i]; x /= (to - from); }
+					else if (aggregation == TResampleAggregation::Min) { for (int i = from + 1; i < to; ++i) x = TFlt::GetMn(x, col.fltVals[i]); }
+					else if (aggregation == TResampleAggregation::Max) { for (int i = from + 1; i < to; ++i) x = TFlt::GetMx(x, col.fltVals[i]); }
+					newVals[k] = x; }
+				else { 
+					// No rows to aggregate: interpolate instead.
+					const int rowNo = interpRows[k]; const double w = weights[k];
+					newVals[k] = (w == 0) ? double(col.fltVals[rowNo]) : (1 - w) * col.fltVals[rowNo] + w * col.fltVals[rowNo + 1]; } }
+			col.fltVals = newVals; }
+		else if (col.type == TAttrType::Numeric && col.subType == TAttrSubtype::Int && col.intVals.Len() == nRows) {
+			TIntV newVals(nNew);
+			for (int k = 0; k < nNew; ++k) {
+				const int from = aggregate ? firstRows[k].Val : 0, to = aggregate ? firstRows[k + 1].Val : 0;
+				if (from < to) {
+					if (aggregation == TResampleAggregation::Mean) { double x = 0; for (int i = from; i < to; ++i) x += col.intVals[i]; newVals[k] = (int) floor(x / (to - from) + 0.5); }
+					else if (aggregation == TResampleAggregation::Min) { int x = col.intVals[from]; for (int i = from + 1; i < to; ++i) x = TInt::GetMn(x, col.intVals[i]); newVals[k] = x; }
+					else if (aggregation == TResampleAggregation::Max) { int x = col.intVals[from]; for (int i = from + 1; i < to; ++i) x = TInt::GetMx(x, col.intVals[i]); newVals[k] = x; } }
+				else {
+					const int rowNo = interpRows[k]; const double w = weights[k];
+					newVals[k] = (w == 0) ? col.intVals[rowNo].Val : (int) floor((1 - w) * col.intVals[rowNo] + w * col.intVals[rowNo + 1] + 0.5); } }
+			col.intVals = newVals; }
+		else if (col.type == TAttrType::Categorical && col.intVals.Len() == nRows) {
+			// Take the last value, and recount the occurrences of each key.
+			TIntV newVals(nNew); 
+			for (int k = 0; k < nNew; ++k) newVals[k] = col.intVals[lastRows[k]];
+			col.intVals = newVals;
+			if (col.subType == TAttrSubtype::String) { for (int keyId = col.strKeyMap.FFirstKeyId(); col.strKeyMap.FNextKeyId(keyId); ) col.strKeyMap[keyId] = 0; for (int keyId : col.intVals) ++col.strKeyMap[keyId].Val; }
+			else { for (int keyId = col.intKeyMap.FFirstKeyId(); col.intKeyMap.FNextKeyId(keyId); ) col.intKeyMap[keyId] = 0; for (int keyId : col.intVals) ++col.intKeyMap[keyId].Val; } }
+		else if (col.type == TAttrType::Time && col.timeVals.Len() == nRows) {
+			TTimeStampV newVals(nNew);
+			for (int k = 0; k < nNew; ++k) newVals[k] = col.timeVals[lastRows[k]];
+			col.timeVals = newVals; }
+		else if (col.type == TAttrType::Text && col.sparseVecIndex.Len() == nRows) { errors.Add("Error in a resample op: text attributes (such as \"" + col.name + "\") cannot be resampled."); return false; }
 	}
+	NotifyInfo("TOpDesc_Resample::Apply: resampled %d rows into %d.\n", nRows, nNew);
+	// The new rows don't correspond to the input rows any more.
+	dataset.nRows = nNew; dataset.inputRowMap.Clr();
 	return true;
 }
 
@@ -506,10 +1201,15 @@ PJsonVal TModelConfig::SaveToJson() const
 	val->AddToObj("numInitialStates", numInitialStates);
 	val->AddToObj("numHistogramBuckets", numHistogramBuckets);
 	val->AddToObj("ignoreConversionErrors", ignoreConversionErrors);
+	if (! seriesAttr.Empty()) val->AddToObj("seriesAttr", seriesAttr);
+	if (sortByTime) val->AddToObj("sortByTime", sortByTime);
+	if (duplicateTimes != TDuplicateTimes::Keep) val->AddToObj("duplicateTimes", (duplicateTimes == TDuplicateTimes::First) ? "first" : (duplicateTimes == TDuplicateTimes::Last) ? "last" : "mean");
+	if (precision != TPrecision::Float64) val->AddToObj("precision", "float32");
 	val->AddToObj("includeDecisionTrees", includeDecisionTrees);
 	val->AddToObj("includeHistograms", includeHistograms);
 	val->AddToObj("includeStateHistory", includeStateHistory);
 	val->AddToObj("distWeightOutliers", distWeightOutliers);
+	val->AddToObj("distWeightSampleThreshold", distWeightSampleThreshold);
 	val->AddToObj("decTree_maxDepth", decTreeConfig.maxDepth);
 	val->AddToObj("decTree_minEntropyToSplit", decTreeConfig.minEntropyToSplit);
 	val->AddToObj("decTree_minNormInfGainToSplit", decTreeConfig.minNormInfGainToSplit);
@@ -536,10 +1236,30 @@ bool TModelConfig::InitFromJson(const PJsonVal& val, TStrV& errList)
 	// ToDo: the alternative to numInitialStates is to specify the radius and use DP-means.
 	if (! Json_GetObjInt(val, "numHistogramBuckets", true, 10, numHistogramBuckets, "model config", errList)) return false;
 	if (! Json_GetObjBool(val, "ignoreConversionErrors", true, true, ignoreConversionErrors, "model config", errList)) return false;
+	if (! Json_GetObjInt(val, "numThreads", true, 0, numThreads, "model config", errList)) return false;
+	if (! Json_GetObjStr(val, "seriesAttr", true, "", seriesAttr, "model config", errList)) return false;
+	if (! Json_GetObjBool(val, "sortByTime", true, false, sortByTime, "model config", errList)) return false;
+	{
+		TStr s; if (! Json_GetObjStr(val, "duplicateTimes", true, "keep", s, "model config", errList)) return false;
+		s.ToLc();
+		if (s == "keep") duplicateTimes = TDuplicateTimes::Keep;
+		else if (s == "first") duplicateTimes = TDuplicateTimes::First;
+		else if (s == "last") duplicateTimes = TDuplicateTimes::Last;
+		else if (s == "mean") duplicateTimes = TDuplicateTimes::Mean;
+		else { errList.Add("Invalid value of \"duplicateTimes\" in the model config: \"" + s + "\" (should be \"keep\", \"first\", \"last\" or \"mean\")."); return false; }
+	}
+	{
+		TStr s; if (! Json_GetObjStr(val, "precision", true, "float64", s, "model config", errList)) return false;
+		s.ToLc();
+		if (s == "float64") precision = TPrecision::Float64;
+		else if (s == "float32") precision = TPrecision::Float32;
+		else { errList.Add("Invalid value of \"precision\" in the model config: \"" + s + "\" (should be \"float64\" or \"float32\")."); return false; }
+	}
 	if (! Json_GetObjBool(val, "includeDecisionTrees", true, true, includeDecisionTrees, "model config", errList)) return false;
 	if (! Json_GetObjBool(val, "includeHistograms", true, true, includeHistograms, "model config", errList)) return false;
 	if (! Json_GetObjBool(val, "includeStateHistory", true, true, includeStateHistory, "model config", errList)) return false;
 	if (! Json_GetObjNum(val, "distWeightOutliers", true, 0.05, distWeightOutliers, "model config", errList)) return false;
+	if (! Json_GetObjInt(val, "distWeightSampleThreshold", true, 0, distWeightSampleThreshold, "model config", errList)) return false;
 	if (! Json_GetObjInt(val, "decTree_maxDepth", true, 3, decTreeConfig.maxDepth, "model config", errList)) return false;
 	if (! Json_GetObjNum(val, "decTree_minEntropyToSplit", true, TDecTreeNode::Entropy(1, 3 * numInitialStates - 1), decTreeConfig.minEntropyToSplit, "model config", errList)) return false;
 	if (! Json_GetObjNum(val, "decTree_minNormInfGainToSplit", true, -1, decTreeConfig.minNormInfGainToSplit, "model config", errList)) return false;
@@ -570,6 +1290,15 @@ bool TModelConfig::InitFromJson(const PJsonVal& val, TStrV& errList)
 	} while (false);
 	// Add the attributes required by the ops.
 	if (! AddAttrsFromOps(errList)) return false;
+	// The rows are grouped by series before the ops are applied, so the series attribute must come from the input data.
+	if (! seriesAttr.Empty()) {
+		const int attrIdx = GetAttrIdx(seriesAttr);
+		if (attrIdx < 0) { errList.Add("The series attribute \"" + seriesAttr + "\" (config.seriesAttr) does not exist."); return false; }
+		const TAttrDesc &attr = attrs[attrIdx];
+		if (attr.type != TAttrType::Categorical || attr.source != TAttrSource::Input) { errList.Add("The series attribute \"" + seriesAttr + "\" (config.seriesAttr) must be a categorical attribute from the input data."); return false; } }
+	if (sortByTime || duplicateTimes != TDuplicateTimes::Keep) {
+		bool hasTime = false; for (const TAttrDesc& attr : attrs) if (attr.type == TAttrType::Time) hasTime = true;
+		if (! hasTime) { errList.Add("config.sortByTime and config.duplicateTimes require a time attribute."); return false; } }
 	//
 	return true;
 }
@@ -613,48 +1342,93 @@ bool StrPTime(const char *s, const char *format, std::tm& tm)
 }
 #endif
 
-// This supports only a subset of the format specifiers, but on the other hand this includes %f.
-bool StrPTime_HomeGrown(const char *s, const char *format, TSecTm &secTm, int &ns)
+void TTimeFormat::Compile(const char *format)
 {
-	int year = -1, month = -1, day = -1, hour = -1, min = -1, sec = 0; ns = 0; 
-	bool isPm = false, applyPm = false;
-	if (! s || ! format) return false;
+	steps.Clr(); valid = true; nDateSteps = 0; prevDateLen = 0; prevDateShort = false;
+	if (! format) { valid = false; return; }
 	while (true)
 	{
 		char fc = *format; if (! fc) break; else ++format;
 		// 1 or more whitespace characters in 'format' can match 1 or more whitespace characters in 's'.
-		if (isspace(uchar(fc)))
-		{
-			if (! isspace(uchar(*s))) return false;
-			while (*s && isspace(uchar(*s))) ++s;
+		if (isspace(uchar(fc))) { 
+			steps.Add({TStepType::Space, ' ', 0, 0});
 			while (*format && isspace(uchar(*format))) ++format;
-			continue;
-		}
-		// Match other non-formatting characters.
-		if (fc != '%') { 
-			if (*s != fc) return false; 
-			++s; continue; }
-		// Match %%.
-		fc = *format; if (! fc) return false; else ++format; // % at the end = invalid format string
-		if (fc == '%') { if (*s == '%') s++; else return false; }
-		// Match AM/PM.
-		if (fc == 'p') { 
-			if ((*s == 'a' || *s == 'A') && (s[1] == 'm' || s[1] == 'M')) { isPm = false; s += 2; continue; }
-			if ((*s == 'p' || *s == 'P') && (s[1] == 'm' || s[1] == 'M')) { isPm = true; s += 2; continue; }
-			return false; }
-		// Match numeric %-formatted values.
-		// - First determine how many digits we should consume.
+			continue; }
+		// Other non-formatting characters must be matched exactly.
+		if (fc != '%') { steps.Add({TStepType::Char, fc, 0, 0}); continue; }
+		fc = *format; if (! fc) { valid = false; return; } else ++format; // % at the end = invalid format string
+		if (fc == '%') { steps.Add({TStepType::Char, '%', 0, 0}); continue; }
+		if (fc == 'p') { steps.Add({TStepType::AmPm, fc, 0, 0}); continue; }
+		// Numeric %-formatted values.
 		int minDigits = -1, maxDigits = -1;
 		if (fc == 'y') minDigits = 2, maxDigits = 2;
 		else if (fc == 'Y') minDigits = 4, maxDigits = 4;
 		else if (fc == 'm' || fc == 'M' || fc == 'H' || fc == 'I' || fc == 'd' || fc == 'S') minDigits = 1, maxDigits = 2;
 		else if (fc == 'f') minDigits = 1, maxDigits = 9;
-		else return false; // invalid or unsupported format character
-		// - Parse the digits.
-		int x = 0, d = 0;
-		while (d < maxDigits && s[d] >= '0' && s[d] <= '9') { x *= 10; x += s[d++] - '0'; }
-		if (d < minDigits) return false;
+		else { valid = false; return; } // invalid or unsupported format character
+		steps.Add({TStepType::Num, fc, minDigits, maxDigits});
+	}
+	// Find the date prefix.  It can only be used if there are no date fields after it.
+	int stepNo = 0, lastDateStep = -1;
+	for ( ; stepNo < steps.Len(); ++stepNo) {
+		const TStep &step = steps[stepNo];
+		if (step.type == TStepType::Num && IsDateField(step.c)) lastDateStep = stepNo;
+		else if (step.type != TStepType::Char) break; }
+	for ( ; stepNo < steps.Len(); ++stepNo) 
+		if (steps[stepNo].type == TStepType::Num && IsDateField(steps[stepNo].c)) lastDateStep = -1;
+	nDateSteps = lastDateStep + 1;
+}
+
+int64_t TTimeFormat::DaysFromCivil(int64_t year, int month, int day)
+{
+	// See http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+	year -= (month <= 2) ? 1 : 0;
+	const int64_t era = (year >= 0 ? year : year - 399) / 400;
+	const int64_t yoe = year - era * 400;
+	const int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+int64_t TTimeFormat::GetDayStartSecs(int year, int month, int day)
+{
+	int64_t y = year, m = int64_t(month) - 1;
+	int64_t carry = (m >= 0) ? m / 12 : -((11 - m) / 12);
+	y += carry; m -= 12 * carry;
+	return (DaysFromCivil(y, int(m) + 1, 1) + day - 1) * 86400;
+}
+
+bool TTimeFormat::Parse(const char *s, TSecTm &secTm, int &ns)
+{
+	int year = -1, month = -1, day = -1, hour = -1, min = -1, sec = 0; ns = 0; 
+	bool isPm = false, applyPm = false;
+	if (! s || ! valid) return false;
+	const char *start = s; int stepNo = 0; 
+	// If the timestamp begins with the same date as the previous one, skip the date prefix.
+	bool haveDaySecs = false;
+	if (prevDateLen > 0 && strncmp(s, prevDate, prevDateLen) == 0 && ! (prevDateShort && s[prevDateLen] >= '0' && s[prevDateLen] <= '9')) {
+		year = prevYear; month = prevMonth; day = prevDay; haveDaySecs = true;
+		s += prevDateLen; stepNo = nDateSteps; }
+	for ( ; stepNo < steps.Len(); ++stepNo)
+	{
+		const TStep &step = steps[stepNo];
+		if (step.type == TStepType::Space) {
+			if (! isspace(uchar(*s))) return false;
+			while (*s && isspace(uchar(*s))) ++s;
+			continue; }
+		if (step.type == TStepType::Char) {
+			if (*s != step.c) return false;
+			++s; continue; }
+		if (step.type == TStepType::AmPm) {
+			if ((*s == 'a' || *s == 'A') && (s[1] == 'm' || s[1] == 'M')) { isPm = false; s += 2; continue; }
+			if ((*s == 'p' || *s == 'P') && (s[1] == 'm' || s[1] == 'M')) { isPm = true; s += 2; continue; }
+			return false; }
+		// - Parse the digits.
+		int x = 0, d = 0;
+		while (d < step.maxDigits && s[d] >= '0' && s[d] <= '9') { x *= 10; x += s[d++] - '0'; }
+		if (d < step.minDigits) return false;
 		// - Store the value.
+		const char fc = step.c;
 		if (fc == 'y') year = x + (x < 70 ? 2000 : 1900);
 		else if (fc == 'Y') year = x;
 		else if (fc == 'H') hour = x;
@@ -665,11 +1439,30 @@ bool StrPTime_HomeGrown(const char *s, const char *format, TSecTm &secTm, int &n
 		else if (fc == 'd') day = x;
 		else if (fc == 'f') { ns = x; for (int D = d; D < 9; ++D) ns *= 10; }
 		s += d;
+		// - Remember the date prefix for the next call.
+		if (stepNo == nDateSteps - 1) {
+			const int len = int(s - start); 
+			prevDateLen = 0; if (len >= int(sizeof(prevDate))) continue;
+			memcpy(prevDate, start, len); prevDateLen = len; prevDateShort = (d < step.maxDigits);
+			prevYear = year; prevMonth = month; prevDay = day; prevDaySecs = GetDayStartSecs(year, month, day);
+			haveDaySecs = true; }
 	}
 	if (applyPm) {
 		if (hour == 12 && ! isPm) hour = 0; // 12 AM = midnight = 0 in 24-hour time
 		else if (hour < 12 && isPm) hour += 12; }
-	secTm = TSecTm(year, month, day, hour, min, sec); return true;
+	const int64_t secs = (haveDaySecs ? prevDaySecs : GetDayStartSecs(year, month, day)) + int64_t(hour) * 3600 + int64_t(min) * 60 + sec;
+	// Leave the values that TSecTm can't represent for its constructor to deal with.
+	if (secs < 0 || secs >= int64_t(UINT_MAX)) secTm = TSecTm(year, month, day, hour, min, sec);
+	else secTm = TSecTm(uint(secs)); 
+	return true;
+}
+
+// This supports only a subset of the format specifiers, but on the other hand this includes %f.
+// To parse many timestamps with the same format, use TTimeFormat directly.
+bool StrPTime_HomeGrown(const char *s, const char *format, TSecTm &secTm, int &ns)
+{
+	TTimeFormat timeFormat { format };
+	return timeFormat.Parse(s, secTm, ns);
 }
 
 // The formatting counterpart to StrPTime_HomeGrown.
@@ -742,23 +1535,93 @@ void TestStrPFTime()
 	printf("StrFTime returns %s \"%s\"\n", (ok ? "T" : "F"), buf.CStr());
 }
 
+// Compares the number parsers used by TDatasetCsvFeeder::AddRow with sscanf, which it used to call,
+// on synthetic data shaped like sampleCall/B100_hour_SS_input.csv: each row contains a timestamp
+// in milliseconds followed by 8 floating-point values printed with 17 significant digits.
+void BenchNumConv()
+{
+	const int nRows = 200000, nFltCols = 8;
+	TRnd rnd(1); TChA buf; TIntV tsPos, fltPos; char s[64];
+	for (int rowNo = 0; rowNo < nRows; ++rowNo)
+	{
+		sprintf(s, "%lld", 1451606400000LL + 3600000LL * rowNo); tsPos.Add(buf.Len()); buf += s; buf += '\0';
+		for (int colNo = 0; colNo < nFltCols; ++colNo) {
+			sprintf(s, "%.17g", rnd.GetUniDev() * pow(10.0, colNo % 4)); fltPos.Add(buf.Len()); buf += s; buf += '\0'; }
+	}
+	const char *data = buf.CStr(); const int nVals = tsPos.Len() + fltPos.Len();
+	TFltV flt1(fltPos.Len()), flt2(fltPos.Len()); TVec<int64_t> ts1(tsPos.Len()), ts2(tsPos.Len());
+	auto Now = [] () { return std::chrono::steady_clock::now(); };
+	auto Secs = [] (std::chrono::steady_clock::time_point t1, std::chrono::steady_clock::time_point t2) { return std::chrono::duration<double>(t2 - t1).count(); };
+	// The old way.
+	auto t0 = Now(); int nErrors1 = 0;
+	for (int i = 0; i < tsPos.Len(); ++i) { intmax_t x; if (1 != sscanf(data + tsPos[i], "%jd", &x)) ++nErrors1; ts1[i] = x; }
+	for (int i = 0; i < fltPos.Len(); ++i) if (1 != sscanf(data + fltPos[i], "%lf", &flt1[i].Val)) ++nErrors1;
+	// The new way.
+	auto t1 = Now(); int nErrors2 = 0;
+	for (int i = 0; i < tsPos.Len(); ++i) { const char *p = data + tsPos[i]; if (! ParseInt64(p, p + strlen(p), ts2[i])) ++nErrors2; }
+	for (int i = 0; i < fltPos.Len(); ++i) { const char *p = data + fltPos[i]; if (! ParseFlt(p, p + strlen(p), flt2[i].Val)) ++nErrors2; }
+	auto t2 = Now();
+	int nDiffs = 0; 
+	for (int i = 0; i < tsPos.Len(); ++i) if (ts1[i] != ts2[i]) ++nDiffs;
+	for (int i = 0; i < fltPos.Len(); ++i) if (memcmp(&flt1[i].Val, &flt2[i].Val, sizeof(double)) != 0) ++nDiffs;
+	const double sec1 = Secs(t0, t1), sec2 = Secs(t1, t2), mb = buf.Len() / 1048576.0;
+	printf("BenchNumConv: %d rows, %d values, %.1f MB.\n", nRows, nVals, mb);
+	printf("  sscanf:          %.3f s (%.1f ns/value, %.1f MB/s), %d errors\n", sec1, 1e9 * sec1 / nVals, mb / sec1, nErrors1);
+	printf("  ParseInt64/Flt:  %.3f s (%.1f ns/value, %.1f MB/s), %d errors\n", sec2, 1e9 * sec2 / nVals, mb / sec2, nErrors2);
+	printf("  speedup %.2fx; %d values differ.\n", sec1 / sec2, nDiffs);
+}
+
 //-----------------------------------------------------------------------------
 //
 // TDataColumn
 //
 //-----------------------------------------------------------------------------
 
-template<typename TDat> 
-double GetVariance(TVec<TDat> v, double propOutliersToIgnore) 
+// Returns the variance of x[0..n - 1] after ignoring the lowest and highest 'propOutliersToIgnore / 2'
+// of the values.  Instead of sorting all the values, the two trim bounds are found by partial selection
+// (std::nth_element), and the variance is then accumulated over the values between them.  If 'sampleThreshold'
+// is > 0 and n exceeds it, the bounds are estimated from every k-th value only (a deterministic sample of
+// about 'sampleThreshold' values), and the variance is computed over all the values that lie within these bounds.
+template<typename T> 
+static double GetVariance(const T *x, int n, double propOutliersToIgnore, int sampleThreshold, TStr& details) 
 {
-	v.Sort(); int n = v.Len(), nToIgnore = int(n * propOutliersToIgnore);
+	int nToIgnore = int(n * propOutliersToIgnore);
 	if (nToIgnore < 0) nToIgnore = 0; 
 	if (nToIgnore > n) nToIgnore = n;
-	int L = nToIgnore / 2; int D = n - (nToIgnore - L);
-	double sum = 0, sum2 = 0; int m = D - L;
-	for (int i = L; i < D; ++i) { double x = v[i]; sum += x; sum2 += x * x; }
-	NotifyInfo("GetVariance(%d; %g to ignore -> %d used): min[0] = %g, first[%d] = %g, last[%d] = %g, max[%d] = %g\n",
-		n, propOutliersToIgnore, m, double(v[0]), L, double(v[L]), D - 1, double(v[D]), n - 1, double(v[n - 1]));
+	if (n <= 0 || nToIgnore >= n) { details = TStr::Fmt("%d values; %g to ignore -> 0 used", n, propOutliersToIgnore); return 0; }
+	double sum = 0, sum2 = 0; int m = 0; double lo, hi;
+	if (nToIgnore == 0)
+	{
+		// No trimming, so no copy is needed either.
+		lo = x[0]; hi = x[0];
+		for (int i = 0; i < n; ++i) { const double v = x[i]; sum += v; sum2 += v * v; lo = (v < lo) ? v : lo; hi = (v > hi) ? v : hi; }
+		m = n;
+	}
+	else if (sampleThreshold > 0 && n > sampleThreshold)
+	{
+		const int step = (n + sampleThreshold - 1) / sampleThreshold;
+		TVec<double> sample(n / step + 1, 0);
+		for (int i = 0; i < n; i += step) sample.Add(double(x[i]));
+		const int ns = sample.Len(), nsToIgnore = TInt::GetMn(int(ns * propOutliersToIgnore), ns - 1);
+		const int L = nsToIgnore / 2, D = ns - (nsToIgnore - L);
+		double *p = &sample[0];
+		std::nth_element(p, p + L, p + ns); lo = p[L];
+		std::nth_element(p + L, p + (D - 1), p + ns); hi = p[D - 1];
+		for (int i = 0; i < n; ++i) { const double v = x[i]; if (v < lo || v > hi) continue; sum += v; sum2 += v * v; ++m; }
+	}
+	else
+	{
+		TVec<double> vals(n); double *v = &vals[0];
+		for (int i = 0; i < n; ++i) v[i] = double(x[i]);
+		const int L = nToIgnore / 2, D = n - (nToIgnore - L);
+		// After the first selection, v[L..n - 1] are the values >= v[L]; the second one only needs to look at those.
+		std::nth_element(v, v + L, v + n); lo = v[L];
+		std::nth_element(v + L, v + (D - 1), v + n); hi = v[D - 1];
+		for (int i = L; i < D; ++i) { const double xi = v[i]; sum += xi; sum2 += xi * xi; }
+		m = D - L;
+	}
+	details = TStr::Fmt("%d values; %g to ignore -> %d used%s, range [%g, %g]", n, propOutliersToIgnore, m, 
+		(nToIgnore > 0 && sampleThreshold > 0 && n > sampleThreshold) ? " (bounds from a sample)" : "", lo, hi);
 	// V = (1/m) sum_i (x_i - xAvg)^2 = (1/m) sum_i (x_i^2 + xAvg^2 - 2 xAvg x_i)
 	// = (1/m) sum_i x_i^2 + (1/m) sum_i xAvg^2 - (2/m) sum_i xAvg x_i
 	// = (1/m) sum_i x_i^2 + xAvg^2 - 2 xAvg^2
@@ -769,97 +1632,407 @@ double GetVariance(TVec<TDat> v, double propOutliersToIgnore)
 	return variance;
 }
 
-double TDataColumn::GetDefaultDistWeight(double propOutliersToIgnore) const
+double TDataColumn::GetDefaultDistWeight(double propOutliersToIgnore, int sampleThreshold, TStr& details) const
 {
 	if (type != TAttrType::Numeric) return 1;
 	double variance = 0;
-	if (subType == TAttrSubtype::Flt) variance = GetVariance(fltVals, propOutliersToIgnore);
-	else if (subType == TAttrSubtype::Int) variance = GetVariance(intVals, propOutliersToIgnore);
+	if (subType == TAttrSubtype::Flt) variance = GetVariance(fltVals.Empty() ? nullptr : &fltVals[0].Val, fltVals.Len(), propOutliersToIgnore, sampleThreshold, details);
+	else if (subType == TAttrSubtype::Int) variance = GetVariance(intVals.Empty() ? nullptr : &intVals[0].Val, intVals.Len(), propOutliersToIgnore, sampleThreshold, details);
 	else IAssert(false);
 	if (variance < 1e-6) return 1;
 	else return 1.0 / variance;
 }
 
+// Computes the statistics of x[0..n - 1] in a single pass.  The sums are taken relative to x[0], which
+// reduces the loss of precision in the variance when the mean is large relative to the standard deviation.
+template<typename T>
+static void CalcColStats(const T *x, int n, TColStats& stats)
+{
+	const double x0 = x[0]; double mn = x0, mx = x0, s = 0, s2 = 0;
+	#pragma omp simd reduction(min:mn) reduction(max:mx) reduction(+:s, s2)
+	for (int i = 0; i < n; ++i) { const double v = x[i], d = v - x0; mn = (v < mn) ? v : mn; mx = (v > mx) ? v : mx; s += d; s2 += d * d; }
+	s /= n; s2 /= n; 
+	stats.min = mn; stats.max = mx; stats.avg = x0 + s; stats.std = sqrt(TFlt::GetMx(s2 - s * s, 0.0));
+}
+
+void TColStats::Calc(const TDataColumn& col)
+{
+	IAssert(col.type == TAttrType::Numeric);
+	*this = {}; valid = true;
+	if (col.subType == TAttrSubtype::Flt) { if (! col.fltVals.Empty()) CalcColStats(&col.fltVals[0].Val, col.fltVals.Len(), *this); }
+	else if (col.subType == TAttrSubtype::Int) { if (! col.intVals.Empty()) CalcColStats(&col.intVals[0].Val, col.intVals.Len(), *this); }
+	else IAssert(false);
+}
+
+//-----------------------------------------------------------------------------
+//
+// TRowFilter
+//
+//-----------------------------------------------------------------------------
+
+bool TRowFilter::ParseOp(const TStr& s, TOp& op)
+{
+	if (s == "==") op = TOp::Eq; else if (s == "!=") op = TOp::Ne; 
+	else if (s == "<") op = TOp::Lt; else if (s == "<=") op = TOp::Le; 
+	else if (s == ">") op = TOp::Gt; else if (s == ">=") op = TOp::Ge; 
+	else return false;
+	return true;
+}
+
+bool TRowFilter::AddCond(const TDataset& dataset, int colNo, TOp op, const PJsonVal& vValue, const TStr& where, TStrV& errList)
+{
+	const TDataColumn &col = dataset.cols[colNo]; TCond cond; cond.op = op; cond.num = 0;
+	if (col.type == TAttrType::Categorical && col.subType == TAttrSubtype::String)
+	{
+		if (! vValue->IsStr()) { errList.Add("The value in " + where + " should be a string."); return false; }
+		if (op != TOp::Eq && op != TOp::Ne) { errList.Add("Only the operators \"==\" and \"!=\" can be used with the categorical attribute \"" + col.name + "\" in " + where + "."); return false; }
+		cond.str = vValue->GetStr();
+	}
+	else if (vValue->IsNum()) cond.num = vValue->GetNum();
+	else if (vValue->IsStr() && col.type == TAttrType::Time && col.subType == TAttrSubtype::String)
+	{
+		// A time can also be given in the attribute's own format.
+		TSecTm secTm; int ns; 
+		if (! StrPTime_HomeGrown(vValue->GetStr().CStr(), col.formatStr.CStr(), secTm, ns)) { errList.Add(TStr::Fmt("Error parsing \"%s\" in %s as a datetime value with the format \"%s\".", vValue->GetStr().CStr(), where.CStr(), col.formatStr.CStr())); return false; }
+		TTimeStamp ts; 
+		if (col.timeType == TTimeType::Int) ts.SetInt(secTm.GetAbsSecs()); else ts.SetTime(secTm.GetAbsSecs(), ns);
+		cond.num = ts.GetFlt();
+	}
+	else { errList.Add("The value in " + where + " should be a number."); return false; }
+	if (col.type == TAttrType::Categorical && col.subType == TAttrSubtype::Int && op != TOp::Eq && op != TOp::Ne) { errList.Add("Only the operators \"==\" and \"!=\" can be used with the categorical attribute \"" + col.name + "\" in " + where + "."); return false; }
+	colConds[colNo].Add(cond); 
+	return true;
+}
+
+bool TRowFilter::InitFromJson(const TDataset& dataset, const PJsonVal& jsonVal, TStrV& errList)
+{
+	Clr();
+	const TStr where = "dataSource.filter"; const int nCols = dataset.cols.Len();
+	if (jsonVal.Empty() || ! jsonVal->IsObj()) { errList.Add("The value of \"dataSource.filter\" is not an object."); return false; }
+	colConds.Gen(nCols);
+	// Returns the index of the input column called 'name', or reports an error and returns -1.
+	auto GetInputCol = [&dataset, &errList] (const TStr& name, const TStr& where) { 
+		const int colNo = dataset.GetColIdx(name);
+		if (colNo < 0) { errList.Add("Unknown attribute \"" + name + "\" in " + where + "."); return -1; }
+		const TDataColumn &col = dataset.cols[colNo];
+		if (col.source != TAttrSource::Input || col.type == TAttrType::Text) { errList.Add("The attribute \"" + name + "\" in " + where + " cannot be filtered on; only numeric, categorical and time attributes from the input data can."); return -1; }
+		return colNo; };
+	// The time range.
+	PJsonVal vFrom, vTo; 
+	if (! Json_GetObjKey(jsonVal, "from", true, true, vFrom, where, errList)) return false;
+	if (! Json_GetObjKey(jsonVal, "to", true, true, vTo, where, errList)) return false;
+	if (! vFrom.Empty() && vFrom->IsNull()) vFrom = {}; 
+	if (! vTo.Empty() && vTo->IsNull()) vTo = {};
+	TStr timeAttr; if (! Json_GetObjStr(jsonVal, "timeAttr", true, "", timeAttr, where, errList)) return false;
+	if (! timeAttr.Empty()) 
+	{
+		timeCol = GetInputCol(timeAttr, where + ".timeAttr"); if (timeCol < 0) return false;
+		if (dataset.cols[timeCol].type != TAttrType::Time) { errList.Add("The attribute \"" + timeAttr + "\" in " + where + ".timeAttr is not a time attribute."); return false; }
+	}
+	else if (! vFrom.Empty() || ! vTo.Empty())
+	{
+		// Use the only time attribute of the input data.
+		for (int colNo = 0; colNo < nCols; ++colNo) if (dataset.cols[colNo].source == TAttrSource::Input && dataset.cols[colNo].type == TAttrType::Time) {
+			if (timeCol >= 0) { errList.Add("The input data has more than one time attribute, so " + where + ".timeAttr must be specified."); return false; }
+			timeCol = colNo; }
+		if (timeCol < 0) { errList.Add("The input data has no time attribute for the time range in " + where + "."); return false; }
+	}
+	if (! vFrom.Empty()) { if (! AddCond(dataset, timeCol, TOp::Ge, vFrom, where + ".from", errList)) return false; timeFrom = colConds[timeCol].Last().num; }
+	if (! vTo.Empty()) { if (! AddCond(dataset, timeCol, TOp::Lt, vTo, where + ".to", errList)) return false; timeTo = colConds[timeCol].Last().num; }
+	if (! Json_GetObjBool(jsonVal, "sorted", true, false, sorted, where, errList)) return false;
+	if (sorted && timeCol < 0) { errList.Add("\"sorted\" in " + where + " requires a time attribute (timeAttr)."); return false; }
+	// The other conditions.
+	PJsonVal vConds; if (! Json_GetObjKey(jsonVal, "conditions", true, true, vConds, where, errList)) return false;
+	if (! vConds.Empty() && ! vConds->IsNull())
+	{
+		if (! vConds->IsArr()) { errList.Add("The value of \"" + where + ".conditions\" is not an array."); return false; }
+		for (int i = 0; i < vConds->GetArrVals(); ++i)
+		{
+			PJsonVal vCond = vConds->GetArrVal(i); const TStr whereCond = TStr::Fmt("%s.conditions[%d]", where.CStr(), i);
+			TStr attr, opStr; TOp op;
+			if (! Json_GetObjStr(vCond, "attr", false, "", attr, whereCond, errList)) return false;
+			if (! Json_GetObjStr(vCond, "op", false, "", opStr, whereCond, errList)) return false;
+			if (! ParseOp(opStr, op)) { errList.Add("Unknown operator \"" + opStr + "\" in " + whereCond + "."); return false; }
+			const int colNo = GetInputCol(attr, whereCond); if (colNo < 0) return false;
+			PJsonVal vValue; if (! Json_GetObjKey(vCond, "value", false, false, vValue, whereCond, errList)) return false;
+			if (! AddCond(dataset, colNo, op, vValue, whereCond, errList)) return false;
+		}
+	}
+	bool any = false; for (const TCondV& conds : colConds) if (! conds.Empty()) any = true;
+	if (! any) colConds.Clr();
+	return true;
+}
+
+void TRowFilter::OrderCols(TIntV& cols) const
+{
+	if (Empty()) return;
+	TIntV ordered; 
+	for (int colNo : cols) if (colNo == timeCol && HasConds(colNo)) ordered.Add(colNo);
+	for (int colNo : cols) if (colNo != timeCol && HasConds(colNo)) ordered.Add(colNo);
+	for (int colNo : cols) if (! HasConds(colNo)) ordered.Add(colNo);
+	cols = ordered;
+}
+
 //-----------------------------------------------------------------------------
 //
-// TCsvReader 
+// TCsvScanner 
 //
 //-----------------------------------------------------------------------------
 
-class TCsvReader
+// A field returned by TCsvScanner.  It points into the scanner's buffer, where the value
+// has already been unescaped and NUL-terminated, so 'p' can be used as a C string.
+class TCsvField
 {
 public:
-	TStr separator;
-	TStr errMsg;
-	TCsvReader(const TStr &separator_) : separator(separator_) { }
+	const char *p; 
+	int len;
+	const char *CStr() const { return p; }
+	int Len() const { return len; }
+};
+
+typedef TVec<TCsvField> TCsvFieldV;
+
+// Splits CSV data into lines and values.  A value that begins with a quote character ends with
+// a quote followed by a separator, EOL or EOF; inside it, a pair of quotes stands for a single quote.
+// Lines can end with LF, CR or CRLF.  The scanner works directly on a writable buffer (usually
+// a TMappedFile) with at least one writable byte after its end: quoted values are unescaped in place
+// and every value is NUL-terminated in place, so that no memory needs to be allocated per value.
+// If a projection has been set, the values of the columns that aren't needed are only skipped over
+// (honouring the quotes, but without unescaping or NUL-terminating them).
+class TCsvScanner
+{
+protected:
+	char *cur, *end;
+	bool isSep[256], isDelim[256]; // isDelim = separator, CR or LF
+	char simdSep1, simdSep2; bool useSimd; // the vectorized search supports at most two different separator characters
+	TBoolV usedCols; // usedCols[i] = is the value in column i (0-based) needed; columns beyond the end are not needed; empty = all columns are needed
+	// Returns the first position in [p, end) that contains a separator, CR or LF; or 'end' if there is no such position.
+	char *FindDelim(char *p) const;
 	// This reads the next value but doesn't consume the separator or EOL that follows it.
-	bool ReadValue(TSIn& SIn, TChA& dest, int rowNo, int colNo);
-	// This reads the next line and also consumes the EOL that follows it.
-	bool ReadLine(TSIn& SIn, TStrV& dest, int rowNo);
+	bool ReadValue(char *&valueStart, char *&valueEnd, int rowNo, int colNo);
+	// Like ReadValue, but leaves the buffer unmodified and only reports errors.
+	bool SkipValue(int rowNo, int colNo);
+	// Skips the next 'n' values of the current line (or fewer if the line ends sooner) and the separators between them,
+	// stopping at the separator or EOL after the last one.  'colNo' is the column number of the last value
+	// before them and is increased by the number of values skipped.
+	bool SkipValues(int n, int rowNo, int &colNo);
+public:
+	TStr errMsg;
+	TCsvScanner(const TStr &separator, char *data, size_t len);
+	bool Eof() const { return cur >= end; }
+	// After this, ReadLine only returns the values of the columns where 'usedCols_' is true; the values of the
+	// other columns up to usedCols_.Len() are replaced by empty placeholders, and those beyond it are left out.
+	void SetProjection(const TBoolV& usedCols_) { usedCols = usedCols_; }
+	// This reads the next line and also consumes the EOL that follows it.  For an empty line, 'dest' will be empty.
+	// The values in 'dest' point into the buffer and remain valid for as long as the buffer.
+	bool ReadLine(TCsvFieldV& dest, int rowNo);
+	// Moves past the next line and its EOL like ReadLine, but without modifying the buffer.
+	// Returns false at EOF or if the line is malformed (errMsg is not set in that case).
+	bool SkipLine();
+	char *GetPos() const { return cur; }
 };
 
-bool TCsvReader::ReadLine(TSIn& SIn, TStrV& dest, int rowNo)
+TCsvScanner::TCsvScanner(const TStr &separator, char *data, size_t len) : cur(data), end(data + len)
 {
-	dest.Clr();
-	if (SIn.Eof()) return false;
+	memset(isSep, 0, sizeof(isSep)); 
+	for (int i = 0; i < separator.Len(); ++i) isSep[(uchar) separator[i]] = true;
+	memcpy(isDelim, isSep, sizeof(isDelim)); isDelim[(uchar) '\r'] = true; isDelim[(uchar) '\n'] = true;
+	int nSepChars = 0; simdSep1 = '\n'; simdSep2 = '\n';
+	for (int ch = 0; ch < 256; ++ch) if (isSep[ch]) { 
+		if (nSepChars == 0) simdSep1 = (char) ch; else if (nSepChars == 1) simdSep2 = (char) ch; 
+		++nSepChars; }
+	useSimd = (nSepChars <= 2);
+}
+
+inline char *TCsvScanner::FindDelim(char *p) const
+{
+#ifdef SS2_SSE2
+	if (useSimd)
+	{
+		const __m128i vCr = _mm_set1_epi8('\r'), vLf = _mm_set1_epi8('\n');
+		const __m128i vSep1 = _mm_set1_epi8(simdSep1), vSep2 = _mm_set1_epi8(simdSep2);
+		while (end - p >= 16)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i *) p);
+			const __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, vCr), _mm_cmpeq_epi8(v, vLf)), 
+				_mm_or_si128(_mm_cmpeq_epi8(v, vSep1), _mm_cmpeq_epi8(v, vSep2)));
+			const int mask = _mm_movemask_epi8(m);
+			if (mask != 0) return p + LowestSetBit((unsigned) mask);
+			p += 16;
+		}
+	}
+#endif
+	while (p < end && ! isDelim[(uchar) *p]) ++p;
+	return p;
+}
+
+bool TCsvScanner::ReadLine(TCsvFieldV& dest, int rowNo)
+{
+	dest.Clr(false);
+	if (cur >= end) return false;
 	// Empty line?
-	char ch = SIn.PeekCh();
-	if (ch == '\x0a') { SIn.GetCh(); return true; }
-	else if (ch == '\x0d') { 
-		SIn.GetCh(); if (! SIn.Eof() && SIn.PeekCh() == '\x0a') SIn.GetCh(); 
+	if (*cur == '\x0a') { ++cur; return true; }
+	else if (*cur == '\x0d') { 
+		++cur; if (cur < end && *cur == '\x0a') ++cur; 
 		return true; }
 	// Read the values.
-	int colNo = 0; TChA buf;
+	const int nUsedCols = usedCols.Len();
+	int colNo = 0; 
 	while (true)
 	{
 		// Read the next value.
-		if (! ReadValue(SIn, buf, rowNo, ++colNo)) return false;
-		dest.Add(TStr(buf));
-		if (SIn.Eof()) return true;
-		ch = SIn.PeekCh();
+		char ch; ++colNo;
+		if (nUsedCols == 0 || (colNo <= nUsedCols && usedCols[colNo - 1]))
+		{
+			char *valueStart, *valueEnd;
+			if (! ReadValue(valueStart, valueEnd, rowNo, colNo)) return false;
+			// Note that for unquoted values, valueEnd == cur, so we must look at the separator/EOL before NUL-terminating the value.
+			// At EOF, *end is the extra byte after the end of the data, which the caller has promised us we can overwrite.
+			ch = (cur < end) ? *cur : '\0';
+			*valueEnd = '\0';
+			dest.Add({valueStart, int(valueEnd - valueStart)});
+		}
+		else
+		{
+			// Skip this value and any unneeded values after it; empty placeholders keep the indices of the needed values unchanged.
+			int n = 1; while (colNo - 1 + n < nUsedCols && ! usedCols[colNo - 1 + n]) ++n;
+			if (colNo - 1 + n >= nUsedCols) n = TInt::Mx; // skip the rest of the line
+			const int firstColNo = colNo; --colNo;
+			if (! SkipValues(n, rowNo, colNo)) return false;
+			for (int i = firstColNo; i <= colNo && i <= nUsedCols; ++i) dest.Add({"", 0});
+			ch = (cur < end) ? *cur : '\0';
+		}
+		if (cur >= end) return true;
 		// Eat the separator.
-		if (separator.IsChIn(ch)) { SIn.GetCh(); continue; }
+		if (isSep[(uchar) ch]) { ++cur; continue; }
 		// ...or the EOL.
 		if (ch == '\x0d') {
-			SIn.GetCh(); if (! SIn.Eof() && SIn.PeekCh() == '\x0a') SIn.GetCh();
+			++cur; if (cur < end && *cur == '\x0a') ++cur;
 			return true; }
-		else if (ch == '\x0a') { SIn.GetCh(); return true; }
+		else if (ch == '\x0a') { ++cur; return true; }
 		else IAssert(false); // Why has ReadValue stopped here?
 	}
 }
 
-bool TCsvReader::ReadValue(TSIn& SIn, TChA& dest, int rowNo, int colNo) 
+bool TCsvScanner::SkipLine()
 {
-	dest.Clr();
-	if (SIn.Eof()) return false;
-	char ch = SIn.PeekCh();
 	const char Quote = '\"';
-	bool quoted = (ch == Quote);
-	if (! quoted)
+	if (cur >= end) return false;
+	if (*cur == '\x0a') { ++cur; return true; }
+	else if (*cur == '\x0d') { 
+		++cur; if (cur < end && *cur == '\x0a') ++cur; 
+		return true; }
+	while (true)
 	{
-		while (! SIn.Eof()) {
-			ch = SIn.PeekCh();
-			if (ch == '\r' || ch == '\n' || separator.IsChIn(ch)) break;
-			dest += SIn.GetCh(); }
+		if (cur < end && *cur == Quote)
+		{
+			++cur; 
+			while (true) {
+				char *quotePos = (char *) memchr(cur, Quote, end - cur);
+				if (! quotePos) return false;
+				cur = quotePos + 1; 
+				if (cur < end && *cur == Quote) { ++cur; continue; }
+				break; }
+			if (cur < end && ! isDelim[(uchar) *cur]) return false;
+		}
+		else cur = FindDelim(cur);
+		if (cur >= end) return true;
+		const char ch = *cur++;
+		if (isSep[(uchar) ch]) continue;
+		if (ch == '\x0d' && cur < end && *cur == '\x0a') ++cur;
 		return true;
 	}
-	SIn.GetCh(); // Eat the quote character.
-	while (! SIn.Eof())
+}
+
+bool TCsvScanner::SkipValue(int rowNo, int colNo)
+{
+	const char Quote = '\"';
+	if (cur >= end || *cur != Quote) { cur = FindDelim(cur); return true; }
+	++cur; // Eat the quote character.
+	while (cur < end)
+	{
+		char *quotePos = (char *) memchr(cur, Quote, end - cur);
+		if (! quotePos) break;
+		cur = quotePos + 1; 
+		if (cur >= end) return true;
+		const char ch2 = *cur;
+		if (ch2 == Quote) { ++cur; continue; }
+		if (isDelim[(uchar) ch2]) return true;
+		errMsg = TStr::Fmt("Error in CSV data (row %d, col %d): unexpected character after the end of a quoted value (separator or EOL/EOF expected).", rowNo, colNo);
+		return false;
+	}
+	cur = end;
+	errMsg = TStr::Fmt("Error in CSV data (row %d, col %d): unexpected EOF in a quoted value.", rowNo, colNo);
+	return false;
+}
+
+bool TCsvScanner::SkipValues(int n, int rowNo, int &colNo)
+{
+	const char Quote = '\"';
+	while (true)
 	{
-		ch = SIn.GetCh();
-		// Non-quote character?
-		if (ch != Quote) { dest += ch; continue; }
+		// 'cur' is at the start of value 'colNo + 1'; 'n' values remain to be skipped.
+		if (cur < end && *cur == Quote) { if (! SkipValue(rowNo, colNo + 1)) return false; }
+		else
+		{
+#ifdef SS2_SSE2
+			// Count the separators 16 bytes at a time, until reaching an EOL or a quote at the start of a value.
+			bool atValueStart = false;
+			const __m128i vCr = _mm_set1_epi8('\r'), vLf = _mm_set1_epi8('\n'), vQuote = _mm_set1_epi8(Quote);
+			const __m128i vSep1 = _mm_set1_epi8(simdSep1), vSep2 = _mm_set1_epi8(simdSep2);
+			while (useSimd && n > 1 && end - cur >= 16)
+			{
+				const __m128i v = _mm_loadu_si128((const __m128i *) cur);
+				const unsigned sepMask = (unsigned) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, vSep1), _mm_cmpeq_epi8(v, vSep2)));
+				const unsigned eolMask = (unsigned) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, vCr), _mm_cmpeq_epi8(v, vLf)));
+				const unsigned quoteMask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, vQuote));
+				const unsigned stopMask = eolMask | ((sepMask << 1) & quoteMask);
+				unsigned seps = sepMask & (stopMask ? (1u << LowestSetBit(stopMask)) - 1 : 0xffffu);
+				if (seps == 0) { if (stopMask) break; cur += 16; continue; }
+				const int nSeps = BitCount(seps);
+				if (nSeps >= n) { 
+					for (int i = 1; i < n; ++i) seps &= seps - 1;
+					cur += LowestSetBit(seps); colNo += n; return true; }
+				cur += HighestSetBit(seps) + 1; colNo += nSeps; n -= nSeps; 
+				atValueStart = true; break;
+			}
+			if (atValueStart) continue;
+#endif
+			cur = FindDelim(cur);
+		}
+		++colNo; --n;
+		if (n == 0 || cur >= end || ! isSep[(uchar) *cur]) return true;
+		++cur;
+	}
+}
+
+bool TCsvScanner::ReadValue(char *&valueStart, char *&valueEnd, int rowNo, int colNo)
+{
+	const char Quote = '\"';
+	bool quoted = (cur < end && *cur == Quote);
+	if (! quoted) { valueStart = cur; cur = FindDelim(cur); valueEnd = cur; return true; }
+	++cur; // Eat the quote character.
+	// Unescape the value in place: 'dest' trails behind 'cur' by the number of doubled quotes seen so far.
+	char *dest = cur; valueStart = cur;
+	while (cur < end)
+	{
+		char *quotePos = (char *) memchr(cur, Quote, end - cur);
+		if (! quotePos) break;
+		const size_t n = quotePos - cur;
+		if (dest != cur) memmove(dest, cur, n); 
+		dest += n; cur = quotePos + 1; 
 		// Quote followed by EOF?
-		if (SIn.Eof()) { return true; } 
-		char ch2 = SIn.PeekCh();
+		if (cur >= end) { valueEnd = dest; return true; }
+		const char ch2 = *cur;
 		// Double quote?
-		if (ch2 == Quote) { dest += SIn.GetCh(); continue; }
+		if (ch2 == Quote) { *dest++ = Quote; ++cur; continue; }
 		// Quote followed by a separator or EOL?
-		if (ch2 == '\r' || ch2 == '\n' || separator.IsChIn(ch2)) { return true; }
+		if (ch2 == '\r' || ch2 == '\n' || isSep[(uchar) ch2]) { valueEnd = dest; return true; }
 		// Otherwise it's an error.
 		errMsg = TStr::Fmt("Error in CSV data (row %d, col %d): unexpected character after the end of a quoted value (separator or EOL/EOF expected).", rowNo, colNo);
 		return false;
 	}
+	cur = end;
 	errMsg = TStr::Fmt("Error in CSV data (row %d, col %d): unexpected EOF in a quoted value.", rowNo, colNo);
 	return false;
 }
@@ -874,14 +2047,28 @@ class TDatasetCsvFeeder
 {
 protected:
 	TDataset& dataset;
+	const TRowFilter& filter;
 	TStr fileName;
 	TIntV dataColToCsvCol; // index: the column index from 'dataset.cols'; value: index of the corresponding column in this CSV file
+	TIntV inputCols; // indices (into 'dataset.cols') of the columns that are read from the CSV file
+	// AddRow converts the values of a row into these buffers (index: the column index from 'dataset.cols'),
+	// and only appends them to the columns once the whole row has been converted successfully.
+	// They are reused from one row to the next, so that no memory needs to be allocated per row.
+	TFltV fltBuf; TIntV intBuf; TTimeStampV timeBuf; TVec<const char *> strBuf;
+	TVec<TTimeFormat> timeFormats; // index: the column index from 'dataset.cols'
+	// Converts 'value' into the time column 'colNo'.
+	bool ParseTime(int colNo, const TCsvField& value, TTimeStamp& ts);
 public:
-	TDatasetCsvFeeder(TDataset& dataset_, const TStr& fileName_) : dataset(dataset_), fileName(fileName_) { }
+	TDatasetCsvFeeder(TDataset& dataset_, const TStr& fileName_) : dataset(dataset_), filter(dataset_.rowFilter), fileName(fileName_) { }
 	// Initializes 'dataColToCsvCol'.
 	bool SetHeaders(const TStrV& headers, int rowNo, TStrV& errors);
+	// Sets 't' to the value (as returned by TTimeStamp::GetFlt) of the time column 'colNo' in the row 'values'.  
+	// Returns false, without reporting an error, if the value is missing or can't be parsed.
+	bool GetTime(const TCsvFieldV& values, int colNo, double& t);
+	// Returns the projection (see TCsvScanner::SetProjection) of the CSV columns that AddRow needs.
+	void GetUsedCsvCols(TBoolV& usedCols) const;
 	// Parses 'values' and adds them to the end of each column in 'dataset.cols'.
-	bool AddRow(const TStrV& values, int rowNo, TConversionProgress& convProg);
+	bool AddRow(const TCsvFieldV& values, int rowNo, TConversionProgress& convProg);
 };
 
 bool TDatasetCsvFeeder::SetHeaders(const TStrV& headers, int rowNo, TStrV& errors)
@@ -889,11 +2076,14 @@ bool TDatasetCsvFeeder::SetHeaders(const TStrV& headers, int rowNo, TStrV& error
 	if (headers.Empty()) { errors.Add(TStr::Fmt("[%s] The header row is empty.", fileName.CStr())); return false; } 
 	const int nCols = dataset.cols.Len(), nHeaders = headers.Len();
 	dataColToCsvCol.Clr(); dataColToCsvCol.Gen(nCols); dataColToCsvCol.PutAll(-1);
+	inputCols.Clr(); fltBuf.Gen(nCols); intBuf.Gen(nCols); timeBuf.Gen(nCols); strBuf.Gen(nCols); timeFormats.Gen(nCols);
 	bool retVal = true;
 	for (int colNo = 0; colNo < nCols; ++colNo)
 	{
 		const TDataColumn &col = dataset.cols[colNo];
 		if (col.source != TAttrSource::Input) continue;
+		inputCols.Add(colNo);
+		if (col.type == TAttrType::Time && col.subType == TAttrSubtype::String) timeFormats[colNo].Compile(col.formatStr.CStr());
 		int found = -1;
 		for (int headNo = 0; headNo < nHeaders; ++headNo)
 			if (headers[headNo] == col.sourceName)
@@ -904,74 +2094,1039 @@ bool TDatasetCsvFeeder::SetHeaders(const TStrV& headers, int rowNo, TStrV& error
 		if (found < 0) { errors.Add(TStr::Fmt("[%s] No header matches the attribute \"%s\".", fileName.CStr(), col.sourceName.CStr())); retVal = false; }
 		dataColToCsvCol[colNo] = found;
 	}
+	filter.OrderCols(inputCols);
 	return retVal;
 }
 
-bool TDatasetCsvFeeder::AddRow(const TStrV& values, int rowNo, TConversionProgress& convProg)
+void TDatasetCsvFeeder::GetUsedCsvCols(TBoolV& usedCols) const
+{
+	int nUsedCols = 0; for (int colNo : inputCols) nUsedCols = std::max(nUsedCols, dataColToCsvCol[colNo] + 1);
+	usedCols.Gen(nUsedCols); usedCols.PutAll(false);
+	for (int colNo : inputCols) if (dataColToCsvCol[colNo] >= 0) usedCols[dataColToCsvCol[colNo]] = true;
+}
+
+bool TDatasetCsvFeeder::ParseTime(int colNo, const TCsvField& value, TTimeStamp& ts)
+{
+	const TDataColumn &col = dataset.cols[colNo];
+	if (col.subType == TAttrSubtype::String) {
+		TSecTm secTm; int ns; if (! timeFormats[colNo].Parse(value.CStr(), secTm, ns)) return false;
+		if (col.timeType == TTimeType::Time) ts.SetTime(secTm.GetAbsSecs(), ns);
+		else if (col.timeType == TTimeType::Int) ts.SetInt(secTm.GetAbsSecs()); 
+		else if (col.timeType == TTimeType::Flt) ts.SetFlt(secTm.GetAbsSecs() + double(ns) / 1e9);
+		else IAssert(false); }
+	else if (col.subType == TAttrSubtype::Int) {
+		int64_t intVal; if (! ParseInt64(value.CStr(), value.CStr() + value.Len(), intVal)) return false;
+		if (col.timeType == TTimeType::Time) ts.SetTime(intVal, 0);
+		else if (col.timeType == TTimeType::Int) ts.SetInt(intVal); 
+		else if (col.timeType == TTimeType::Flt) ts.SetFlt((double) intVal);
+		else IAssert(false); }
+	else if (col.subType == TAttrSubtype::Flt) {
+		double x; if (! ParseFlt(value.CStr(), value.CStr() + value.Len(), x)) return false;
+		double fx = floor(x);
+		int64_t intVal = (int64_t) fx; int ns = int((x - fx) * 1e9);
+		if (ns < 0) ns = 0; else if (ns >= 1000000000) { ns -= 1000000000; ++intVal; }
+		if (col.timeType == TTimeType::Time) ts.SetTime(intVal, ns);
+		else if (col.timeType == TTimeType::Int) ts.SetInt(intVal); 
+		else if (col.timeType == TTimeType::Flt) ts.SetFlt(x);
+		else IAssert(false); }
+	else IAssert(false);
+	return true;
+}
+
+bool TDatasetCsvFeeder::GetTime(const TCsvFieldV& values, int colNo, double& t)
+{
+	const int csvColNo = dataColToCsvCol[colNo]; TTimeStamp ts;
+	if (csvColNo < 0 || csvColNo >= values.Len() || ! ParseTime(colNo, values[csvColNo], ts)) return false;
+	t = ts.GetFlt(); return true;
+}
+
+bool TDatasetCsvFeeder::AddRow(const TCsvFieldV& values, int rowNo, TConversionProgress& convProg)
+{
+#define ON_ERROR(x) { \
+		if (convProg.nErrorsReported >= convProg.maxErrorsToReport) convProg.nErrorsSuppressed++; \
+		else { convProg.nErrorsReported++; convProg.errors.Add((x)); } \
+		convProg.nRowsIgnored++; return convProg.ignoreErrors; } 
+	// Convert the values.
+	for (int colNo : inputCols)
+	{
+		const TDataColumn &col = dataset.cols[colNo];
+		int csvColNo = dataColToCsvCol[colNo];
+		if (csvColNo < 0 || csvColNo >= values.Len()) ON_ERROR(TStr::Fmt("[%s] Error in CSV data (row %d): this row has %d values, attribute \"%s\" should be in column %d based on headers.", fileName.CStr(), rowNo, int(values.Len()), col.name.CStr(), csvColNo + 1));
+		const TCsvField& value = values[csvColNo];
+		const char *valueEnd = value.CStr() + value.Len();
+		//
+		if (col.type == TAttrType::Numeric && (col.subType == TAttrSubtype::Flt || col.subType == TAttrSubtype::Int))
+		{
+			if (col.subType == TAttrSubtype::Flt) { if (! ParseFlt(value.CStr(), valueEnd, fltBuf[colNo].Val)) ON_ERROR("The value of data[" + TInt::GetStr(rowNo - 1) + "].\"" + col.sourceName + "\" is not a floating-point number."); }
+			else if (col.subType == TAttrSubtype::Int) { if (! ParseInt(value.CStr(), valueEnd, intBuf[colNo].Val)) ON_ERROR("The value of data[" + TInt::GetStr(rowNo - 1) + "].\"" + col.sourceName + "\" is not an integer."); }
+			else IAssert(false);
+		}
+		else if (col.type == TAttrType::Categorical)
+		{
+			// The key is only looked up when the row gets added, so that an erroneous row doesn't leave any unused keys behind.
+			if (col.subType == TAttrSubtype::String) strBuf[colNo] = value.CStr(); 
+			else if (col.subType == TAttrSubtype::Int) { if (! ParseInt(value.CStr(), valueEnd, intBuf[colNo].Val)) ON_ERROR("The value of data[" + TInt::GetStr(rowNo - 1) + "].\"" + col.sourceName + "\" is not an integer."); }
+			else IAssert(false);
+		}
+		else if (col.type == TAttrType::Time)
+		{
+			if (! ParseTime(colNo, value, timeBuf[colNo]))
+			{
+				if (col.subType == TAttrSubtype::String) ON_ERROR(TStr::Fmt("Error parsing data[%d].\"%s\" = \"%s\" as a datetime value with the format \"%s\".", rowNo - 1, col.sourceName.CStr(), value.CStr(), col.formatStr.CStr())); 
+				if (col.subType == TAttrSubtype::Int) ON_ERROR("The value of data[" + TInt::GetStr(rowNo - 1) + "].\"" + col.sourceName + "\" is not an integer."); 
+				ON_ERROR("The value of data[" + TInt::GetStr(rowNo - 1) + "].\"" + col.sourceName + "\" is not a floating-point number."); 
+			}
+		}
+		else if (col.type == TAttrType::Text)
+		{
+			// ToDo.
+			IAssert(false);
+		}
+		else IAssert(false);
+		// Drop the row if this value doesn't pass the filter.  
+		if (filter.HasConds(colNo))
+		{
+			if (col.type == TAttrType::Categorical && col.subType == TAttrSubtype::String) { if (filter.Accepts(colNo, value.CStr(), value.Len())) continue; }
+			else {
+				const double x = (col.type == TAttrType::Time) ? timeBuf[colNo].GetFlt() : (col.subType == TAttrSubtype::Flt) ? fltBuf[colNo].Val : double(intBuf[colNo]);
+				if (filter.Accepts(colNo, x)) continue; 
+				if (filter.IsPastEnd(colNo, x)) convProg.pastFilterEnd = true; }
+			convProg.nRowsFiltered++; return true;
+		}
+	}
+	// Append the converted values to the columns.
+	for (int colNo : inputCols)
+	{
+		TDataColumn &col = dataset.cols[colNo];
+		if (col.type == TAttrType::Numeric) {
+			if (col.subType == TAttrSubtype::Flt) col.fltVals.Add(fltBuf[colNo]); 
+			else col.intVals.Add(intBuf[colNo]); }
+		else if (col.type == TAttrType::Categorical) {
+			if (col.subType == TAttrSubtype::String) col.AddCatVal(strBuf[colNo]); 
+			else col.AddCatVal(intBuf[colNo].Val); }
+		else if (col.type == TAttrType::Time) col.timeVals.Add(timeBuf[colNo]);
+	}
+	dataset.nRows += 1;
+	return true;
+#undef ON_ERROR
+}
+
+//-----------------------------------------------------------------------------
+//
+// Parallel CSV reading
+//
+//-----------------------------------------------------------------------------
+// Large CSV inputs are split into chunks of roughly equal size at line boundaries; each chunk 
+// is parsed by a separate thread into its own TDataset, and the rows of these partial datasets
+// are then appended to the main dataset in order.  
+
+// The data is only read in parallel if each chunk would get at least this many bytes.
+static const size_t MinCsvChunkSize = size_t(1) << 20;
+// When seeking the time range of a sorted filter, the binary search stops at this many bytes.
+static const size_t MinCsvSeekRange = size_t(1) << 16;
+
+// Returns the position after the first EOL in [p, end), or 'end' if there is none.
+static char *NextLineStart(char *p, char *end)
+{
+	while (p < end && *p != '\x0a' && *p != '\x0d') ++p;
+	if (p < end && *p == '\x0d') ++p;
+	if (p < end && *p == '\x0a') ++p;
+	return p;
+}
+
+class TCsvChunk
+{
+public:
+	char *start, *end;
+	int firstRowNo, nLines; // nLines also counts empty lines, so that row numbers in error messages are the same as when reading sequentially
+	bool ok; 
+	TStr errMsg; // error from the scanner (as opposed to conversion errors, which are in 'errors')
+	TStrV errors; int nErrorsSuppressed, nRowsIgnored, nRowsFiltered;
+	bool pastFilterEnd;
+	PDataset dataset;
+	TCsvChunk() : start(nullptr), end(nullptr), firstRowNo(0), nLines(0), ok(false), nErrorsSuppressed(0), nRowsIgnored(0), nRowsFiltered(0), pastFilterEnd(false) { }
+};
+
+typedef TVec<TCsvChunk> TCsvChunkV;
+
+// Splits [data, dataEnd) into at most 'nChunks' chunks that begin and end at line boundaries.
+// Since a quoted value may contain line breaks, an EOL can only be recognized as a line boundary
+// by scanning from an earlier line boundary.  We guess the chunk boundaries (the first EOL after 
+// each of the evenly spaced split points), then scan all the chunks in parallel and check that each
+// chunk's last line ends exactly at the next guessed boundary.  Since the first chunk begins at 
+// a known line boundary, this verifies all the guesses.  Returns false if the data cannot be split
+// like this (e.g. because of a multi-line quoted value that spans a guessed boundary, or because of 
+// a malformed line); the caller should then read the data sequentially.
+static bool SplitCsvIntoChunks(const TStr& fieldSep, char *data, char *dataEnd, int firstRowNo, int nChunks, TCsvChunkV& chunks)
+{
+	chunks.Clr(); 
+	const size_t len = dataEnd - data;
+	TVec<char *> starts; starts.Add(data);
+	for (int chunkNo = 1; chunkNo < nChunks; ++chunkNo)
+	{
+		char *p = data + len / nChunks * chunkNo;
+		if (p <= starts.Last()) continue;
+		p = NextLineStart(p, dataEnd);
+		if (p >= dataEnd) break;
+		if (p > starts.Last()) starts.Add(p);
+	}
+	if (starts.Len() < 2) return false;
+	nChunks = starts.Len(); chunks.Gen(nChunks);
+	for (int chunkNo = 0; chunkNo < nChunks; ++chunkNo) {
+		chunks[chunkNo].start = starts[chunkNo]; 
+		chunks[chunkNo].end = (chunkNo + 1 < nChunks) ? starts[chunkNo + 1] : dataEnd; }
+	ParallelFor(nChunks, nChunks, [&fieldSep, dataEnd, &chunks] (int chunkNo) {
+		TCsvChunk &chunk = chunks[chunkNo];
+		// The scanner may run past 'chunk.end' if the guessed boundary was wrong, so it gets the rest of the data.
+		TCsvScanner scanner { fieldSep, chunk.start, size_t(dataEnd - chunk.start) };
+		chunk.ok = true; chunk.nLines = 0;
+		while (scanner.GetPos() < chunk.end) {
+			if (! scanner.SkipLine()) { chunk.ok = false; break; }
+			++chunk.nLines; }
+		if (scanner.GetPos() != chunk.end) chunk.ok = false; });
+	for (TCsvChunk &chunk : chunks) {
+		if (! chunk.ok) { chunks.Clr(); return false; }
+		chunk.firstRowNo = firstRowNo; firstRowNo += chunk.nLines; }
+	return true;
+}
+
+// Reads the chunks prepared by SplitCsvIntoChunks and appends their rows to 'dataset'.
+// Errors are reported in the same order, and subject to the same limits, as if the data 
+// had been read sequentially.  Categorical keys are added to 'dataset' in the order of their first 
+// appearance, so the keyIds are also the same as after a sequential read.
+static bool ReadCsvChunks(TDataset& dataset, TCsvChunkV& chunks, const TStr& fieldSep, const TStr& fileName, const TStrV& headers, TConversionProgress& convProg)
+{
+	const int nChunks = chunks.Len(), nCols = dataset.cols.Len();
+	// The partial datasets are prepared here rather than in the worker threads because this
+	// involves copying the config smart pointer, whose reference count isn't thread-safe.
+	for (TCsvChunk &chunk : chunks) { chunk.dataset = new TDataset(); chunk.dataset->nRows = 0; chunk.dataset->InitColsFromConfig(dataset.config); chunk.dataset->rowFilter = dataset.rowFilter; }
+	ParallelFor(nChunks, dataset.config->numThreads, [&] (int chunkNo) {
+		TCsvChunk &chunk = chunks[chunkNo];
+		TConversionProgress chunkProg { chunk.errors, convProg.ignoreErrors }; chunkProg.maxErrorsToReport = convProg.maxErrorsToReport;
+		TDatasetCsvFeeder feeder { *chunk.dataset, fileName };
+		chunk.ok = feeder.SetHeaders(headers, chunk.firstRowNo, chunk.errors);
+		TCsvScanner scanner { fieldSep, chunk.start, size_t(chunk.end - chunk.start) };
+		TBoolV usedCols; feeder.GetUsedCsvCols(usedCols); scanner.SetProjection(usedCols);
+		TCsvFieldV values; int rowNo = chunk.firstRowNo - 1;
+		while (chunk.ok && ! scanner.Eof() && ! chunkProg.pastFilterEnd)
+		{
+			++rowNo; if (! scanner.ReadLine(values, rowNo)) { chunk.errMsg = TStr::Fmt("[%s] %s", fileName.CStr(), scanner.errMsg.CStr()); chunk.ok = false; break; }
+			if (values.Empty()) continue; // skip empty lines
+			if (! feeder.AddRow(values, rowNo, chunkProg)) chunk.ok = false;
+		}
+		chunk.nErrorsSuppressed = chunkProg.nErrorsSuppressed; chunk.nRowsIgnored = chunkProg.nRowsIgnored; 
+		chunk.nRowsFiltered = chunkProg.nRowsFiltered; chunk.pastFilterEnd = chunkProg.pastFilterEnd; });
+	// Collect the errors, stopping at the first chunk where the reading was aborted.  If a chunk has reached 
+	// the end of a sorted filter's time range, the following chunks are ignored, as in a sequential read.
+	for (int chunkNo = 0; chunkNo < nChunks; ++chunkNo)
+	{
+		const TCsvChunk &chunk = chunks[chunkNo];
+		for (const TStr& error : chunk.errors) {
+			if (convProg.nErrorsReported >= convProg.maxErrorsToReport) convProg.nErrorsSuppressed++;
+			else { convProg.nErrorsReported++; convProg.errors.Add(error); } }
+		convProg.nErrorsSuppressed += chunk.nErrorsSuppressed; convProg.nRowsIgnored += chunk.nRowsIgnored; convProg.nRowsFiltered += chunk.nRowsFiltered;
+		if (! chunk.errMsg.Empty()) convProg.errors.Add(chunk.errMsg);
+		if (! chunk.ok) return false;
+		if (chunk.pastFilterEnd) { convProg.pastFilterEnd = true; chunks.Trunc(chunkNo + 1); break; }
+	}
+	// Append the rows of the partial datasets to 'dataset'.
+	int nNewRows = 0; for (const TCsvChunk &chunk : chunks) nNewRows += chunk.dataset->nRows;
+	ParallelFor(nCols, dataset.config->numThreads, [&] (int colNo) {
+		TDataColumn &col = dataset.cols[colNo];
+		if (col.source != TAttrSource::Input) return;
+		if (col.type == TAttrType::Numeric && col.subType == TAttrSubtype::Flt) {
+			col.fltVals.Reserve(col.fltVals.Len() + nNewRows);
+			for (const TCsvChunk &chunk : chunks) col.fltVals.AddV(chunk.dataset->cols[colNo].fltVals); }
+		else if (col.type == TAttrType::Numeric && col.subType == TAttrSubtype::Int) {
+			col.intVals.Reserve(col.intVals.Len() + nNewRows);
+			for (const TCsvChunk &chunk : chunks) col.intVals.AddV(chunk.dataset->cols[colNo].intVals); }
+		else if (col.type == TAttrType::Time) {
+			col.timeVals.Reserve(col.timeVals.Len() + nNewRows);
+			for (const TCsvChunk &chunk : chunks) col.timeVals.AddV(chunk.dataset->cols[colNo].timeVals); }
+		else if (col.type == TAttrType::Categorical)
+		{
+			col.intVals.Reserve(col.intVals.Len() + nNewRows);
+			TIntV keyIdMap; // keyIdMap[i] = the keyId, in 'col', of the key whose keyId in the chunk's column is 'i'
+			for (const TCsvChunk &chunk : chunks)
+			{
+				const TDataColumn &part = chunk.dataset->cols[colNo];
+				// The keyIds in the chunk's column are 0, 1, ..., in the order of the keys' first appearance.
+				keyIdMap.Clr(false);
+				if (col.subType == TAttrSubtype::String) for (int partKeyId = 0; partKeyId < part.strKeyMap.Len(); ++partKeyId) {
+					const char *key = part.strKeyMap.GetKey(partKeyId); const int count = part.strKeyMap[partKeyId];
+					int keyId = col.strKeyMap.GetKeyId(key);
+					if (! IsValidId(keyId)) { keyId = col.strKeyMap.AddKey(key); col.strKeyMap[keyId] = count; }
+					else col.strKeyMap[keyId] += count;
+					keyIdMap.Add(keyId); }
+				else if (col.subType == TAttrSubtype::Int) for (int partKeyId = 0; partKeyId < part.intKeyMap.Len(); ++partKeyId) {
+					const int key = part.intKeyMap.GetKey(partKeyId), count = part.intKeyMap[partKeyId];
+					int keyId = col.intKeyMap.GetKeyId(key);
+					if (! IsValidId(keyId)) { keyId = col.intKeyMap.AddKey(key); col.intKeyMap[keyId] = count; }
+					else col.intKeyMap[keyId] += count;
+					keyIdMap.Add(keyId); }
+				else IAssert(false);
+				for (int partKeyId : part.intVals) col.intVals.Add(keyIdMap[partKeyId]);
+			}
+		}
+		else IAssert(false); });
+	dataset.nRows += nNewRows;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// TCsvDataReader
+//
+//-----------------------------------------------------------------------------
+
+// Reads CSV data into a TDataset.  The data may be passed in several consecutive parts
+// (e.g. as it is being decompressed), each of which must consist of complete lines, except
+// for the last one.  Large parts are split into chunks that are read in parallel.
+class TCsvDataReader
+{
+protected:
+	TDataset& dataset;
+	TStr fieldSep, fileName;
+	TDatasetCsvFeeder feeder;
+	TStrV headers; // empty until the header row has been read
+	TBoolV usedCols; // the CSV columns needed by 'feeder'; see TCsvScanner::SetProjection
+	int rowNo; // the line number of the last line read so far
+	// Narrows [lo, hi), whose bounds must be line boundaries, around the first row whose time is not earlier than 't' 
+	// (in the filter's time column), assuming that the rows are sorted by time: afterwards, the rows before 'lo' are 
+	// earlier than 't' and those from 'hi' on are not.  The probes take the first EOL after an arbitrary position
+	// to be a line boundary, so this is only reliable if the quoted values contain no line breaks.
+	void SeekTime(char *&lo, char *&hi, double t);
+	// Counts the lines in [from, to); returns false if 'to' is not the end of a line.
+	bool CountLines(char *from, char *to, int &nLines) const;
+public:
+	TCsvDataReader(TDataset& dataset_, const TStr& fieldSep_, const TStr& fileName_) : dataset(dataset_), fieldSep(fieldSep_), fileName(fileName_), feeder(dataset_, fileName_), rowNo(0) { }
+	// Reads the lines in [data, data + len).  There must be at least one writable byte after the end of the data.
+	bool ReadPart(char *data, size_t len, TConversionProgress& convProg);
+	// Must be called after the last part has been read.
+	bool Finish(TConversionProgress& convProg);
+	// Returns the end of the last line in [data, data + len) that is known to be complete, i.e. whose EOL is followed
+	// by more data, or 'data' if there is no such line.  (A malformed line is treated as incomplete.)
+	char *FindLastLineEnd(char *data, size_t len) const;
+};
+
+bool TCsvDataReader::ReadPart(char *data, size_t len, TConversionProgress& convProg)
+{
+	TCsvScanner scanner { fieldSep, data, len };
+	TCsvFieldV values; 
+	// Read the headers.
+	while (headers.Empty())
+	{
+		if (scanner.Eof()) return true;
+		++rowNo; if (! scanner.ReadLine(values, rowNo)) { convProg.errors.Add(TStr::Fmt("[%s] %s", fileName.CStr(), scanner.errMsg.CStr())); return false; }
+		if (values.Empty()) continue; 
+		for (const TCsvField& value : values) headers.Add(value.CStr());
+		if (! feeder.SetHeaders(headers, rowNo, convProg.errors)) return false;
+		feeder.GetUsedCsvCols(usedCols);
+	}
+	char *dataStart = scanner.GetPos(), *dataEnd = data + len, *seekEnd = dataEnd;
+	// If the rows are sorted by time, skip those before the filter's time range, and find roughly
+	// where it ends.  The position found for 'from' is only used if scanning the lines before it
+	// (which also counts them) ends exactly there, i.e. if it is not inside a quoted value.
+	const TRowFilter &filter = dataset.rowFilter;
+	if (filter.sorted && filter.HasConds(filter.timeCol) && size_t(dataEnd - dataStart) > MinCsvSeekRange)
+	{
+		char *lo = dataStart, *hi = dataEnd; int nSkipped = 0;
+		if (filter.timeFrom > -std::numeric_limits<double>::infinity()) {
+			SeekTime(lo, hi, filter.timeFrom); 
+			if (CountLines(dataStart, lo, nSkipped)) { dataStart = lo; rowNo += nSkipped; } 
+			lo = dataStart; hi = dataEnd; }
+		if (filter.timeTo < std::numeric_limits<double>::infinity()) { SeekTime(lo, hi, filter.timeTo); seekEnd = hi; }
+		NotifyInfo("TDataset::ReadDataFromCsv: skipped %d rows before the filter's time range, which ends near byte %llu of this part (%llu bytes).\n", nSkipped, (unsigned long long) (seekEnd - data), (unsigned long long) len);
+	}
+	scanner = TCsvScanner { fieldSep, dataStart, size_t(dataEnd - dataStart) };
+	scanner.SetProjection(usedCols);
+	// Process the rest of the data.  Large inputs are split into chunks that are read in parallel;
+	// the chunks only cover the data up to 'seekEnd', which SplitCsvIntoChunks verifies to be the end of a line.
+	const int nThreads = GetNumThreads(dataset.config->numThreads);
+	const int nChunks = (int) std::min(size_t(nThreads), size_t(seekEnd - dataStart) / MinCsvChunkSize);
+	TCsvChunkV chunks;
+	if (nChunks > 1 && ! SplitCsvIntoChunks(fieldSep, dataStart, seekEnd, rowNo + 1, nChunks, chunks)) 
+		NotifyInfo("TDataset::ReadDataFromCsv: could not split the data into chunks; reading sequentially.\n");
+	if (! chunks.Empty()) 
+	{
+		NotifyInfo("TDataset::ReadDataFromCsv: reading %d chunks in parallel.\n", int(chunks.Len()));
+		if (! ReadCsvChunks(dataset, chunks, fieldSep, fileName, headers, convProg)) return false;
+		rowNo = chunks.Last().firstRowNo + chunks.Last().nLines - 1;
+		if (seekEnd < dataEnd) convProg.pastFilterEnd = true;
+	}
+	else while (! scanner.Eof() && ! convProg.pastFilterEnd)
+	{
+		++rowNo; if (! scanner.ReadLine(values, rowNo)) { convProg.errors.Add(TStr::Fmt("[%s] %s", fileName.CStr(), scanner.errMsg.CStr())); return false; }
+		if (values.Empty()) continue; // skip empty lines
+		if (! feeder.AddRow(values, rowNo, convProg)) return false;
+	}
+	return true;
+}
+
+bool TCsvDataReader::CountLines(char *from, char *to, int &nLines) const
+{
+	TCsvScanner scanner { fieldSep, from, size_t(to - from) };
+	nLines = 0; while (scanner.GetPos() < to) { if (! scanner.SkipLine()) return false; ++nLines; }
+	return scanner.GetPos() == to;
+}
+
+void TCsvDataReader::SeekTime(char *&lo, char *&hi, double t)
+{
+	TChA lineBuf; TCsvFieldV values;
+	while (size_t(hi - lo) > MinCsvSeekRange)
+	{
+		char *p = NextLineStart(lo + (hi - lo) / 2, hi);
+		if (p >= hi) break;
+		// Parse a copy of the line, since the scanner modifies its buffer.
+		lineBuf.Clr(); lineBuf.AddBf(p, int(NextLineStart(p, hi) - p));
+		TCsvScanner scanner { fieldSep, lineBuf.CStr(), size_t(lineBuf.Len()) }; scanner.SetProjection(usedCols);
+		double pt; if (! scanner.ReadLine(values, 0) || ! feeder.GetTime(values, dataset.rowFilter.timeCol, pt)) break;
+		if (pt < t) lo = p; else hi = p;
+	}
+}
+
+bool TCsvDataReader::Finish(TConversionProgress& convProg)
+{
+	if (headers.Empty()) { convProg.errors.Add(TStr::Fmt("[%s] Error in CSV data: the file is empty.", fileName.CStr())); return false; }
+	NotifyInfo("TDataset::ReadDataFromCsv: %d rows, %d/%d columns.\n", dataset.nRows - 1, int(headers.Len()), dataset.cols.Len());
+	return true;
+}
+
+char *TCsvDataReader::FindLastLineEnd(char *data, size_t len) const
+{
+	TCsvScanner scanner { fieldSep, data, len };
+	char *lastEnd = data;
+	while (scanner.SkipLine() && scanner.GetPos() < data + len) lastEnd = scanner.GetPos();
+	return lastEnd;
+}
+
+//-----------------------------------------------------------------------------
+//
+// TJsonDataReader
+//
+//-----------------------------------------------------------------------------
+
+// Reads a JSON array of objects (one per row) directly into the columns of a TDataset,
+// without building TJsonVal's for the array or its elements.  The values of each row are first
+// collected into 'cells' (one per distinct source name), then converted in the order of the columns,
+// so that the first error reported for a row is the same as with TDataset::AddRowFromJson,
+// and only appended to the columns once the whole row has been converted successfully.
+// The input buffer is not modified; strings are unescaped into 'strBuf', which is reused from row to row.
+// If the data comes from a TDecompressor, 'buf' holds the part of it that hasn't been processed yet;
+// if an element of the array can't be read because it continues beyond the end of the buffer, more data
+// is appended and the element is read again.
+class TJsonDataReader
+{
+protected:
+	enum class TCellType { Missing, Num, Str, Other };
+	class TCell { public: TCellType type; double num; int strPos; }; // strPos = the offset of the (NUL-terminated) string in 'strBuf'
+	TDataset& dataset;
+	TStr fileName;
+	const char *start, *cur, *end;
+	TIntV inputCols;         // indices (into 'dataset.cols') of the columns that are read from the input data
+	TStrV keys;              // the distinct source names of the input columns
+	TIntV colToKey;          // index: the column index from 'dataset.cols'; value: index into 'keys', or -1 if the column is not an input column
+	TVec<TCell> cells;       // index: same as for 'keys'
+	TIntV prevRowKeys;       // prevRowKeys[i] = the index (into 'keys') of the i'th key in the previous row, or -1 if that key wasn't one of 'keys'
+	TChA strBuf, keyBuf;
+	TFltV fltBuf; TIntV intBuf; TTimeStampV timeBuf; TVec<TTimeFormat> timeFormats; // index: the column index from 'dataset.cols'
+	TDecompressor *source; TChA buf; bool sourceEof;
+	bool tentative; const char *errPos; // see ReadElement
+	int lineNoBase, colNoBase; // the line and column number of 'start' (0-based), for error messages
+	char Peek() const { return (cur < end) ? *cur : '\0'; }
+	void SkipWs() { while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\n' || *cur == '\r')) ++cur; }
+	bool SyntaxError(const char *what);
+	// Discards the data before 'cur' and appends the next block from 'source' to the rest.  Returns false if there is no more data.
+	bool Refill();
+	void SkipWsAndRefill() { SkipWs(); while (cur >= end && Refill()) SkipWs(); }
+	// Reads the array element at 'cur' with ReadRow (if it's an object) or SkipValue, refilling the buffer as necessary.
+	bool ReadElement(bool isObj);
+	// Reads a string (whose opening quote must be at 'cur'), unescapes it and appends it to 'dest'.
+	bool ReadStr(TChA& dest);
+	// Reads a key; if it doesn't contain any escape sequences, the result points into the input buffer, otherwise into 'keyBuf'.
+	bool ReadKey(const char *&key, int &keyLen);
+	bool ReadNum(double &x);
+	bool SkipValue(int depth);
+	int FindKey(const char *key, int keyLen, int keyNo);
+	// Reads an object into 'cells'.
+	bool ReadRow();
+	// Converts 'cells' and adds them to the dataset.  Returns false if the reading should be aborted.
+	bool AddRow(int rowIdx, TConversionProgress& convProg);
+public:
+	TStr errMsg;
+	TJsonDataReader(TDataset& dataset_, const TStr& fileName_, const char *data, size_t len);
+	TJsonDataReader(TDataset& dataset_, const TStr& fileName_, TDecompressor& source_) : TJsonDataReader(dataset_, fileName_, nullptr, 0) { source = &source_; }
+	bool Read(TConversionProgress& convProg);
+};
+
+TJsonDataReader::TJsonDataReader(TDataset& dataset_, const TStr& fileName_, const char *data, size_t len) : 
+	dataset(dataset_), fileName(fileName_), start(data), cur(data), end(data + len), source(nullptr), sourceEof(false), tentative(false), errPos(nullptr), lineNoBase(0), colNoBase(0)
+{
+	const int nCols = dataset.cols.Len(); 
+	colToKey.Gen(nCols); colToKey.PutAll(-1);
+	fltBuf.Gen(nCols); intBuf.Gen(nCols); timeBuf.Gen(nCols); timeFormats.Gen(nCols);
+	for (int colNo = 0; colNo < nCols; ++colNo)
+	{
+		const TDataColumn &col = dataset.cols[colNo];
+		if (col.source != TAttrSource::Input) continue;
+		inputCols.Add(colNo);
+		int keyNo = keys.SearchForw(col.sourceName); if (keyNo < 0) keyNo = keys.Add(col.sourceName);
+		colToKey[colNo] = keyNo;
+		if (col.type == TAttrType::Time && col.subType == TAttrSubtype::String) timeFormats[colNo].Compile(col.formatStr.CStr());
+	}
+	dataset.rowFilter.OrderCols(inputCols);
+	cells.Gen(keys.Len());
+}
+
+bool TJsonDataReader::SyntaxError(const char *what)
+{
+	errPos = cur; if (tentative) return false; // no need to format the message, see ReadElement
+	// If the data is incomplete because of an error in the compressed data, that's the error to report.
+	if (source && ! source->errMsg.Empty()) { errMsg = TStr::Fmt("[%s] %s", fileName.CStr(), source->errMsg.CStr()); return false; }
+	int lineNo = lineNoBase + 1, colNo = colNoBase; const char *lineStart = start;
+	for (const char *p = start; p < cur && p < end; ++p) if (*p == '\n') { ++lineNo; lineStart = p + 1; colNo = 0; }
+	errMsg = TStr::Fmt("[%s] JSON syntax error (line %d, col %d): %s", fileName.CStr(), lineNo, colNo + int(cur - lineStart) + 1, what);
+	return false;
+}
+
+bool TJsonDataReader::Refill()
+{
+	if (! source || sourceEof) return false;
+	for (const char *p; cur > start && (p = (const char *) memchr(start, '\n', cur - start)) != nullptr; ) { ++lineNoBase; colNoBase = 0; start = p + 1; }
+	colNoBase += int(cur - start);
+	TChA rest; if (end > cur) rest.AddBf((char *) cur, int(end - cur));
+	if (! source->Read(rest)) sourceEof = true;
+	buf = rest; start = buf.CStr(); cur = start; end = start + buf.Len();
+	return ! sourceEof;
+}
+
+bool TJsonDataReader::ReadElement(bool isObj)
+{
+	while (true)
+	{
+		// An error close to the end of the buffer may just mean that the element continues in the data
+		// that hasn't been decompressed yet.  (The parser stops with 'cur' at the end of the buffer in such
+		// cases, except for a number, which is checked once it has been read to the end.)
+		const char *elemStart = cur;
+		tentative = (source && ! sourceEof);
+		bool ok = isObj ? ReadRow() : SkipValue(0);
+		tentative = false;
+		if (! source || sourceEof) return ok;
+		// The element is complete if it's followed by something other than whitespace.
+		if (ok) { SkipWs(); if (cur < end) return true; }
+		else if (end - errPos > 1024) { cur = elemStart; return isObj ? ReadRow() : SkipValue(0); } // a genuine error; read it again to format the message
+		cur = elemStart; Refill();
+	}
+}
+
+bool TJsonDataReader::ReadStr(TChA& dest)
+{
+	if (Peek() != '"') return SyntaxError("string expected.");
+	++cur;
+	while (true)
+	{
+		const char *p = cur; while (p < end && *p != '"' && *p != '\\') ++p;
+		if (p > cur) { dest.AddBf((char *) cur, int(p - cur)); cur = p; }
+		if (cur >= end) return SyntaxError("unexpected end of data in a string.");
+		if (*cur == '"') { ++cur; return true; }
+		// An escape sequence.
+		++cur; const char c = Peek(); ++cur;
+		if (c == '"' || c == '\\' || c == '/') dest += c;
+		else if (c == 'b') dest += '\b'; else if (c == 'f') dest += '\f'; else if (c == 'n') dest += '\n'; else if (c == 'r') dest += '\r'; else if (c == 't') dest += '\t';
+		else if (c == 'u')
+		{
+			auto GetHex4 = [this] (uint& u) { 
+				if (end - cur < 4) return false; u = 0;
+				for (int i = 0; i < 4; ++i) { const char h = *cur++; u <<= 4;
+					if (h >= '0' && h <= '9') u |= h - '0'; else if (h >= 'a' && h <= 'f') u |= h - 'a' + 10; else if (h >= 'A' && h <= 'F') u |= h - 'A' + 10; else return false; }
+				return true; };
+			uint u; if (! GetHex4(u)) return SyntaxError("invalid \\u escape sequence in a string.");
+			// A surrogate pair?
+			if (u >= 0xd800 && u < 0xdc00 && end - cur >= 6 && cur[0] == '\\' && cur[1] == 'u') {
+				const char *saved = cur; cur += 2; uint u2;
+				if (GetHex4(u2) && u2 >= 0xdc00 && u2 < 0xe000) u = 0x10000 + ((u - 0xd800) << 10) + (u2 - 0xdc00); else cur = saved; }
+			// Encode it in UTF-8.
+			if (u < 0x80) dest += char(u);
+			else if (u < 0x800) { dest += char(0xc0 | (u >> 6)); dest += char(0x80 | (u & 0x3f)); }
+			else if (u < 0x10000) { dest += char(0xe0 | (u >> 12)); dest += char(0x80 | ((u >> 6) & 0x3f)); dest += char(0x80 | (u & 0x3f)); }
+			else { dest += char(0xf0 | (u >> 18)); dest += char(0x80 | ((u >> 12) & 0x3f)); dest += char(0x80 | ((u >> 6) & 0x3f)); dest += char(0x80 | (u & 0x3f)); }
+		}
+		else { --cur; return SyntaxError("invalid escape sequence in a string."); }
+	}
+}
+
+bool TJsonDataReader::ReadKey(const char *&key, int &keyLen)
+{
+	if (Peek() != '"') return SyntaxError("string expected.");
+	const char *p = cur + 1; while (p < end && *p != '"' && *p != '\\') ++p;
+	if (p < end && *p == '"') { key = cur + 1; keyLen = int(p - key); cur = p + 1; return true; }
+	keyBuf.Clr(); if (! ReadStr(keyBuf)) return false;
+	key = keyBuf.CStr(); keyLen = keyBuf.Len(); return true;
+}
+
+bool TJsonDataReader::ReadNum(double &x)
+{
+	const char *p = cur; 
+	if (p < end && *p == '-') ++p;
+	while (p < end && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-')) ++p;
+	const char *firstDigit = (cur < end && *cur == '-') ? cur + 1 : cur;
+	if (firstDigit >= p || *firstDigit < '0' || *firstDigit > '9' || ! ParseFlt(cur, p, x)) return SyntaxError("invalid number.");
+	cur = p; return true;
+}
+
+bool TJsonDataReader::SkipValue(int depth)
+{
+	if (depth > 1000) return SyntaxError("the values are nested too deeply.");
+	SkipWs(); const char c = Peek();
+	if (c == '"') { 
+		++cur; 
+		while (cur < end && *cur != '"') { if (*cur == '\\') ++cur; ++cur; }
+		if (cur >= end) return SyntaxError("unexpected end of data in a string.");
+		++cur; return true; }
+	if (c == '{' || c == '[') 
+	{
+		const char closing = (c == '{') ? '}' : ']';
+		++cur; SkipWs(); if (Peek() == closing) { ++cur; return true; }
+		while (true) {
+			if (c == '{') { 
+				const char *key; int keyLen; if (! ReadKey(key, keyLen)) return false; 
+				SkipWs(); if (Peek() != ':') return SyntaxError("':' expected."); ++cur; }
+			if (! SkipValue(depth + 1)) return false;
+			SkipWs(); const char c2 = Peek(); ++cur;
+			if (c2 == closing) return true;
+			if (c2 != ',') { --cur; return SyntaxError(c == '{' ? "',' or '}' expected." : "',' or ']' expected."); }
+			SkipWs(); }
+	}
+	if (c == '-' || (c >= '0' && c <= '9')) { double x; return ReadNum(x); }
+	if (end - cur >= 4 && (memcmp(cur, "true", 4) == 0 || memcmp(cur, "null", 4) == 0)) { cur += 4; return true; }
+	if (end - cur >= 5 && memcmp(cur, "false", 5) == 0) { cur += 5; return true; }
+	return SyntaxError("value expected.");
+}
+
+int TJsonDataReader::FindKey(const char *key, int keyLen, int keyNo)
+{
+	// Rows usually have their keys in the same order, so try the key from the same position in the previous row first.
+	if (keyNo < prevRowKeys.Len()) { 
+		const int i = prevRowKeys[keyNo]; 
+		if (i >= 0 && keys[i].Len() == keyLen && memcmp(keys[i].CStr(), key, keyLen) == 0) return i; }
+	int found = -1;
+	for (int i = 0; i < keys.Len(); ++i) if (keys[i].Len() == keyLen && memcmp(keys[i].CStr(), key, keyLen) == 0) { found = i; break; }
+	while (prevRowKeys.Len() <= keyNo) prevRowKeys.Add(-1);
+	prevRowKeys[keyNo] = found; return found;
+}
+
+bool TJsonDataReader::ReadRow()
+{
+	for (TCell& cell : cells) cell.type = TCellType::Missing;
+	strBuf.Clr();
+	Assert(Peek() == '{'); ++cur; SkipWs(); 
+	if (Peek() == '}') { ++cur; return true; }
+	for (int keyNo = 0; ; ++keyNo)
+	{
+		const char *key; int keyLen; if (! ReadKey(key, keyLen)) return false;
+		SkipWs(); if (Peek() != ':') return SyntaxError("':' expected."); 
+		++cur; SkipWs();
+		const int i = FindKey(key, keyLen, keyNo);
+		if (i < 0) { if (! SkipValue(0)) return false; }
+		else
+		{
+			TCell &cell = cells[i]; const char c = Peek();
+			if (c == '"') { cell.type = TCellType::Str; cell.strPos = strBuf.Len(); if (! ReadStr(strBuf)) return false; strBuf += '\0'; }
+			else if (c == '-' || (c >= '0' && c <= '9')) { cell.type = TCellType::Num; if (! ReadNum(cell.num)) return false; }
+			else { cell.type = TCellType::Other; if (! SkipValue(0)) return false; }
+		}
+		SkipWs(); const char c2 = Peek(); ++cur;
+		if (c2 == '}') return true;
+		if (c2 != ',') { --cur; return SyntaxError("',' or '}' expected."); }
+		SkipWs();
+	}
+}
+
+bool TJsonDataReader::AddRow(int jsonRowIdx, TConversionProgress& convProg)
+{
+#define ON_ERROR(x) { \
+		if (convProg.nErrorsReported >= convProg.maxErrorsToReport) convProg.nErrorsSuppressed++; \
+		else { convProg.nErrorsReported++; convProg.errors.Add((x)); } \
+		convProg.nRowsIgnored++; return convProg.ignoreErrors; } 
+	const TRowFilter &filter = dataset.rowFilter;
+	// Convert the values.
+	for (int colNo : inputCols)
+	{
+		const TDataColumn &col = dataset.cols[colNo]; 
+		const TCell &cell = cells[colToKey[colNo]];
+		if (cell.type == TCellType::Missing) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is missing."); 
+		const bool isNum = (cell.type == TCellType::Num), isStr = (cell.type == TCellType::Str);
+		if (col.type == TAttrType::Numeric)
+		{
+			if (! isNum) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is not a number."); 
+			double x = cell.num;
+			if (col.subType == TAttrSubtype::Flt) fltBuf[colNo] = x;
+			else if (col.subType == TAttrSubtype::Int) {
+				int y = (int) floor(x); if (x != y) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is not an integer."); 
+				intBuf[colNo] = y; }
+			else IAssert(false);
+		}
+		else if (col.type == TAttrType::Categorical)
+		{
+			if (col.subType == TAttrSubtype::String) {
+				if (! isStr) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is not a string."); }
+			else if (col.subType == TAttrSubtype::Int) {
+				if (! isNum) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is not a number."); 
+				double x = cell.num; int key = (int) floor(x); if (key != x) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is a number but not an integer."); 
+				intBuf[colNo] = key; }
+			else IAssert(false);
+		}
+		else if (col.type == TAttrType::Time)
+		{
+			TTimeStamp &ts = timeBuf[colNo];
+			if (col.subType == TAttrSubtype::String) {
+				if (! isStr) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is not a string."); 
+				const char *s = strBuf.CStr() + cell.strPos;
+				TSecTm secTm; int ns; if (! timeFormats[colNo].Parse(s, secTm, ns)) ON_ERROR(TStr::Fmt("Error parsing data[%d].\"%s\" = \"%s\" as a datetime value with the format \"%s\".", int(jsonRowIdx), col.sourceName.CStr(), s, col.formatStr.CStr())); 
+				if (col.timeType == TTimeType::Time) ts.SetTime(secTm.GetAbsSecs(), ns);
+				else if (col.timeType == TTimeType::Int) ts.SetInt(secTm.GetAbsSecs()); 
+				else if (col.timeType == TTimeType::Flt) ts.SetFlt(secTm.GetAbsSecs() + double(ns) / 1e9);
+				else IAssert(false); }
+			else if (col.subType == TAttrSubtype::Int) {
+				if (! isNum) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is not a number."); 
+				double x = cell.num; int64_t intVal = (int64_t) floor(x); if (intVal != x) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is a number but not an integer."); 
+				if (col.timeType == TTimeType::Time) ts.SetTime(intVal, 0);
+				else if (col.timeType == TTimeType::Int) ts.SetInt(intVal); 
+				else if (col.timeType == TTimeType::Flt) ts.SetFlt((double) intVal);
+				else IAssert(false); }
+			else if (col.subType == TAttrSubtype::Flt) {
+				if (! isNum) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is not a number."); 
+				double x = cell.num; double fx = floor(x);
+				int64_t intVal = (int64_t) fx; int ns = int((x - fx) * 1e9);
+				if (ns < 0) ns = 0; else if (ns >= 1000000000) { ns -= 1000000000; ++intVal; }
+				if (col.timeType == TTimeType::Time) ts.SetTime(intVal, ns);
+				else if (col.timeType == TTimeType::Int) ts.SetInt(intVal); 
+				else if (col.timeType == TTimeType::Flt) ts.SetFlt(x);
+				else IAssert(false); }
+			else IAssert(false);
+		}
+		else if (col.type == TAttrType::Text)
+		{
+			// ToDo.
+			IAssert(false);
+		}
+		else IAssert(false);
+		// Drop the row if this value doesn't pass the filter.  
+		if (filter.HasConds(colNo))
+		{
+			if (col.type == TAttrType::Categorical && col.subType == TAttrSubtype::String) { 
+				const char *s = strBuf.CStr() + cell.strPos; if (filter.Accepts(colNo, s, int(strlen(s)))) continue; }
+			else {
+				const double x = (col.type == TAttrType::Time) ? timeBuf[colNo].GetFlt() : (col.subType == TAttrSubtype::Flt) ? fltBuf[colNo].Val : double(intBuf[colNo]);
+				if (filter.Accepts(colNo, x)) continue; 
+				if (filter.IsPastEnd(colNo, x)) convProg.pastFilterEnd = true; }
+			convProg.nRowsFiltered++; return true;
+		}
+	}
+	// Append the converted values to the columns.
+	for (int colNo : inputCols)
+	{
+		TDataColumn &col = dataset.cols[colNo];
+		if (col.type == TAttrType::Numeric) {
+			if (col.subType == TAttrSubtype::Flt) col.fltVals.Add(fltBuf[colNo]); 
+			else col.intVals.Add(intBuf[colNo]); }
+		else if (col.type == TAttrType::Categorical) {
+			if (col.subType == TAttrSubtype::String) col.AddCatVal(strBuf.CStr() + cells[colToKey[colNo]].strPos); 
+			else col.AddCatVal(intBuf[colNo].Val); }
+		else if (col.type == TAttrType::Time) col.timeVals.Add(timeBuf[colNo]);
+	}
+	dataset.nRows += 1;
+	return true;
+#undef ON_ERROR
+}
+
+bool TJsonDataReader::Read(TConversionProgress& convProg)
+{
+	if (source) Refill();
+	SkipWsAndRefill(); 
+	if (Peek() != '[') { 
+		if (source && ! source->errMsg.Empty()) { SyntaxError(""); convProg.errors.Add(errMsg); return false; }
+		convProg.errors.Add("The JSON data value must be an array."); return false; }
+	++cur; SkipWsAndRefill();
+	if (Peek() == ']') ++cur;
+	else for (int rowIdx = 0; ; ++rowIdx)
+	{
+		SkipWsAndRefill();
+		if (Peek() != '{') {
+			if (! ReadElement(false)) { convProg.errors.Add(errMsg); return false; }
+			if (convProg.nErrorsReported >= convProg.maxErrorsToReport) convProg.nErrorsSuppressed++;
+			else { convProg.nErrorsReported++; convProg.errors.Add("The value of data[" + TInt::GetStr(rowIdx) + "] must be an object."); }
+			convProg.nRowsIgnored++; if (! convProg.ignoreErrors) return false; }
+		else {
+			if (! ReadElement(true)) { convProg.errors.Add(errMsg); return false; }
+			if (! AddRow(rowIdx, convProg)) return false; 
+			if (convProg.pastFilterEnd) return true; } // the rest of the data is not checked
+		SkipWsAndRefill(); const char c = Peek(); ++cur;
+		if (c == ']') break;
+		if (c != ',') { --cur; SyntaxError("',' or ']' expected."); convProg.errors.Add(errMsg); return false; }
+	}
+	SkipWsAndRefill(); if (cur < end) { SyntaxError("unexpected data after the end of the array."); convProg.errors.Add(errMsg); return false; }
+	if (source && ! source->errMsg.Empty()) { SyntaxError(""); convProg.errors.Add(errMsg); return false; }
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// TArrowDataReader
+//
+//-----------------------------------------------------------------------------
+
+// Reads the record batches of Arrow IPC data into the columns of a TDataset.  Each input column
+// is read from the top-level field whose name is the column's sourceName; dictionary-encoded fields
+// are resolved through their dictionaries.  Numbers, timestamps and dates are taken as they are,
+// strings go through the same parsers as CSV values.  Each batch is converted column by column into
+// the buffers below, which records the first error (in column order) of each row; the erroneous rows
+// are then reported in row order and the remaining ones are appended to the columns.  A float64 or
+// int32 field without nulls that matches the layout of fltVals/intVals is not converted at all, but
+// copied into the column with a single memcpy (if the batch has no erroneous rows).  For dictionary-encoded
+// categorical columns, each dictionary entry is looked up in the column's key map only once.
+class TArrowDataReader
+{
+protected:
+	enum class TRowErr { Missing, NotFlt, NotInt, BadTime, Filtered }; // Filtered = the row has been dropped by the filter
+	TDataset& dataset;
+	TStr fileName;
+	TArrowIpcReader reader;
+	TIntV inputCols;         // indices (into 'dataset.cols') of the columns that are read from the input data
+	TIntV colToField;        // index: the column index from 'dataset.cols'; value: index into 'reader.fields', or -1
+	// The following are indexed by the column index from 'dataset.cols' and reused from batch to batch.
+	TVec<TFltV> fltBufs; TVec<TIntV> intBufs; TVec<TTimeStampV> timeBufs; TVec<TTimeFormat> timeFormats;
+	TVec<TVec<const char *>> strPtrs; TVec<TIntV> strLens; // categorical strings; not null-terminated
+	TArrowArrayV dicts; TIntV dictVersions; TVec<TIntV> dictKeyIds; // dictKeyIds[colNo][i] = the keyId of the i'th dictionary entry, or -1 if not known yet
+	TIntV rowErrCol; TVec<TRowErr> rowErrs; // index: row number within the batch; rowErrCol[i] = -1 if row i has no errors
+	int pastEndRow; // the first row of the batch that is beyond the end of a sorted filter's time range, or -1
+	TChA strBuf;
+	bool Error(const TStr& msg) { errMsg = TStr::Fmt("[%s] Error in Arrow data: %s", fileName.CStr(), msg.CStr()); return false; }
+	// Returns the array and the index within it where the value of the given row is, or nullptr if the value is missing.
+	const TArrowArray *GetValue(const TArrowArray& arr, const TArrowArray *dict, int64_t rowNo, int64_t& idx, bool& ok);
+	bool ConvertCol(int colNo, const TArrowArray& arr, const TArrowArray *dict, int64_t length);
+	TStr GetErrMsg(int colNo, TRowErr err, int64_t rowIdx, const TArrowArray& arr, const TArrowArray *dict, int64_t rowNo);
+	int GetStrKeyId(TDataColumn& col, const char *p, size_t len);
+	static int GetIntKeyId(TDataColumn& col, int key);
+public:
+	TStr errMsg;
+	TArrowDataReader(TDataset& dataset_, const TStr& fileName_) : dataset(dataset_), fileName(fileName_) { }
+	bool Read(const char *data, size_t len, TConversionProgress& convProg);
+};
+
+const TArrowArray *TArrowDataReader::GetValue(const TArrowArray& arr, const TArrowArray *dict, int64_t rowNo, int64_t& idx, bool& ok)
+{
+	ok = true; idx = rowNo;
+	if (arr.IsNull(rowNo)) return nullptr;
+	if (! dict) return &arr;
+	arr.GetInt(rowNo, idx); 
+	if (idx < 0 || idx >= dict->length) { ok = false; Error(TStr::Fmt("dictionary index %lld is out of range.", (long long) idx)); return nullptr; }
+	return dict->IsNull(idx) ? nullptr : dict;
+}
+
+int TArrowDataReader::GetStrKeyId(TDataColumn& col, const char *p, size_t len)
+{
+	strBuf.Clr(); strBuf.AddBf((char *) p, int(len));
+	int keyId = col.strKeyMap.GetKeyId(strBuf.CStr());
+	if (! IsValidId(keyId)) { keyId = col.strKeyMap.AddKey(strBuf.CStr()); col.strKeyMap[keyId] = 0; }
+	return keyId;
+}
+
+int TArrowDataReader::GetIntKeyId(TDataColumn& col, int key)
+{
+	int keyId = col.intKeyMap.GetKeyId(key);
+	if (! IsValidId(keyId)) { keyId = col.intKeyMap.AddKey(key); col.intKeyMap[keyId] = 0; }
+	return keyId;
+}
+
+bool TArrowDataReader::ConvertCol(int colNo, const TArrowArray& arr, const TArrowArray *dict, int64_t length)
+{
+	const TDataColumn &col = dataset.cols[colNo]; const TRowFilter &filter = dataset.rowFilter;
+	TFltV &fltBuf = fltBufs[colNo]; TIntV &intBuf = intBufs[colNo]; TTimeStampV &timeBuf = timeBufs[colNo];
+	TVec<const char *> &strPtr = strPtrs[colNo]; TIntV &strLen = strLens[colNo];
+	auto SetErr = [this, colNo] (int64_t rowNo, TRowErr err) { rowErrCol[int(rowNo)] = colNo; rowErrs[int(rowNo)] = err; };
+	for (int64_t rowNo = 0; rowNo < length; ++rowNo)
+	{
+		if (rowErrCol[int(rowNo)] >= 0) continue; // only the first error of each row is reported
+		int64_t j; bool ok; const TArrowArray *a = GetValue(arr, dict, rowNo, j, ok);
+		if (! ok) return false;
+		if (! a) { SetErr(rowNo, TRowErr::Missing); continue; }
+		const char *p = nullptr; size_t len = 0;
+		if (a->IsStr() && ! a->GetStr(j, p, len)) return Error(TStr::Fmt("invalid string offsets in field \"%s\".", col.sourceName.CStr()));
+		if (col.type == TAttrType::Numeric && col.subType == TAttrSubtype::Flt) {
+			if (p) { if (! ParseFlt(p, p + len, fltBuf[int(rowNo)].Val)) SetErr(rowNo, TRowErr::NotFlt); }
+			else fltBuf[int(rowNo)] = a->GetFlt(j); }
+		else if (col.subType == TAttrSubtype::Int && (col.type == TAttrType::Numeric || col.type == TAttrType::Categorical)) {
+			if (p) { if (! ParseInt(p, p + len, intBuf[int(rowNo)].Val)) SetErr(rowNo, TRowErr::NotInt); }
+			else if (a->type == TArrowType::Float) { 
+				double x = a->GetFlt(j); 
+				if (x == floor(x) && x >= double(TInt::Mn) && x <= double(TInt::Mx)) intBuf[int(rowNo)] = int(x); else SetErr(rowNo, TRowErr::NotInt); }
+			else { 
+				int64_t x; 
+				if (a->GetInt(j, x) && x >= TInt::Mn && x <= TInt::Mx) intBuf[int(rowNo)] = int(x); else SetErr(rowNo, TRowErr::NotInt); } }
+		else if (col.type == TAttrType::Categorical) { strPtr[int(rowNo)] = p; strLen[int(rowNo)] = int(len); }
+		else if (col.type == TAttrType::Time)
+		{
+			TTimeStamp &ts = timeBuf[int(rowNo)]; int64_t sec; int ns = 0; double x;
+			if (p && col.subType == TAttrSubtype::String) {
+				strBuf.Clr(); strBuf.AddBf((char *) p, int(len)); TSecTm secTm; 
+				if (! timeFormats[colNo].Parse(strBuf.CStr(), secTm, ns)) { SetErr(rowNo, TRowErr::BadTime); continue; }
+				sec = secTm.GetAbsSecs(); x = double(sec) + double(ns) / 1e9; }
+			else if (p && col.subType == TAttrSubtype::Int) { 
+				if (! ParseInt64(p, p + len, sec)) { SetErr(rowNo, TRowErr::NotInt); continue; }
+				x = double(sec); }
+			else if (a->type == TArrowType::Float || (p && col.subType == TAttrSubtype::Flt)) {
+				if (p) { if (! ParseFlt(p, p + len, x)) { SetErr(rowNo, TRowErr::NotFlt); continue; } }
+				else x = a->GetFlt(j);
+				double fx = floor(x); sec = (int64_t) fx; ns = int((x - fx) * 1e9);
+				if (ns < 0) ns = 0; else if (ns >= 1000000000) { ns -= 1000000000; ++sec; } }
+			else if (a->type == TArrowType::Timestamp || a->type == TArrowType::Date) { a->GetSecNs(j, sec, ns); x = double(sec) + double(ns) / 1e9; }
+			else { if (! a->GetInt(j, sec)) { SetErr(rowNo, TRowErr::NotInt); continue; } x = double(sec); }
+			if (col.timeType == TTimeType::Time) ts.SetTime(sec, ns);
+			else if (col.timeType == TTimeType::Int) ts.SetInt(sec); 
+			else if (col.timeType == TTimeType::Flt) ts.SetFlt(x);
+			else IAssert(false);
+		}
+		else IAssert(false);
+		// Drop the row if this value doesn't pass the filter.
+		if (filter.HasConds(colNo) && rowErrCol[int(rowNo)] < 0)
+		{
+			if (col.type == TAttrType::Categorical && col.subType == TAttrSubtype::String) { if (filter.Accepts(colNo, p, int(len))) continue; }
+			else {
+				const double x = (col.type == TAttrType::Time) ? timeBuf[int(rowNo)].GetFlt() : (col.subType == TAttrSubtype::Flt) ? fltBuf[int(rowNo)].Val : double(intBuf[int(rowNo)]);
+				if (filter.Accepts(colNo, x)) continue; 
+				if (filter.IsPastEnd(colNo, x) && pastEndRow < 0) pastEndRow = int(rowNo); }
+			SetErr(rowNo, TRowErr::Filtered);
+		}
+	}
+	return true;
+}
+
+TStr TArrowDataReader::GetErrMsg(int colNo, TRowErr err, int64_t rowIdx, const TArrowArray& arr, const TArrowArray *dict, int64_t rowNo)
+{
+	const TDataColumn &col = dataset.cols[colNo];
+	const TStr where = TStr::Fmt("data[%lld].\"%s\"", (long long) rowIdx, col.sourceName.CStr());
+	if (err == TRowErr::Missing) return "The value of " + where + " is missing.";
+	if (err == TRowErr::NotFlt) return "The value of " + where + " is not a floating-point number.";
+	if (err == TRowErr::NotInt) return "The value of " + where + " is not an integer.";
+	int64_t j; bool ok; const TArrowArray *a = GetValue(arr, dict, rowNo, j, ok); const char *p = ""; size_t len = 0;
+	if (a) a->GetStr(j, p, len);
+	TChA value; value.AddBf((char *) p, int(len));
+	return TStr::Fmt("Error parsing %s = \"%s\" as a datetime value with the format \"%s\".", where.CStr(), value.CStr(), col.formatStr.CStr());
+}
+
+bool TArrowDataReader::Read(const char *data, size_t len, TConversionProgress& convProg)
 {
-#define ON_ERROR(x) { \
-		if (convProg.nErrorsReported >= convProg.maxErrorsToReport) convProg.nErrorsSuppressed++; \
-		else { convProg.nErrorsReported++; convProg.errors.Add((x)); } \
-		convProg.nRowsIgnored++; return convProg.ignoreErrors; } 
-	const int nCols = dataset.cols.Len();
-	TConvertedValueV convVals; convVals.Gen(nCols);
+	if (! reader.Open(data, len)) { Error(reader.errMsg); convProg.errors.Add(errMsg); return false; }
+	const TArrowFieldV &fields = reader.fields;
+	const int nCols = dataset.cols.Len(); bool ok = true;
+	if (reader.GetNRows() > TInt::Mx) { Error(TStr::Fmt("too many rows (%lld).", (long long) reader.GetNRows())); convProg.errors.Add(errMsg); return false; }
+	const int nAllRows = int(reader.GetNRows());
+	colToField.Gen(nCols); colToField.PutAll(-1); 
+	fltBufs.Gen(nCols); intBufs.Gen(nCols); timeBufs.Gen(nCols); timeFormats.Gen(nCols); strPtrs.Gen(nCols); strLens.Gen(nCols);
+	dicts.Gen(nCols); dictVersions.Gen(nCols); dictVersions.PutAll(-1); dictKeyIds.Gen(nCols);
 	for (int colNo = 0; colNo < nCols; ++colNo)
 	{
 		TDataColumn &col = dataset.cols[colNo];
 		if (col.source != TAttrSource::Input) continue;
-		int csvColNo = dataColToCsvCol[colNo];
-		if (csvColNo < 0 || csvColNo >= values.Len()) ON_ERROR(TStr::Fmt("[%s] Error in CSV data (row %d): this row has %d values, attribute \"%s\" should be in column %d based on headers.", fileName.CStr(), rowNo, int(values.Len()), col.name.CStr(), csvColNo + 1));
-		const TStr& value = values[csvColNo];
-		TConvertedValue &cv = convVals[colNo];
-		//
-		if (col.type == TAttrType::Numeric && (col.subType == TAttrSubtype::Flt || col.subType == TAttrSubtype::Int))
+		inputCols.Add(colNo);
+		int found = -1;
+		for (int fieldNo = 0; fieldNo < fields.Len(); ++fieldNo)
+			if (fields[fieldNo].name == col.sourceName) {
+				if (found < 0) found = fieldNo;
+				else { convProg.errors.Add(TStr::Fmt("[%s] More than one field matches the attribute \"%s\": %d and %d.", fileName.CStr(), col.sourceName.CStr(), found, fieldNo)); ok = false; } }
+		if (found < 0) { convProg.errors.Add(TStr::Fmt("[%s] No field matches the attribute \"%s\".", fileName.CStr(), col.sourceName.CStr())); ok = false; continue; }
+		colToField[colNo] = found;
+		// Check if the field's type can be converted into the column's type.
+		const TArrowField &field = fields[found]; const TArrowType t = field.type;
+		const bool isStr = (t == TArrowType::Utf8 || t == TArrowType::LargeUtf8 || t == TArrowType::Binary || t == TArrowType::LargeBinary);
+		const bool isNum = (t == TArrowType::Bool || t == TArrowType::Int || (t == TArrowType::Float && field.bitWidth >= 32));
+		bool canConvert = false;
+		if (col.type == TAttrType::Numeric) canConvert = isNum || isStr;
+		else if (col.type == TAttrType::Categorical) canConvert = isStr || (col.subType == TAttrSubtype::Int && isNum);
+		else if (col.type == TAttrType::Time) canConvert = isStr || isNum || t == TArrowType::Timestamp || t == TArrowType::Date;
+		if (! canConvert) { convProg.errors.Add(TStr::Fmt("[%s] The attribute \"%s\" cannot be read from the Arrow field \"%s\" of type %s.", fileName.CStr(), col.name.CStr(), field.name.CStr(), field.GetTypeStr().CStr())); ok = false; continue; }
+		if (col.type == TAttrType::Time && col.subType == TAttrSubtype::String) timeFormats[colNo].Compile(col.formatStr.CStr());
+		col.ClrVals(); col.timeVals.Clr();
+		if (col.type == TAttrType::Numeric && col.subType == TAttrSubtype::Flt) col.fltVals.Gen(nAllRows);
+		else if (col.type == TAttrType::Time) col.timeVals.Gen(nAllRows);
+		else col.intVals.Gen(nAllRows);
+	}
+	if (! ok) return false;
+	dataset.rowFilter.OrderCols(inputCols);
+	// Process the record batches.
+	TArrowArrayV arrays; int64_t length; int nRowsBefore = 0, outRow = 0; 
+	while (reader.NextBatch(arrays, length))
+	{
+		const int n = int(length);
+		rowErrCol.Gen(n); rowErrCol.PutAll(-1); rowErrs.Gen(n); pastEndRow = -1;
+		// Convert the values, except those that will be copied directly.
+		TBoolV isDirect; isDirect.Gen(nCols);
+		for (int colNo : inputCols)
 		{
-			if (col.subType == TAttrSubtype::Flt) { if (1 != sscanf(value.CStr(), "%lf", &cv.fltVal)) ON_ERROR("The value of data[" + TInt::GetStr(rowNo - 1) + "].\"" + col.sourceName + "\" is not a floating-point number."); }
-			else if (col.subType == TAttrSubtype::Int) { if (1 != sscanf(value.CStr(), "%d", &cv.intVal)) ON_ERROR("The value of data[" + TInt::GetStr(rowNo - 1) + "].\"" + col.sourceName + "\" is not an integer."); }
-			else IAssert(false);
+			const TDataColumn &col = dataset.cols[colNo]; const TArrowField &field = fields[colToField[colNo]]; const TArrowArray &arr = arrays[colToField[colNo]];
+			const TArrowArray *dict = nullptr;
+			if (field.IsDictEncoded()) {
+				int version; if (! reader.GetDict(field.dictId, dicts[colNo], version)) { Error(reader.errMsg); convProg.errors.Add(errMsg); return false; }
+				if (version != dictVersions[colNo]) { dictVersions[colNo] = version; dictKeyIds[colNo].Gen(int(dicts[colNo].length)); dictKeyIds[colNo].PutAll(-1); }
+				dict = &dicts[colNo]; }
+			else if (arr.nullCount == 0 && col.type == TAttrType::Numeric && ! dataset.rowFilter.HasConds(colNo)) 
+				isDirect[colNo] = (col.subType == TAttrSubtype::Flt) ? (arr.type == TArrowType::Float && arr.bitWidth == 64) : (arr.type == TArrowType::Int && arr.bitWidth == 32 && arr.isSigned);
+			if (isDirect[colNo]) continue;
+			fltBufs[colNo].Gen(n); intBufs[colNo].Gen(n); timeBufs[colNo].Gen(n); strPtrs[colNo].Gen(n); strLens[colNo].Gen(n);
+			if (! ConvertCol(colNo, arr, dict, length)) { convProg.errors.Add(errMsg); return false; }
+			// The rows from the end of a sorted filter's time range on are dropped, as if the reading had stopped there.
+			if (pastEndRow >= 0) for (int rowNo = pastEndRow; rowNo < n; ++rowNo) { rowErrCol[rowNo] = colNo; rowErrs[rowNo] = TRowErr::Filtered; }
 		}
-		else if (col.type == TAttrType::Categorical)
+		// Report the errors.
+		int nBadRows = 0;
+		for (int rowNo = 0; rowNo < n; ++rowNo) if (rowErrCol[rowNo] >= 0)
 		{
-			if (col.subType == TAttrSubtype::String) cv.strVal = value; 
-			else if (col.subType == TAttrSubtype::Int) { if (1 != sscanf(value.CStr(), "%d", &cv.intVal)) ON_ERROR("The value of data[" + TInt::GetStr(rowNo - 1) + "].\"" + col.sourceName + "\" is not an integer."); }
-			else IAssert(false);
+			const int colNo = rowErrCol[rowNo]; ++nBadRows;
+			if (rowErrs[rowNo] == TRowErr::Filtered) { convProg.nRowsFiltered++; continue; }
+			if (convProg.nErrorsReported >= convProg.maxErrorsToReport) convProg.nErrorsSuppressed++;
+			else { convProg.nErrorsReported++; convProg.errors.Add(GetErrMsg(colNo, rowErrs[rowNo], nRowsBefore + rowNo, arrays[colToField[colNo]], fields[colToField[colNo]].IsDictEncoded() ? &dicts[colNo] : nullptr, rowNo)); }
+			convProg.nRowsIgnored++; if (! convProg.ignoreErrors) return false;
 		}
-		else if (col.type == TAttrType::Time)
+		// Append the rows without errors to the columns.
+		for (int colNo : inputCols)
 		{
-			TTimeStamp &ts = cv.tsVal; 
-			if (col.subType == TAttrSubtype::String) {
-				TSecTm secTm; int ns; if (! StrPTime_HomeGrown(value.CStr(), col.formatStr.CStr(), secTm, ns)) ON_ERROR(TStr::Fmt("Error parsing data[%d].\"%s\" = \"%s\" as a datetime value with the format \"%s\".", rowNo - 1, col.sourceName.CStr(), value.CStr(), col.formatStr.CStr())); 
-				if (col.timeType == TTimeType::Time) ts.SetTime(secTm.GetAbsSecs(), ns);
-				else if (col.timeType == TTimeType::Int) ts.SetInt(secTm.GetAbsSecs()); 
-				else if (col.timeType == TTimeType::Flt) ts.SetFlt(secTm.GetAbsSecs() + double(ns) / 1e9);
-				else IAssert(false); }
-			else if (col.subType == TAttrSubtype::Int) {
-				intmax_t intVal; if (1 != sscanf(value.CStr(), "%jd", &intVal)) ON_ERROR("The value of data[" + TInt::GetStr(rowNo - 1) + "].\"" + col.sourceName + "\" is not an integer."); 
-				if (col.timeType == TTimeType::Time) ts.SetTime(intVal, 0);
-				else if (col.timeType == TTimeType::Int) ts.SetInt(intVal); 
-				else if (col.timeType == TTimeType::Flt) ts.SetFlt((double) intVal);
-				else IAssert(false); }
-			else if (col.subType == TAttrSubtype::Flt) {
-				double x; if (1 != sscanf(value.CStr(), "%lf", &x)) ON_ERROR("The value of data[" + TInt::GetStr(rowNo - 1) + "].\"" + col.sourceName + "\" is not a floating-point number."); 
-				double fx = floor(x);
-				int64_t intVal = (int64_t) fx; int ns = int((x - fx) * 1e9);
-				if (ns < 0) ns = 0; else if (ns >= 1000000000) { ns -= 1000000000; ++intVal; }
-				if (col.timeType == TTimeType::Time) ts.SetTime(intVal, ns);
-				else if (col.timeType == TTimeType::Int) ts.SetInt(intVal); 
-				else if (col.timeType == TTimeType::Flt) ts.SetFlt(x);
-				else IAssert(false); }
+			TDataColumn &col = dataset.cols[colNo]; const TArrowArray &arr = arrays[colToField[colNo]];
+			int k = outRow;
+			if (col.type == TAttrType::Numeric && col.subType == TAttrSubtype::Flt) {
+				if (isDirect[colNo] && nBadRows == 0) { if (n > 0) memcpy(&col.fltVals[k], arr.values, sizeof(double) * size_t(n)); }
+				else for (int rowNo = 0; rowNo < n; ++rowNo) if (rowErrCol[rowNo] < 0) col.fltVals[k++] = isDirect[colNo] ? arr.GetFlt(rowNo) : fltBufs[colNo][rowNo].Val; }
+			else if (col.type == TAttrType::Numeric) {
+				if (isDirect[colNo] && nBadRows == 0) { if (n > 0) memcpy(&col.intVals[k], arr.values, sizeof(int32_t) * size_t(n)); }
+				else for (int rowNo = 0; rowNo < n; ++rowNo) if (rowErrCol[rowNo] < 0) { int64_t x; if (isDirect[colNo]) arr.GetInt(rowNo, x); else x = intBufs[colNo][rowNo]; col.intVals[k++] = int(x); } }
+			else if (col.type == TAttrType::Time) {
+				for (int rowNo = 0; rowNo < n; ++rowNo) if (rowErrCol[rowNo] < 0) col.timeVals[k++] = timeBufs[colNo][rowNo]; }
+			else if (col.type == TAttrType::Categorical)
+			{
+				const bool isDict = fields[colToField[colNo]].IsDictEncoded(); TIntV &dictKeyId = dictKeyIds[colNo];
+				for (int rowNo = 0; rowNo < n; ++rowNo) if (rowErrCol[rowNo] < 0)
+				{
+					int keyId = -1, dictIdx = -1;
+					if (isDict) { int64_t idx; arr.GetInt(rowNo, idx); dictIdx = int(idx); keyId = dictKeyId[dictIdx]; }
+					if (keyId < 0) {
+						keyId = (col.subType == TAttrSubtype::String) ? GetStrKeyId(col, strPtrs[colNo][rowNo], size_t(strLens[colNo][rowNo])) : GetIntKeyId(col, intBufs[colNo][rowNo]);
+						if (isDict) dictKeyId[dictIdx] = keyId; }
+					if (col.subType == TAttrSubtype::String) ++col.strKeyMap[keyId].Val; else ++col.intKeyMap[keyId].Val;
+					col.intVals[k++] = keyId;
+				}
+			}
 			else IAssert(false);
 		}
-		else if (col.type == TAttrType::Text)
-		{
-			// ToDo.
-			IAssert(false);
-		}
-		else IAssert(false);
+		outRow += n - nBadRows; nRowsBefore += n;
+		if (pastEndRow >= 0) { convProg.pastFilterEnd = true; break; }
 	}
-	dataset.AddRow(convVals);
+	if (! reader.errMsg.Empty()) { Error(reader.errMsg); convProg.errors.Add(errMsg); return false; }
+	// Drop the space that was reserved for the rows that have been skipped.
+	if (outRow < nAllRows) for (int colNo : inputCols) {
+		TDataColumn &col = dataset.cols[colNo];
+		col.fltVals.Trunc(TInt::GetMn(col.fltVals.Len(), outRow)); col.intVals.Trunc(TInt::GetMn(col.intVals.Len(), outRow)); col.timeVals.Trunc(TInt::GetMn(col.timeVals.Len(), outRow)); }
+	dataset.nRows = outRow;
 	return true;
-#undef ON_ERROR
 }
 
 //-----------------------------------------------------------------------------
@@ -995,18 +3150,8 @@ void TDataset::AddRow(const TConvertedValueV& values)
 			else IAssert(false); }
 		else if (col.type == TAttrType::Categorical)
 		{
-			if (col.subType == TAttrSubtype::String) {
-				const TStr& key = cv.strVal;
-				int keyId = col.strKeyMap.GetKeyId(key);
-				if (! IsValidId(keyId)) { keyId = col.strKeyMap.AddKey(key); col.strKeyMap[keyId] = 1; }
-				else ++col.strKeyMap[keyId].Val;
-				col.intVals.Add(keyId); }
-			else if (col.subType == TAttrSubtype::Int) {
-				int key = cv.intVal;
-				int keyId = col.intKeyMap.GetKeyId(key);
-				if (! IsValidId(keyId)) { keyId = col.intKeyMap.AddKey(key); col.intKeyMap[keyId] = 1; }
-				else ++col.intKeyMap[key].Val;
-				col.intVals.Add(keyId); }
+			if (col.subType == TAttrSubtype::String) col.AddCatVal(cv.strVal.CStr());
+			else if (col.subType == TAttrSubtype::Int) col.AddCatVal(cv.intVal);
 			else IAssert(false);
 		}
 		else if (col.type == TAttrType::Time)
@@ -1081,7 +3226,7 @@ void TDataset::InitColsFromConfig(const PModelConfig& config_)
 	}
 }
 
-bool TDataset::AddRowFromJson(const PJsonVal &jsonRow, int jsonRowIdx, TConversionProgress& convProg)
+bool TDataset::AddRowFromJson(const PJsonVal &jsonRow, int jsonRowIdx, const TIntV& colOrder, TVec<TTimeFormat>& timeFormats, TConversionProgress& convProg)
 {
 #define ON_ERROR(x) { \
 		if (convProg.nErrorsReported >= convProg.maxErrorsToReport) convProg.nErrorsSuppressed++; \
@@ -1091,9 +3236,10 @@ bool TDataset::AddRowFromJson(const PJsonVal &jsonRow, int jsonRowIdx, TConversi
 	if (! jsonRow->IsObj()) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "] must be an object."); 
 	const int nCols = cols.Len();
 	TConvertedValueV convVals; convVals.Gen(nCols);
-	for (int colIdx = 0; colIdx < nCols; ++colIdx)
+	for (int colIdx : colOrder)
 	{
 		TDataColumn &col = cols[colIdx]; TConvertedValue &cv = convVals[colIdx];
+		if (col.source != TAttrSource::Input) continue;
 		if (! jsonRow->IsObjKey(col.sourceName)) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is missing."); 
 		PJsonVal val = jsonRow->GetObjKey(col.sourceName); if (val.Empty()) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is empty."); 
 		if (col.type == TAttrType::Numeric)
@@ -1125,7 +3271,7 @@ bool TDataset::AddRowFromJson(const PJsonVal &jsonRow, int jsonRowIdx, TConversi
 			if (col.subType == TAttrSubtype::String) {
 				if (! val->IsStr()) ON_ERROR("The value of data[" + TInt::GetStr(jsonRowIdx) + "].\"" + col.sourceName + "\" is not a string."); 
 				TStr s = val->GetStr();
-				TSecTm secTm; int ns; if (! StrPTime_HomeGrown(s.CStr(), col.formatStr.CStr(), secTm, ns)) ON_ERROR(TStr::Fmt("Error parsing data[%d].\"%s\" = \"%s\" as a datetime value with the format \"%s\".", int(jsonRowIdx), col.sourceName.CStr(), s.CStr(), col.formatStr.CStr())); 
+				TSecTm secTm; int ns; if (! timeFormats[colIdx].Parse(s.CStr(), secTm, ns)) ON_ERROR(TStr::Fmt("Error parsing data[%d].\"%s\" = \"%s\" as a datetime value with the format \"%s\".", int(jsonRowIdx), col.sourceName.CStr(), s.CStr(), col.formatStr.CStr())); 
 				if (col.timeType == TTimeType::Time) ts.SetTime(secTm.GetAbsSecs(), ns);
 				else if (col.timeType == TTimeType::Int) ts.SetInt(secTm.GetAbsSecs()); 
 				else if (col.timeType == TTimeType::Flt) ts.SetFlt(secTm.GetAbsSecs() + double(ns) / 1e9);
@@ -1154,6 +3300,16 @@ bool TDataset::AddRowFromJson(const PJsonVal &jsonRow, int jsonRowIdx, TConversi
 			IAssert(false);
 		}
 		else IAssert(false);
+		// Drop the row if this value doesn't pass the filter.
+		if (rowFilter.HasConds(colIdx))
+		{
+			if (col.type == TAttrType::Categorical && col.subType == TAttrSubtype::String) { if (rowFilter.Accepts(colIdx, cv.strVal.CStr(), cv.strVal.Len())) continue; }
+			else {
+				const double x = (col.type == TAttrType::Time) ? cv.tsVal.GetFlt() : (col.subType == TAttrSubtype::Flt) ? cv.fltVal : double(cv.intVal);
+				if (rowFilter.Accepts(colIdx, x)) continue; 
+				if (rowFilter.IsPastEnd(colIdx, x)) convProg.pastFilterEnd = true; }
+			convProg.nRowsFiltered++; return true;
+		}
 	}
 	AddRow(convVals); return true;
 #undef ON_ERROR
@@ -1163,75 +3319,134 @@ bool TDataset::ReadDataFromJsonArray(const PJsonVal &jsonData, TConversionProgre
 {
 	if (jsonData.Empty()) { convProg.errors.Add("Empty JSON data value."); return false; }
 	if (! jsonData->IsArr()) { convProg.errors.Add("The JSON data value must be an array."); return false; }
-	const int nCols = cols.Len(); nRows = jsonData->GetArrVals();
-	NotifyInfo("TDataset::ReadDataFromJsonArray: %d rows (if no errors), %d columns.\n", nRows, nCols);
+	const int nCols = cols.Len(), nJsonRows = jsonData->GetArrVals(); nRows = 0; // AddRow will count the rows
+	NotifyInfo("TDataset::ReadDataFromJsonArray: %d rows (if no errors), %d columns.\n", nJsonRows, nCols);
 	for (int colIdx = 0; colIdx < nCols; ++colIdx) cols[colIdx].ClrVals(); // (nRows);
-	for (int rowIdx = 0; rowIdx < nRows; ++rowIdx)
+	TIntV colOrder; for (int colIdx = 0; colIdx < nCols; ++colIdx) colOrder.Add(colIdx); 
+	rowFilter.OrderCols(colOrder);
+	TVec<TTimeFormat> timeFormats(nCols); 
+	for (int colIdx = 0; colIdx < nCols; ++colIdx) { 
+		const TDataColumn &col = cols[colIdx];
+		if (col.type == TAttrType::Time && col.subType == TAttrSubtype::String) timeFormats[colIdx].Compile(col.formatStr.CStr()); }
+	for (int rowIdx = 0; rowIdx < nJsonRows && ! convProg.pastFilterEnd; ++rowIdx)
 	{
 		PJsonVal jsonRow = jsonData->GetArrVal(rowIdx);
-		if (! AddRowFromJson(jsonRow, rowIdx, convProg)) return false;
+		if (! AddRowFromJson(jsonRow, rowIdx, colOrder, timeFormats, convProg)) return false;
 	}
 	return true;
 }
 
-bool TDataset::ReadDataFromCsv(TSIn& SIn, const TStr& fieldSep, const TStr& fileName, TConversionProgress &convProg)
+bool TDataset::ReadDataFromJson(const char *data, size_t len, const TStr& fileName, TConversionProgress &convProg)
+{
+	const int nCols = cols.Len(); nRows = 0;
+	for (int colIdx = 0; colIdx < nCols; ++colIdx) cols[colIdx].ClrVals();
+	TJsonDataReader reader { *this, fileName, data, len };
+	if (! reader.Read(convProg)) return false;
+	NotifyInfo("TDataset::ReadDataFromJson: %d rows, %d columns.\n", nRows, nCols);
+	return true;
+}
+
+bool TDataset::ReadDataFromJson(TDecompressor& source, const TStr& fileName, TConversionProgress &convProg)
+{
+	const int nCols = cols.Len(); nRows = 0;
+	for (int colIdx = 0; colIdx < nCols; ++colIdx) cols[colIdx].ClrVals();
+	TJsonDataReader reader { *this, fileName, source };
+	if (! reader.Read(convProg)) return false;
+	NotifyInfo("TDataset::ReadDataFromJson: %d rows, %d columns.\n", nRows, nCols);
+	return true;
+}
+
+bool TDataset::ReadDataFromArrow(const char *data, size_t len, const TStr& fileName, TConversionProgress &convProg)
+{
+	const int nCols = cols.Len(); nRows = 0;
+	for (int colIdx = 0; colIdx < nCols; ++colIdx) cols[colIdx].ClrVals();
+	TArrowDataReader reader { *this, fileName };
+	if (! reader.Read(data, len, convProg)) return false;
+	NotifyInfo("TDataset::ReadDataFromArrow: %d rows, %d columns.\n", nRows, nCols);
+	return true;
+}
+
+bool TDataset::ReadDataFromCsv(char *data, size_t len, const TStr& fieldSep, const TStr& fileName, TConversionProgress &convProg)
 {
 	// Clear the data.
 	const int nCols = cols.Len(); 
 	for (int colIdx = 0; colIdx < nCols; ++colIdx) cols[colIdx].ClrVals();
-	// Read the headers;
-	if (SIn.Eof()) { convProg.errors.Add(TStr::Fmt("[%s] Error in CSV data: the file is empty.", fileName.CStr())); return false; }
-	int rowNo = 0; TStrV headers, values;
-	TCsvReader reader { fieldSep };
-	while (true) {
-		++rowNo; if (! reader.ReadLine(SIn, headers, rowNo)) { convProg.errors.Add(TStr::Fmt("[%s] %s", fileName.CStr(), reader.errMsg.CStr())); return false; }
-		if (! headers.Empty()) break; }
-	TDatasetCsvFeeder feeder { *this, fileName };
-	if (! feeder.SetHeaders(headers, rowNo, convProg.errors)) return false;
-	// Process the rest of the data.
-	while (! SIn.Eof())
-	{
-		++rowNo; if (! reader.ReadLine(SIn, values, rowNo)) { convProg.errors.Add(TStr::Fmt("[%s] %s", fileName.CStr(), reader.errMsg.CStr())); return false; }
-		if (values.Empty()) continue; // skip empty lines
-		if (! feeder.AddRow(values, rowNo, convProg)) return false;
+	TCsvDataReader reader { *this, fieldSep, fileName };
+	if (! reader.ReadPart(data, len, convProg)) return false;
+	return reader.Finish(convProg);
+}
+
+bool TDataset::ReadDataFromCsv(TDecompressor& source, const TStr& fieldSep, const TStr& fileName, TConversionProgress &convProg)
+{
+	const int nCols = cols.Len(); 
+	for (int colIdx = 0; colIdx < nCols; ++colIdx) cols[colIdx].ClrVals();
+	TCsvDataReader reader { *this, fieldSep, fileName };
+	// The data is read in parts that are large enough to be split into chunks for all the threads;
+	// meanwhile, the decompressor is already working on the next part.
+	const size_t minPartLen = size_t(GetNumThreads(config->numThreads)) * MinCsvChunkSize * 4;
+	TChA buf, rest; bool eof = false; size_t minLen = minPartLen;
+	while (! eof)
+	{
+		while (! eof && size_t(buf.Len()) < minLen) if (! source.Read(buf)) eof = true;
+		if (! source.errMsg.Empty()) { convProg.errors.Add(TStr::Fmt("[%s] %s", fileName.CStr(), source.errMsg.CStr())); return false; }
+		// Read the complete lines and keep the rest for the next part.
+		char *data = buf.CStr(), *dataEnd = data + buf.Len();
+		char *partEnd = eof ? dataEnd : reader.FindLastLineEnd(data, buf.Len());
+		const char saved = *partEnd; // the scanner may overwrite the byte after the end of the part
+		if (! reader.ReadPart(data, partEnd - data, convProg)) return false;
+		*partEnd = saved;
+		if (convProg.pastFilterEnd) break;
+		// If the buffer didn't contain a complete line, more data is needed.
+		minLen = (partEnd == data) ? size_t(buf.Len()) + 1 : minPartLen;
+		rest.Clr(); if (dataEnd > partEnd) rest.AddBf(partEnd, int(dataEnd - partEnd)); 
+		buf = rest;
 	}
-	NotifyInfo("TDataset::ReadDataFromCsv: %d rows, %d/%d columns.\n", nRows - 1, int(headers.Len()), nCols);
-	return true;
+	return reader.Finish(convProg);
 }
 
 bool TDataset::ReadDataFromJsonDataSourceSpec(const PJsonVal &jsonSpec, TStrV& errors)
 {
 	TStr type; if (! Json_GetObjStr(jsonSpec, "type", false, "", type, "dataSource", errors)) return false; 
 	TConversionProgress convProg { errors, config->ignoreConversionErrors };
+	PJsonVal vFilter; if (! Json_GetObjKey(jsonSpec, "filter", true, true, vFilter, "dataSource", errors)) return false; 
+	rowFilter.Clr(); if (! vFilter.Empty() && ! vFilter->IsNull() && ! rowFilter.InitFromJson(*this, vFilter, errors)) return false;
 	if (type == "file")
 	{
 		TStr format; if (! Json_GetObjStr(jsonSpec, "format", true, "", format, "dataSource", errors)) return false; 
 		TStr fileName; if (! Json_GetObjStr(jsonSpec, "fileName", true, "", fileName, "dataSource", errors)) return false; 
 		if (format.Empty())
 		{
-			if (fileName.ToLc().EndsWith(".json")) format = "json";
-			else if (fileName.ToLc().EndsWith(".csv")) format = "csv";
+			// For compressed files, the format is inferred from the name without the compression extension (e.g. "data.csv.gz").
+			const TStr baseName = StripCompressionExt(fileName).ToLc();
+			if (baseName.EndsWith(".json")) format = "json";
+			else if (baseName.EndsWith(".csv")) format = "csv";
+			else if (baseName.EndsWith(".arrow") || baseName.EndsWith(".arrows") || baseName.EndsWith(".feather")) format = "arrow";
 			else { errors.Add("dataSource[format] is missing and cannot be inferred from the file name."); return false; }
 		}
-		if (format == "json")
-		{
-			// QW ToDo: eventually we want some security precautions here so that the caller can't get us to open an arbitrary file.
-			NotifyInfo("TDataset::ReadDataFromJsonDataSourceSpec: reading \"%s\".\n", fileName.CStr());
-			PSIn SIn = TFIn::New(fileName);
-			if (SIn.Empty()) { errors.Add("Error opening \"" + fileName + "\"."); return false; }
-			bool ok = false; TStr msgStr;
-			PJsonVal jsonData = TJsonVal::GetValFromSIn(SIn, ok, msgStr);
-			if (! ok) { errors.Add(msgStr); return false; }
-			if (! this->ReadDataFromJsonArray(jsonData, convProg)) return false;
-		}
-		else if (format == "csv")
+		TStr fieldSep; if (format == "csv" && ! Json_GetObjStr(jsonSpec, "fieldSep", true, ",", fieldSep, "dataSource", errors)) return true;
+		if (format != "json" && format != "csv" && format != "arrow") { errors.Add("Unsupported value of dataSource[format]: \"" + format + "\"."); return false; }
+		// QW ToDo: eventually we want some security precautions here so that the caller can't get us to open an arbitrary file.
+		NotifyInfo("TDataset::ReadDataFromJsonDataSourceSpec: reading \"%s\".\n", fileName.CStr());
+		TMappedFile file; 
+		if (! file.Open(fileName)) { errors.Add("Error opening \"" + fileName + "\"."); return false; }
+		const TCompression compression = GetCompression(fileName, file.GetData(), file.Len());
+		if (compression != TCompression::None)
 		{
-			TStr fieldSep; if (! Json_GetObjStr(jsonSpec, "fieldSep", true, ",", fieldSep, "dataSource", errors)) return true;
-			PSIn SIn = TFIn::New(fileName);
-			if (SIn.Empty()) { errors.Add("Error opening \"" + fileName + "\"."); return false; }
-			if (! this->ReadDataFromCsv(*SIn, fieldSep, fileName, convProg)) return false;
+			// Compressed data is decompressed on a separate thread while it is being parsed.
+			TDecompressor source { compression, file.GetData(), file.Len() };
+			if (format == "json") { if (! this->ReadDataFromJson(source, fileName, convProg)) return false; }
+			else if (format == "csv") { if (! this->ReadDataFromCsv(source, fieldSep, fileName, convProg)) return false; }
+			else
+			{
+				// The Arrow reader needs all the data at once.
+				TChA buf; while (source.Read(buf)) { }
+				if (! source.errMsg.Empty()) { errors.Add(TStr::Fmt("[%s] %s", fileName.CStr(), source.errMsg.CStr())); return false; }
+				if (! this->ReadDataFromArrow(buf.CStr(), buf.Len(), fileName, convProg)) return false;
+			}
 		}
-		else { errors.Add("Unsupported value of dataSource[format]: \"" + format + "\"."); return false; }
+		else if (format == "json") { if (! this->ReadDataFromJson(file.GetData(), file.Len(), fileName, convProg)) return false; }
+		else if (format == "csv") { if (! this->ReadDataFromCsv(file.GetData(), file.Len(), fieldSep, fileName, convProg)) return false; }
+		else { if (! this->ReadDataFromArrow(file.GetData(), file.Len(), fileName, convProg)) return false; }
 	}
 	else if (type == "internal")
 	{
@@ -1240,13 +3455,21 @@ bool TDataset::ReadDataFromJsonDataSourceSpec(const PJsonVal &jsonSpec, TStrV& e
 		const TStr fileName = "<internal>";
 		if (format == "json") {
 			if (! this->ReadDataFromJsonArray(vData, convProg)) return false; }
+		else if (format == "arrow")
+		{
+			// The Arrow data (in the IPC file or stream format) must be base64-encoded.
+			if (vData.Empty() || ! vData->IsStr()) { errors.Add("The value of \"dataSource\".\"data\" must be a base64-encoded string for the arrow format."); return false; }
+			const TStr& s = vData->GetStr(); TChA buf;
+			if (! DecodeBase64(s.CStr(), s.CStr() + s.Len(), buf)) { errors.Add("The value of \"dataSource\".\"data\" is not a valid base64-encoded string."); return false; }
+			if (! this->ReadDataFromArrow(buf.CStr(), buf.Len(), fileName, convProg)) return false;
+		}
 		else if (format == "csv")
 		{
 			TStr fieldSep; if (! Json_GetObjStr(jsonSpec, "fieldSep", true, ",", fieldSep, "dataSource", errors)) return true;
 			if (vData->IsStr()) 
 			{ 
-				PSIn SIn = TStrIn::New(vData->GetStr(), false);
-				if (! this->ReadDataFromCsv(*SIn, fieldSep, fileName, convProg)) return false;
+				TChA buf = vData->GetStr(); // a writable copy for TCsvScanner
+				if (! this->ReadDataFromCsv(buf.CStr(), buf.Len(), fieldSep, fileName, convProg)) return false;
 			}
 			else if (vData->IsArr())
 			{
@@ -1255,17 +3478,21 @@ bool TDataset::ReadDataFromJsonDataSourceSpec(const PJsonVal &jsonSpec, TStrV& e
 				const int nCols = cols.Len(); nRows = 0;
 				for (int colIdx = 0; colIdx < nCols; ++colIdx) cols[colIdx].ClrVals();
 				//
-				TCsvReader reader { fieldSep }; int rowNo = 1, nDataRows = 0;
+				int rowNo = 1, nDataRows = 0;
 				TDatasetCsvFeeder feeder { *this, fileName };
-				TStrV v; int nHeaders = -1;
-				for (int iElt = 0; iElt < nElts; ++iElt)
+				TCsvFieldV v; TChA buf; int nHeaders = -1; TBoolV usedCols;
+				for (int iElt = 0; iElt < nElts && ! convProg.pastFilterEnd; ++iElt)
 				{
 					PJsonVal vElt = vData->GetArrVal(iElt); if (vElt.Empty() || ! vElt->IsStr()) { errors.Add(TStr::Fmt("Error: unexpected non-string value in \"dataSource\".\"data\"[%d].", iElt)); return false; }
-					PSIn SIn = TStrIn::New(vElt->GetStr(), false);
-					while (! SIn->Eof())
+					buf = vElt->GetStr(); // a writable copy for TCsvScanner
+					TCsvScanner scanner { fieldSep, buf.CStr(), size_t(buf.Len()) }; scanner.SetProjection(usedCols);
+					while (! scanner.Eof() && ! convProg.pastFilterEnd)
 					{
-						if (! reader.ReadLine(*SIn, v, rowNo)) { errors.Add(TStr::Fmt("[%s] %s", fileName.CStr(), reader.errMsg.CStr())); return false; }
-						if (rowNo == 1) { nHeaders = v.Len(); if (! feeder.SetHeaders(v, rowNo, errors)) return false; }
+						if (! scanner.ReadLine(v, rowNo)) { errors.Add(TStr::Fmt("[%s] %s", fileName.CStr(), scanner.errMsg.CStr())); return false; }
+						if (rowNo == 1) { 
+							TStrV headers; for (const TCsvField& value : v) headers.Add(value.CStr());
+							nHeaders = headers.Len(); if (! feeder.SetHeaders(headers, rowNo, errors)) return false; 
+							feeder.GetUsedCsvCols(usedCols); scanner.SetProjection(usedCols); }
 						else { ++nDataRows; if (! feeder.AddRow(v, rowNo, convProg)) return false; }
 						++rowNo;
 					}
@@ -1284,25 +3511,323 @@ bool TDataset::ReadDataFromJsonDataSourceSpec(const PJsonVal &jsonSpec, TStrV& e
 	}
 	if (convProg.nErrorsSuppressed > 0) errors.Add(TStr::Fmt("%d more conversion errors were encountered but not reported here.", convProg.nErrorsSuppressed));
 	if (convProg.nRowsIgnored > 0) errors.Add(TStr::Fmt("A total of %d input rows were ignored due to conversion errors or missing values.", convProg.nRowsIgnored));
+	if (! rowFilter.Empty()) NotifyInfo("TDataset::ReadDataFromJsonDataSourceSpec: %d rows were dropped by the filter%s.\n", convProg.nRowsFiltered, convProg.pastFilterEnd ? " before the end of its time range was reached" : "");
+	SortRows(errors);
 	return true;
 }
 
+// Replaces 'v' with (v[rowNos[0]], v[rowNos[1]], ...); 'v' may be empty (for the vectors that a column doesn't use).
+template<typename T>
+static void SelectRows(TVec<T>& v, const TIntV& rowNos)
+{
+	if (v.Empty()) return;
+	const TVec<T> old = v; v.Gen(rowNos.Len());
+	for (int i = 0; i < rowNos.Len(); ++i) v[i] = old[rowNos[i]];
+}
+
+// Maps a timestamp to a key that sorts in the same order as the timestamps of its column: (sec, ns) for true 
+// timestamps, (value, 0) for integer times, and (the order-preserving bit pattern, 0) for floats.
+typedef std::pair<int64_t, int> TTimeSortKey;
+static TTimeSortKey GetTimeSortKey(const TTimeStamp& ts)
+{
+	if (ts.type == TTimeType::Time) return TTimeSortKey(ts.sec, ts.ns);
+	else if (ts.type == TTimeType::Int) return TTimeSortKey(ts.sec, 0);
+	int64_t bits; memcpy(&bits, &ts.flt, sizeof(bits));
+	return TTimeSortKey((bits >= 0) ? bits : (bits ^ std::numeric_limits<int64_t>::max()), 0);
+}
+
+void TDataset::SortRows(TStrV& errors)
+{
+	ClrAll(seriesStarts, inputRowMap);
+	int timeColNo = -1; for (int colNo = 0; colNo < cols.Len() && timeColNo < 0; ++colNo) if (cols[colNo].type == TAttrType::Time) timeColNo = colNo;
+	const bool bySeries = ! config->seriesAttr.Empty(), byTime = (timeColNo >= 0) && config->SortsRows();
+	TVec<TTimeSortKey> timeKeys; 
+	if (timeColNo >= 0) { const TTimeStampV &times = cols[timeColNo].timeVals; timeKeys.Gen(nRows); for (int rowNo = 0; rowNo < nRows; ++rowNo) timeKeys[rowNo] = GetTimeSortKey(times[rowNo]); }
+	if (! config->SortsRows()) {
+		if (timeColNo >= 0) for (int rowNo = 1; rowNo < nRows; ++rowNo) if (timeKeys[rowNo] < timeKeys[rowNo - 1]) { 
+			errors.Add(TStr::Fmt("Warning: the rows are not sorted by \"%s\" (see row %d); the time-window ops and the transitions between states follow the order of the rows.  Set config.sortByTime to sort them.", cols[timeColNo].name.CStr(), rowNo)); break; }
+		return; }
+	// The keyIds of a categorical column are assigned in the order in which the keys first appear.
+	const TIntV *seriesKeys = bySeries ? &GetCol(config->seriesAttr).intVals : nullptr;
+	auto Less = [seriesKeys, byTime, &timeKeys] (int row1, int row2) {
+		if (seriesKeys && (*seriesKeys)[row1] != (*seriesKeys)[row2]) return (*seriesKeys)[row1] < (*seriesKeys)[row2];
+		return byTime && timeKeys[row1] < timeKeys[row2]; };
+	// Most inputs are already sorted, which takes just one pass to find out.
+	bool sorted = true; for (int rowNo = 1; rowNo < nRows && sorted; ++rowNo) if (Less(rowNo, rowNo - 1)) sorted = false;
+	// order[rowNo] = the position of 'rowNo' in the input data.
+	TIntV order(nRows); for (int rowNo = 0; rowNo < nRows; ++rowNo) order[rowNo] = rowNo;
+	if (! sorted) {
+		ParallelStableSort(order, config->numThreads, [&Less] (const TInt& row1, const TInt& row2) { return Less(row1, row2); });
+		ParallelFor(cols.Len(), config->numThreads, [this, &order] (int colNo) {
+			TDataColumn &col = cols[colNo]; col.calendar.Clr();
+			SelectRows(col.fltVals, order); SelectRows(col.intVals, order); SelectRows(col.sparseVecIndex, order); SelectRows(col.timeVals, order); });
+		SelectRows(timeKeys, order); }
+	inputRowMap.Gen(nRows); for (int rowNo = 0; rowNo < nRows; ++rowNo) inputRowMap[order[rowNo]] = rowNo;
+	// Merge the runs of rows with the same series and time.
+	int nMerged = 0;
+	if (byTime && config->duplicateTimes != TDuplicateTimes::Keep)
+	{
+		const TDuplicateTimes policy = config->duplicateTimes;
+		auto SameKey = [seriesKeys, &timeKeys] (int row1, int row2) { 
+			return timeKeys[row1] == timeKeys[row2] && (! seriesKeys || (*seriesKeys)[row1] == (*seriesKeys)[row2]); };
+		TIntV keptRows; 
+		for (int from = 0, to; from < nRows; from = to)
+		{
+			to = from + 1; while (to < nRows && SameKey(from, to)) ++to;
+			const int keptRow = (policy == TDuplicateTimes::First) ? from : to - 1; keptRows.Add(keptRow);
+			for (int rowNo = from; rowNo < to; ++rowNo) inputRowMap[order[rowNo]] = keptRows.Len() - 1;
+			if (to - from == 1) continue;
+			nMerged += to - from - 1;
+			// The columns computed by ops are still empty at this point; ApplyOps will compute them on the remaining rows.
+			for (TDataColumn &col : cols) if (col.source == TAttrSource::Input)
+			{
+				if (col.type == TAttrType::Numeric && policy == TDuplicateTimes::Mean) {
+					double sum = 0; for (int rowNo = from; rowNo < to; ++rowNo) sum += (col.subType == TAttrSubtype::Flt) ? double(col.fltVals[rowNo]) : double(col.intVals[rowNo]);
+					if (col.subType == TAttrSubtype::Flt) col.fltVals[keptRow] = sum / (to - from);
+					else col.intVals[keptRow] = (int) floor(sum / (to - from) + 0.5); }
+				// The key counts of categorical attributes must only include the rows that remain.
+				else if (col.type == TAttrType::Categorical) 
+					for (int rowNo = from; rowNo < to; ++rowNo) if (rowNo != keptRow) {
+						if (col.subType == TAttrSubtype::String) --col.strKeyMap[col.intVals[rowNo]].Val; else --col.intKeyMap[col.intVals[rowNo]].Val; }
+			}
+		}
+		if (nMerged > 0) {
+			ParallelFor(cols.Len(), config->numThreads, [this, &keptRows] (int colNo) {
+				TDataColumn &col = cols[colNo]; col.calendar.Clr();
+				SelectRows(col.fltVals, keptRows); SelectRows(col.intVals, keptRows); SelectRows(col.sparseVecIndex, keptRows); SelectRows(col.timeVals, keptRows); });
+			nRows = keptRows.Len();
+			errors.Add(TStr::Fmt("%d input rows were merged with other rows that have the same time%s.", nMerged, bySeries ? " and series" : "")); }
+	}
+	FindSeriesStarts();
+	NotifyInfo("TDataset::SortRows: %d rows in %d series%s%s.\n", nRows, GetNumSeries(), sorted ? "" : "; the rows have been reordered", (nMerged > 0) ? TStr::Fmt("; %d rows have been merged", nMerged).CStr() : "");
+}
+
+// Merges rows with duplicate times in a dataset with synthetic attributes, which are still empty 
+// when the rows are merged (both the numeric and the categorical ones), and checks the results.
+// The input rows have the times 3, 1, 3, 2, 1; the 2-sample rolling mean covers the current row and the two before it.
+void TestDuplicateTimesWithOps()
+{
+	const char *policies[] = { "first", "last", "mean" };
+	// The values of 'x' that remain after merging the rows at times 1, 2 and 3, for each policy.
+	const double expectedX[3][3] = { { 10, 20, 30 }, { 11, 20, 31 }, { 10.5, 20, 30.5 } };
+	const int expectedInputRowMap[5] = { 2, 0, 2, 1, 0 };
+	for (int policyNo = 0; policyNo < 3; ++policyNo)
+	{
+		TStr json = TStr::Fmt("{\"dataSource\": {\"type\": \"internal\", \"format\": \"csv\", \"data\": "
+			"\"ts,x\\n3,30\\n1,10\\n3,31\\n2,20\\n1,11\\n\"}, "
+			"\"config\": {\"numInitialStates\": 2, \"sortByTime\": true, \"duplicateTimes\": \"%s\", \"attributes\": ["
+			"{\"name\": \"ts\", \"type\": \"time\", \"subType\": \"integer\", \"timeType\": \"time\"}, "
+			"{\"name\": \"x\", \"type\": \"numeric\", \"subType\": \"float\"}], \"ops\": ["
+			"{\"op\": \"rollingMean\", \"inAttr\": \"x\", \"outAttr\": \"Mean_x\", \"windowUnit\": \"samples\", \"windowSize\": 2}, "
+			"{\"op\": \"timeCategorical\", \"inAttr\": \"ts\", \"outAttr\": \"Sec_ts\", \"unit\": \"sec\"}]}}", policies[policyNo]);
+		PJsonVal in = TJsonVal::GetValFromStr(json); IAssert(! in.Empty() && in->IsObj());
+		TStrV errors; PModelConfig config = new TModelConfig();
+		IAssert(config->InitFromJson(in->GetObjKey("config"), errors));
+		PDataset dataset = new TDataset(); dataset->InitColsFromConfig(config);
+		IAssert(dataset->ReadDataFromJsonDataSourceSpec(in->GetObjKey("dataSource"), errors));
+		IAssert(dataset->ApplyOps(errors));
+		IAssert(dataset->nRows == 3);
+		const TDataColumn &TC = dataset->GetCol("ts"), &XC = dataset->GetCol("x"), &MC = dataset->GetCol("Mean_x"), &SC = dataset->GetCol("Sec_ts");
+		const double *x = expectedX[policyNo];
+		for (int rowNo = 0; rowNo < 3; ++rowNo) {
+			IAssert(TC.timeVals[rowNo].sec == rowNo + 1);
+			IAssert(XC.fltVals[rowNo] == x[rowNo]);
+			double sum = 0; for (int i = 0; i <= rowNo; ++i) sum += x[i];
+			IAssert(fabs(MC.fltVals[rowNo] - sum / (rowNo + 1)) < 1e-12);
+			IAssert(SC.intVals[rowNo] == rowNo + 1 && SC.intKeyMap[rowNo + 1] == 1); }
+		IAssert(dataset->inputRowMap.Len() == 5);
+		for (int i = 0; i < 5; ++i) IAssert(dataset->inputRowMap[i] == expectedInputRowMap[i]);
+		printf("duplicateTimes = \"%s\": OK\n", policies[policyNo]);
+	}
+}
+
+void TDataset::FindSeriesStarts()
+{
+	seriesStarts.Clr(); 
+	if (config->seriesAttr.Empty()) return;
+	const TDataColumn &SC = GetCol(config->seriesAttr);
+	for (int rowNo = 0; rowNo < nRows; ++rowNo) if (rowNo == 0 || SC.intVals[rowNo] != SC.intVals[rowNo - 1]) seriesStarts.Add(rowNo);
+	seriesStarts.Add(nRows);
+}
+
+// A group of ops that TDataset::ApplyOps applies as a single task.
+class TOpTask
+{
+public:
+	TVec<TOpDesc *> ops; // all of them are time-window ops if there is more than one
+	TStrV inAttrs, outAttrs; bool allAttrs = false; // allAttrs = true if the ops may read or write any attribute
+	int level = 0; // tasks at the same level are independent of each other
+	// Time-window ops may use up to 'nThreads' threads for processing several series in parallel.
+	bool Apply(TDataset& dataset, int nThreads, TStrV& errors) const { 
+		if (ops.Len() == 1 && ! dynamic_cast<TOpDesc_TimeWindow *>(ops[0])) return ops[0]->Apply(dataset, errors);
+		TVec<TOpDesc_TimeWindow *> group; for (TOpDesc *op : ops) group.Add(dynamic_cast<TOpDesc_TimeWindow *>(op));
+		return TOpDesc_TimeWindow::ApplyAll(dataset, group, nThreads, errors); }
+	// Returns true if this task must be applied after 'prev', which comes before it in config.ops.
+	bool DependsOn(const TOpTask& prev) const {
+		if (allAttrs || prev.allAttrs) return true;
+		for (const TStr& attr : prev.outAttrs) if (inAttrs.IsIn(attr) || outAttrs.IsIn(attr)) return true;
+		for (const TStr& attr : outAttrs) if (prev.inAttrs.IsIn(attr)) return true;
+		return false; }
+};
+
+void TDataset::GetOpsToApply(TVec<TOpDesc *>& opsToApply) const
+{
+	const TOpDescV &ops = config->ops; opsToApply.Clr();
+	if (neededCols.Empty()) { for (const POpDesc& op : ops) opsToApply.Add(op()); return; }
+	// Go through the ops backwards, keeping track of the columns needed by the caller or by the ops that will be applied.
+	// An op is applied if it writes a needed column; its own output is then no longer needed before it (unless it's also
+	// one of its inputs), but its inputs are.
+	TBoolV needed = neededCols; TBoolV applyOp; applyOp.Gen(ops.Len()); applyOp.PutAll(false);
+	for (int opNo = ops.Len() - 1; opNo >= 0; --opNo)
+	{
+		TStrV inAttrs, outAttrs; 
+		if (! ops[opNo]->GetAttrDeps(inAttrs, outAttrs)) { applyOp[opNo] = true; needed.PutAll(true); continue; }
+		for (const TStr& attr : outAttrs) { int colNo = GetColIdx(attr); if (colNo < 0 || needed[colNo]) applyOp[opNo] = true; }
+		if (! applyOp[opNo]) continue;
+		for (const TStr& attr : outAttrs) { int colNo = GetColIdx(attr); if (colNo >= 0) needed[colNo] = false; }
+		for (const TStr& attr : inAttrs) { int colNo = GetColIdx(attr); if (colNo >= 0) needed[colNo] = true; }
+	}
+	for (int opNo = 0; opNo < ops.Len(); ++opNo) 
+		if (applyOp[opNo]) opsToApply.Add(ops[opNo]()); 
+		else NotifyInfo("TDataset::ApplyOps: skipping op %d, whose output is not needed.\n", opNo);
+}
+
 bool TDataset::ApplyOps(TStrV& errors)
 {
-	for (const POpDesc &op : config->ops)
-		if (! op->Apply(*this, errors)) return false;
+	// Consecutive time-window ops with the same window are applied in a single pass over the data.
+	TVec<TOpDesc *> ops; GetOpsToApply(ops); TVec<TOpTask> tasks;
+	for (int opNo = 0; opNo < ops.Len(); )
+	{
+		TVec<TOpDesc_TimeWindow *> group;
+		for (int i = opNo; i < ops.Len(); ++i) {
+			TOpDesc_TimeWindow *op = dynamic_cast<TOpDesc_TimeWindow *>(ops[i]); if (! op) break;
+			bool ok = true; for (const TOpDesc_TimeWindow *prev : group) if (! op->CanSharePassWith(*prev)) { ok = false; break; }
+			if (! ok) break; 
+			group.Add(op); }
+		TOpTask &task = tasks[tasks.Add()];
+		if (group.Len() > 1) { for (TOpDesc_TimeWindow *op : group) task.ops.Add(op); opNo += group.Len(); }
+		else { task.ops.Add(ops[opNo]); ++opNo; }
+		for (const TOpDesc *op : task.ops) if (! op->GetAttrDeps(task.inAttrs, task.outAttrs)) task.allAttrs = true;
+	}
+	// Each task goes one level above the last task that it depends on.  The tasks at the same level 
+	// read and write disjoint columns, so they can be applied concurrently with the same results as in order.
+	int nLevels = 0;
+	for (int taskNo = 0; taskNo < tasks.Len(); ++taskNo) {
+		TOpTask &task = tasks[taskNo];
+		for (int prevNo = 0; prevNo < taskNo; ++prevNo) if (task.level <= tasks[prevNo].level && task.DependsOn(tasks[prevNo])) task.level = tasks[prevNo].level + 1;
+		nLevels = TInt::GetMx(nLevels, task.level + 1); }
+	CalcCalendarCodes();
+	for (int level = 0; level < nLevels; ++level)
+	{
+		TIntV taskNos; for (int taskNo = 0; taskNo < tasks.Len(); ++taskNo) if (tasks[taskNo].level == level) taskNos.Add(taskNo);
+		// Compute the column statistics needed by the ops at this level, unless they are still valid from an earlier level.
+		// Each column's statistics are computed once for all the ops that refer to them.
+		if (colStats.Len() != cols.Len()) colStats.Gen(cols.Len());
+		TIntV statsColNos; 
+		for (int taskNo : taskNos) for (const TOpDesc *op : tasks[taskNo].ops) {
+			TStrV attrs; op->GetStatsAttrs(attrs);
+			for (const TStr& attr : attrs) { int colNo = GetColIdx(attr); if (colNo >= 0 && ! colStats[colNo].valid && ! statsColNos.IsIn(colNo)) statsColNos.Add(colNo); } }
+		ParallelFor(statsColNos.Len(), config->numThreads, [&] (int i) { colStats[statsColNos[i]].Calc(cols[statsColNos[i]]); });
+		// Apply the tasks.  Each task reports its errors separately; they are then merged in the order of the ops.
+		bool ok = true;
+		if (taskNos.Len() == 1) ok = tasks[taskNos[0]].Apply(*this, config->numThreads, errors);
+		else {
+			TVec<TStrV> taskErrors; taskErrors.Gen(taskNos.Len()); TBoolV taskOk; taskOk.Gen(taskNos.Len());
+			ParallelFor(taskNos.Len(), config->numThreads, [&] (int i) {
+				taskOk[i] = tasks[taskNos[i]].Apply(*this, 1, taskErrors[i]); });
+			for (int i = 0; i < taskNos.Len(); ++i) { errors.AddV(taskErrors[i]); if (! taskOk[i]) ok = false; } }
+		if (! ok) { colStats.Clr(); return false; }
+		// The statistics of the columns that have been modified are no longer valid.
+		for (int taskNo : taskNos) {
+			const TOpTask &task = tasks[taskNo];
+			if (task.allAttrs) { colStats.Clr(); for (TDataColumn& col : cols) col.calendar.Clr(); CalcCalendarCodes(); }
+			else for (const TStr& attr : task.outAttrs) { int colNo = GetColIdx(attr); if (colNo >= 0 && colNo < colStats.Len()) colStats[colNo].valid = false; } }
+	}
+	colStats.Clr();
 	return true;
 }
 
-void TDataset::CalcDefaultDistWeights() 
-{ 
-	for (TDataColumn& col : cols) if (isnan(col.distWeight)) 
+void TCalendarCodes::Calc(const TTimeStampV& timeVals)
+{
+	const int n = timeVals.Len(); hour.Gen(n); dayOfWeek.Gen(n); month.Gen(n);
+	for (int i = 0; i < n; ++i)
 	{
-		col.distWeight = col.GetDefaultDistWeight(config->distWeightOutliers); 
-		NotifyInfo("TDataset::CalcDefaultDistWeights: setting distWeight of \"%s\" to %g.\n", col.name.CStr(), col.distWeight);
+		const TTimeStamp &ts = timeVals[i];
+		TSecTm secTm(ts.type == TTimeType::Flt ? uint(floor(ts.flt)) : ts.sec);
+		hour[i] = (uint8_t) secTm.GetHourN(); dayOfWeek[i] = (uint8_t) (secTm.GetDayOfWeekN() - 1); month[i] = (uint8_t) (secTm.GetMonthN() - 1);
 	}
 }
 
+void TDataset::CalcCalendarCodes()
+{
+	TIntV colNos; 
+	for (int colNo = 0; colNo < cols.Len(); ++colNo) { 
+		const TDataColumn &col = cols[colNo]; 
+		if (col.type == TAttrType::Time && col.timeType == TTimeType::Time && col.calendar.Len() != col.timeVals.Len()) colNos.Add(colNo); }
+	ParallelFor(colNos.Len(), config->numThreads, [this, &colNos] (int i) { TDataColumn &col = cols[colNos[i]]; col.calendar.Calc(col.timeVals); });
+}
+
+void TDataset::CalcDefaultDistWeights() 
+{ 
+	TIntV colNos; for (int colNo = 0; colNo < cols.Len(); ++colNo) if (isnan(cols[colNo].distWeight)) colNos.Add(colNo);
+	// The columns are independent, so they are processed in parallel; the log messages are reported
+	// afterwards so that their order doesn't depend on the scheduling.
+	TStrV details; details.Gen(colNos.Len());
+	ParallelFor(colNos.Len(), config->numThreads, [this, &colNos, &details] (int i) { 
+		TDataColumn &col = cols[colNos[i]]; 
+		col.distWeight = col.GetDefaultDistWeight(config->distWeightOutliers, config->distWeightSampleThreshold, details[i]); });
+	for (int i = 0; i < colNos.Len(); ++i) {
+		const TDataColumn &col = cols[colNos[i]];
+		if (col.type == TAttrType::Numeric) NotifyInfo("TDataset::CalcDefaultDistWeights: variance of \"%s\": %s.\n", col.name.CStr(), details[i].CStr());
+		NotifyInfo("TDataset::CalcDefaultDistWeights: setting distWeight of \"%s\" to %g.\n", col.name.CStr(), col.distWeight); }
+}
+
+// The squared distances between text attributes (before being multiplied by distWeight).
+static double TextDist2(const TDataColumn& col, int row1, int row2)
+{
+	const auto &V = col.sparseVecData;
+	const auto &pr1 = col.sparseVecIndex[row1]; const auto *from1 = &V[pr1.Val1]; const auto *to1 = from1 + pr1.Val2;
+	const auto &pr2 = col.sparseVecIndex[row2]; const auto *from2 = &V[pr2.Val1]; const auto *to2 = from2 + pr2.Val2;
+	double sum11 = 0, sum12 = 0, sum22 = 0;
+	while (from1 < to1 && from2 < to2) {
+		auto key1 = from1->Key, key2 = from2->Key; auto dat1 = from1->Dat, dat2 = from2->Dat;
+		if (key1 == key2) sum12 += dat1 * dat2;
+		if (key1 <= key2) { sum11 += dat1 * dat1; ++from1; }
+		if (key2 <= key1) { sum22 += dat2 * dat2; ++from2; } }
+	while (from1 < to1) { auto dat1 = from1->Dat; sum11 += dat1 * dat1; ++from1; }
+	while (from2 < to2) { auto dat2 = from2->Dat; sum22 += dat2 * dat2; ++from2; }
+	// sum_i (x_i - y_i)^2 = sum_i x_i^2 + sum_i y_i^2 - 2 sum_i x_i y_i
+	return sum11 + sum22 - sum12 - sum12;
+}
+
+static double TextDist2(const TDataColumn& col, int rowNo, const TCentroidComponent& comp)
+{
+	const auto &V = col.sparseVecData;
+	const auto &pr1 = col.sparseVecIndex[rowNo]; const auto *from1 = V.begin() + pr1.Val1; const auto *to1 = from1 + pr1.Val2;
+	double sum11 = 0, sum12 = 0, sum22 = comp.GetSparseVec2();
+	for ( ; from1 < to1; ++from1) {
+		auto key1 = from1->Key; auto dat1 = from1->Dat;
+		auto keyId2 = comp.sparseVec.GetKeyId(key1);
+		double dat2 = (keyId2 < 0) ? 0.0 : comp.sparseVec[keyId2].Val;
+		sum11 += dat1 * dat1; sum12 += dat1 * dat2; }
+	// sum_i (x_i - y_i)^2 = sum_i x_i^2 + sum_i y_i^2 - 2 sum_i x_i y_i
+	return sum11 + sum22 - sum12 - sum12;
+}
+
+static double TextDist2(const TCentroidComponent& comp1, const TCentroidComponent& comp2)
+{
+	const int L1 = comp1.sparseVec.Len(), L2 = comp2.sparseVec.Len();
+	const auto &SV1 = (L1 < L2) ? comp1.sparseVec : comp2.sparseVec, &SV2 = (L1 < L2) ? comp2.sparseVec : comp1.sparseVec;
+	double sum11 = comp1.GetSparseVec2(), sum12 = 0, sum22 = comp2.GetSparseVec2();
+	for (auto keyId1 = SV1.FFirstKeyId(); SV1.FNextKeyId(keyId1); ) {
+		auto key = SV1.GetKey(keyId1); double dat1 = SV1[keyId1];
+		auto keyId2 = SV2.GetKeyId(key);
+		double dat2 = (keyId2 < 0) ? 0.0 : SV2[keyId2].Val;
+		sum12 += dat1 * dat2; }
+	// sum_i (x_i - y_i)^2 = sum_i x_i^2 + sum_i y_i^2 - 2 sum_i x_i y_i
+	return sum11 + sum22 - sum12 - sum12;
+}
+
 double TDataset::RowDist2(int row1, int row2) const
 {
 	double result = 0; const int nCols = cols.Len();
@@ -1317,21 +3842,9 @@ double TDataset::RowDist2(int row1, int row2) const
 			else Assert(false); 
 			delta2 *= delta2; }
 		else if (col.type == TAttrType::Categorical) {
-			delta2 = (col.intVals[row1] == col.intVals[row2]) ? 1 : 0; }
-		else if (col.type == TAttrType::Text) {
-			const auto &V = col.sparseVecData;
-			const auto &pr1 = col.sparseVecIndex[row1]; const auto *from1 = &V[pr1.Val1]; const auto *to1 = from1 + pr1.Val2;
-			const auto &pr2 = col.sparseVecIndex[row2]; const auto *from2 = &V[pr2.Val1]; const auto *to2 = from2 + pr2.Val2;
-			double sum11 = 0, sum12 = 0, sum22 = 0;
-			while (from1 < to1 && from2 < to2) {
-				auto key1 = from1->Key, key2 = from2->Key; auto dat1 = from1->Dat, dat2 = from2->Dat;
-				if (key1 == key2) sum12 += dat1 * dat2;
-				if (key1 <= key2) { sum11 += dat1 * dat1; ++from1; }
-				if (key2 <= key1) { sum22 += dat2 * dat2; ++from2; } }
-			while (from1 < to1) { auto dat1 = from1->Dat; sum11 += dat1 * dat1; ++from1; }
-			while (from2 < to2) { auto dat2 = from2->Dat; sum22 += dat2 * dat2; ++from2; }
-			// sum_i (x_i - y_i)^2 = sum_i x_i^2 + sum_i y_i^2 - 2 sum_i x_i y_i
-			delta2 = sum11 + sum22 - sum12 - sum12; }
+			// Same as the squared distance between the one-hot encodings of the two values.
+			delta2 = (col.intVals[row1] == col.intVals[row2]) ? 0 : 2; }
+		else if (col.type == TAttrType::Text) delta2 = TextDist2(col, row1, row2);
 		else Assert(false);
 		result += col.distWeight * delta2;
 	}
@@ -1353,21 +3866,8 @@ double TDataset::RowCentrDist2(int rowNo, const TCentroidComponentV& centroid) c
 			else if (col.subType == TAttrSubtype::Int) delta2 = double(col.intVals[rowNo]) - comp.fltVal;
 			else Assert(false); 
 			delta2 *= delta2; }
-		else if (col.type == TAttrType::Categorical) {
-			for (int keyId = 0; keyId < comp.denseVec.Len(); ++keyId) {
-				double d = (col.intVals[rowNo] == keyId ? 1 : 0) - comp.denseVec[keyId];
-				delta2 += d * d; } }
-		else if (col.type == TAttrType::Text) {
-			const auto &V = col.sparseVecData;
-			const auto &pr1 = col.sparseVecIndex[rowNo]; const auto *from1 = V.begin() + pr1.Val1; const auto *to1 = from1 + pr1.Val2;
-			double sum11 = 0, sum12 = 0, sum22 = comp.GetSparseVec2();
-			for ( ; from1 < to1; ++from1) {
-				auto key1 = from1->Key; auto dat1 = from1->Dat;
-				auto keyId2 = comp.sparseVec.GetKeyId(key1);
-				double dat2 = (keyId2 < 0) ? 0.0 : comp.sparseVec[keyId2].Val;
-				sum11 += dat1 * dat1; sum12 = dat1 * dat2; }
-			// sum_i (x_i - y_i)^2 = sum_i x_i^2 + sum_i y_i^2 - 2 sum_i x_i y_i
-			delta2 = sum11 + sum22 - sum12 - sum12; }
+		else if (col.type == TAttrType::Categorical) delta2 = comp.GetOneHotDist2(col.intVals[rowNo]);
+		else if (col.type == TAttrType::Text) delta2 = TextDist2(col, rowNo, comp);
 		else Assert(false);
 		result += col.distWeight * delta2;
 	}
@@ -1394,23 +3894,365 @@ double TDataset::CentrDist2(const TCentroidComponentV& centroid1, const TCentroi
 			for (int keyId = 0; keyId < L; ++keyId) {
 				double d = comp1.denseVec[keyId] - comp2.denseVec[keyId];
 				delta2 += d * d; } }
-		else if (col.type == TAttrType::Text) {
-			const int L1 = comp1.sparseVec.Len(), L2 = comp2.sparseVec.Len();
-			const auto &SV1 = (L1 < L2) ? comp1.sparseVec : comp2.sparseVec, &SV2 = (L1 < L2) ? comp2.sparseVec : comp1.sparseVec;
-			double sum11 = comp1.GetSparseVec2(), sum12 = 0, sum22 = comp2.GetSparseVec2();
-			for (auto keyId1 = SV1.FFirstKeyId(); SV1.FNextKeyId(keyId1); ) {
-				auto key = SV1.GetKey(keyId1); double dat1 = SV1[keyId1];
-				auto keyId2 = SV2.GetKeyId(key);
-				double dat2 = (keyId2 <= 0) ? 0.0 : SV2[keyId2].Val;
-				sum12 = dat1 * dat2; }
-			// sum_i (x_i - y_i)^2 = sum_i x_i^2 + sum_i y_i^2 - 2 sum_i x_i y_i
-			delta2 = sum11 + sum22 - sum12 - sum12; }
+		else if (col.type == TAttrType::Text) delta2 = TextDist2(comp1, comp2);
 		else Assert(false);
 		result += col.distWeight * delta2;
 	}
 	return result;
 }
 
+//-----------------------------------------------------------------------------
+//
+// TFeatureMatrix
+//
+//-----------------------------------------------------------------------------
+
+// The parts of the distance that the feature matrix leaves out: the one due to text attributes,
+// and between centroids, the one due to the categorical attributes in TFeatureMatrix::catCols.
+static double TextRowDist2(const TDataset& dataset, const TIntV& textCols, int row1, int row2)
+{
+	double result = 0;
+	for (int colNo : textCols) { const TDataColumn &col = dataset.cols[colNo]; result += col.distWeight * TextDist2(col, row1, row2); }
+	return result;
+}
+
+static double TextRowCentrDist2(const TDataset& dataset, const TIntV& textCols, int rowNo, const TCentroidComponentV& centroid)
+{
+	double result = 0;
+	for (int colNo : textCols) { const TDataColumn &col = dataset.cols[colNo]; result += col.distWeight * TextDist2(col, rowNo, centroid[colNo]); }
+	return result;
+}
+
+static double TextCentrDist2(const TDataset& dataset, const TIntV& textCols, const TCentroidComponentV& centroid1, const TCentroidComponentV& centroid2)
+{
+	double result = 0;
+	for (int colNo : textCols) result += dataset.cols[colNo].distWeight * TextDist2(centroid1[colNo], centroid2[colNo]);
+	return result;
+}
+
+static double CatCentrDist2(const TDataset& dataset, const TIntV& catCols, const TCentroidComponentV& centroid1, const TCentroidComponentV& centroid2)
+{
+	double result = 0;
+	for (int colNo : catCols) {
+		const TFltV &v1 = centroid1[colNo].denseVec, &v2 = centroid2[colNo].denseVec; IAssert(v1.Len() == v2.Len());
+		double delta2 = 0; for (int keyId = 0; keyId < v1.Len(); ++keyId) { const double d = v1[keyId] - v2[keyId]; delta2 += d * d; }
+		result += dataset.cols[colNo].distWeight * delta2; }
+	return result;
+}
+
+void TFeatureMatrix::InitLayout(const TDataset& dataset)
+{
+	const int nCols = dataset.cols.Len(); precision = dataset.config->precision;
+	firstFeature.Gen(nCols); firstFeature.PutAll(-1); scale.Gen(nCols); scale.PutAll(0); offset.Gen(nCols); offset.PutAll(0); 
+	ClrAll(textCols, catCols, catWeights); nFeatures = 0;
+	for (int colNo = 0; colNo < nCols; ++colNo)
+	{
+		const TDataColumn &col = dataset.cols[colNo];
+		if (col.distWeight == 0 || col.type == TAttrType::Time) continue;
+		if (col.type == TAttrType::Text) { textCols.Add(colNo); continue; }
+		int nColFeatures = 1;
+		if (col.type == TAttrType::Categorical) {
+			if (col.subType == TAttrSubtype::Int) nColFeatures = col.intKeyMap.Len();
+			else if (col.subType == TAttrSubtype::String) nColFeatures = col.strKeyMap.Len();
+			else IAssert(false); 
+			if (nColFeatures > MaxOneHotKeys) { catCols.Add(colNo); catWeights.Add(col.distWeight); continue; } }
+		else IAssert(col.type == TAttrType::Numeric);
+		firstFeature[colNo] = nFeatures; scale[colNo] = sqrt(col.distWeight); nFeatures += nColFeatures;
+	}
+	static_assert((Alignment / sizeof(double)) % TDistKernels::StrideMultipleF64 == 0 && (Alignment / sizeof(float)) % TDistKernels::StrideMultipleF32 == 0, "The stride must suit the distance kernels.");
+	const int perLine = Alignment / ((precision == TPrecision::Float32) ? sizeof(float) : sizeof(double));
+	stride = (nFeatures + perLine - 1) / perLine * perLine;
+}
+
+void TFeatureMatrix::GenRows(int nRows_)
+{
+	nRows = nRows_; data64 = nullptr; data32 = nullptr;
+	if (precision == TPrecision::Float32) {
+		std::vector<double>().swap(buf64); buf32.assign(size_t(nRows) * stride + Alignment / sizeof(float), 0.0f);
+		data32 = buf32.data(); while ((reinterpret_cast<uintptr_t>(data32) % Alignment) != 0) ++data32; }
+	else {
+		std::vector<float>().swap(buf32); buf64.assign(size_t(nRows) * stride + Alignment / sizeof(double), 0.0);
+		data64 = buf64.data(); while ((reinterpret_cast<uintptr_t>(data64) % Alignment) != 0) ++data64; }
+}
+
+void TFeatureMatrix::Init(const TDataset& dataset)
+{
+	const int nCols = dataset.cols.Len();
+	TIntV colMap(nCols); for (int colNo = 0; colNo < nCols; ++colNo) colMap[colNo] = colNo;
+	TIntV rowNos(dataset.nRows); for (int rowNo = 0; rowNo < dataset.nRows; ++rowNo) rowNos[rowNo] = rowNo;
+	Init(dataset, dataset, colMap, rowNos);
+}
+
+void TFeatureMatrix::Init(const TDataset& layoutDataset, const TDataset& dataset, const TIntV& colMap, const TIntV& rowNos)
+{
+	InitLayout(layoutDataset); GenRows(rowNos.Len());
+	const int nCols = layoutDataset.cols.Len(), nCatCols = catCols.Len(); catKeys.assign(size_t(nRows) * nCatCols, -1);
+	// The keyIds in col.intVals refer to col.{str|int}KeyMap; if that's a different dataset, 
+	// map them to the keyIds of ourCol.{str|int}KeyMap, which determine the features.
+	TVec<TIntV> keyMaps(nCols); TIntV nKeys(nCols), catColIdx(nCols);
+	for (int colNo = 0; colNo < nCols; ++colNo)
+	{
+		catColIdx[colNo] = catCols.SearchForw(colNo); if (firstFeature[colNo] < 0 && catColIdx[colNo] < 0) continue;
+		const TDataColumn &ourCol = layoutDataset.cols[colNo]; IAssert(colMap[colNo] >= 0);
+		const TDataColumn &col = dataset.cols[colMap[colNo]]; 
+		if (col.type == TAttrType::Numeric) { 
+			if (precision != TPrecision::Float32 || nRows == 0) continue;
+			double sum = 0; for (int rowNo : rowNos) sum += (col.subType == TAttrSubtype::Flt) ? double(col.fltVals[rowNo]) : double(col.intVals[rowNo]);
+			offset[colNo] = sum / nRows; continue; }
+		IAssert(col.type == TAttrType::Categorical);
+		nKeys[colNo] = (ourCol.subType == TAttrSubtype::Int) ? ourCol.intKeyMap.Len() : ourCol.strKeyMap.Len();
+		if (&col == &ourCol) continue;
+		const int nOtherKeys = (col.subType == TAttrSubtype::Int) ? col.intKeyMap.Len() : col.strKeyMap.Len();
+		TIntV &keyMap = keyMaps[colNo]; keyMap.Gen(nOtherKeys);
+		for (int keyId = 0; keyId < nOtherKeys; ++keyId) {
+			if (col.subType == TAttrSubtype::String) keyMap[keyId] = ourCol.strKeyMap.GetKeyId(col.strKeyMap.GetKey(keyId));
+			else if (col.subType == TAttrSubtype::Int) keyMap[keyId] = ourCol.intKeyMap.GetKeyId(col.intKeyMap.GetKey(keyId));
+			else IAssert(false); }
+	}
+	// Fill the matrix in blocks of rows, so that each thread writes to a separate part of it.
+	const int BlockLen = 4096, nBlocks = (nRows + BlockLen - 1) / BlockLen;
+	ParallelFor(nBlocks, layoutDataset.config->numThreads, [&] (int blockNo) {
+		const int from = blockNo * BlockLen, to = TInt::GetMn(from + BlockLen, nRows);
+		for (int colNo = 0; colNo < nCols; ++colNo)
+		{
+			const int first = firstFeature[colNo], catIdx = catColIdx[colNo]; if (first < 0 && catIdx < 0) continue;
+			const TDataColumn &col = dataset.cols[colMap[colNo]]; const double s = scale[colNo], o = offset[colNo];
+			if (col.type == TAttrType::Numeric) {
+				if (col.subType == TAttrSubtype::Flt) for (int i = from; i < to; ++i) PutFeature(i, first, (col.fltVals[rowNos[i]] - o) * s);
+				else if (col.subType == TAttrSubtype::Int) for (int i = from; i < to; ++i) PutFeature(i, first, (double(col.intVals[rowNos[i]]) - o) * s);
+				else IAssert(false); 
+				continue; }
+			const TIntV &keyMap = keyMaps[colNo]; const int nColKeys = nKeys[colNo];
+			for (int i = from; i < to; ++i) {
+				int keyId = col.intVals[rowNos[i]];
+				if (! keyMap.Empty()) keyId = (keyId >= 0 && keyId < keyMap.Len()) ? keyMap[keyId].Val : -1;
+				if (keyId < 0 || keyId >= nColKeys) keyId = -1;
+				if (catIdx >= 0) catKeys[GetCatOffset(i) + catIdx] = keyId;
+				else if (keyId >= 0) PutFeature(i, first + keyId, s); }
+		} });
+}
+
+void TFeatureMatrix::InitCentroids(const TDataset& dataset, const TStateV& states, const TFeatureMatrix *rows)
+{
+	InitLayout(dataset); GenRows(states.Len());
+	if (rows) { IAssert(rows->offset.Len() == offset.Len()); offset = rows->offset; }
+	else if (precision == TPrecision::Float32 && nRows > 0) 
+		for (int colNo = 0; colNo < dataset.cols.Len(); ++colNo) if (firstFeature[colNo] >= 0 && dataset.cols[colNo].type == TAttrType::Numeric) {
+			double sum = 0; for (const PState& state : states) sum += state->centroid[colNo].fltVal;
+			offset[colNo] = sum / nRows; }
+	for (int stateNo = 0; stateNo < nRows; ++stateNo)
+	{
+		const TCentroidComponentV &centroid = states[stateNo]->centroid;
+		for (int colNo = 0; colNo < dataset.cols.Len(); ++colNo)
+		{
+			const int first = firstFeature[colNo]; if (first < 0) continue;
+			const TCentroidComponent &comp = centroid[colNo]; const double s = scale[colNo];
+			if (dataset.cols[colNo].type == TAttrType::Numeric) PutFeature(stateNo, first, (comp.fltVal - offset[colNo]) * s);
+			else for (int keyId = 0; keyId < comp.denseVec.Len(); ++keyId) PutFeature(stateNo, first + keyId, comp.denseVec[keyId] * s);
+		}
+	}
+}
+
+double TFeatureMatrix::CatDist2(int row1, int row2) const
+{
+	const int nCatCols = catCols.Len(); double result = 0; if (nCatCols == 0) return 0;
+	const int *keys1 = catKeys.data() + GetCatOffset(row1), *keys2 = catKeys.data() + GetCatOffset(row2);
+	for (int i = 0; i < nCatCols; ++i) {
+		// The one-hot vectors of two different keys are at a distance of 2; that of an unknown key is 0.
+		const int k1 = keys1[i], k2 = keys2[i]; 
+		if (k1 != k2) result += catWeights[i] * ((k1 >= 0 ? 1 : 0) + (k2 >= 0 ? 1 : 0)); }
+	return result;
+}
+
+double TFeatureMatrix::CatDist2(int rowNo, const TCentroidComponentV& centroid) const
+{
+	const int nCatCols = catCols.Len(); double result = 0; if (nCatCols == 0) return 0;
+	const int *keys = catKeys.data() + GetCatOffset(rowNo);
+	for (int i = 0; i < nCatCols; ++i) result += catWeights[i] * centroid[catCols[i]].GetOneHotDist2(keys[i]);
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+//
+// TDatasetSnapshot
+//
+//-----------------------------------------------------------------------------
+//
+// A snapshot is a cache local to this machine and build, so the columns are stored in their
+// in-memory layout (native byte order and struct padding); the sizes of the element types 
+// are part of the key, so a snapshot written by an incompatible build is never picked up.
+// Layout: magic, key, nRows, nCols; for each column its name, type, subType, timeType and
+// distWeight, then fltVals, intVals, intKeyMap, strKeyMap, sparseVecData, sparseVecIndex
+// and timeVals; then inputRowMap, if the config sorts the rows; finally the warnings.  Strings are stored with their length and a terminating
+// null character; vectors with their length followed by all their elements in one block,
+// so that loading a column from the mapped file is a single memcpy.
+
+TStr TDatasetSnapshot::dirName;
+
+namespace {
+
+const char SnapshotMagic[8] = { 'S', 'S', '2', 'S', 'N', 'A', 'P', '2' };
+
+uint64_t Fnv1a64(const char *p, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; ++i) { h ^= (uchar) p[i]; h *= 1099511628211ULL; }
+	return h;
+}
+
+class TSnapshotWriter
+{
+public:
+	FILE *f; bool ok;
+	TSnapshotWriter(FILE *f_) : f(f_), ok(f_ != nullptr) { }
+	void WriteBytes(const void *p, size_t nBytes) { if (ok && nBytes > 0 && fwrite(p, 1, nBytes, f) != nBytes) ok = false; }
+	template<typename T> void WriteVal(const T& x) { WriteBytes(&x, sizeof(T)); }
+	void WriteStr(const TStr& s) { WriteVal<int64_t>(s.Len()); WriteBytes(s.CStr(), size_t(s.Len()) + 1); }
+	void WriteStr(const char *s) { size_t len = strlen(s); WriteVal<int64_t>(len); WriteBytes(s, len + 1); }
+	template<typename T> void WriteVec(const TVec<T>& v) { WriteVal<int64_t>(v.Len()); if (! v.Empty()) WriteBytes(&v[0], sizeof(T) * size_t(v.Len())); }
+};
+
+class TSnapshotReader
+{
+public:
+	const char *p, *end; bool ok;
+	TSnapshotReader(const char *p_, size_t len) : p(p_), end(p_ + len), ok(true) { }
+	bool ReadBytes(void *dest, size_t nBytes) { if (! ok || size_t(end - p) < nBytes) return ok = false; memcpy(dest, p, nBytes); p += nBytes; return true; }
+	template<typename T> bool ReadVal(T& x) { return ReadBytes(&x, sizeof(T)); }
+	// Reads a length and checks that that many elements of the given size are available.
+	bool ReadLen(int& len, size_t eltSize) { 
+		int64_t n; if (! ReadVal(n)) return false;
+		if (n < 0 || n > TInt::Mx || uint64_t(n) > size_t(end - p) / eltSize) return ok = false;
+		len = (int) n; return true; }
+	// The returned pointer points into the snapshot data.
+	bool ReadStr(const char *&s) { 
+		int len; if (! ReadLen(len, 1) || p + len >= end || p[len] != 0) return ok = false;
+		s = p; p += len + 1; return true; }
+	bool ReadStr(TStr& s) { const char *q; if (! ReadStr(q)) return false; s = q; return true; }
+	template<typename T> bool ReadVec(TVec<T>& v) { 
+		int len; if (! ReadLen(len, sizeof(T))) return false; 
+		v.Gen(len); if (len > 0) ReadBytes(&v[0], sizeof(T) * size_t(len)); return ok; }
+};
+
+}
+
+TDatasetSnapshot::TDatasetSnapshot(TDataset& dataset_, const PJsonVal& jsonSpec, bool withDistWeights) : dataset(dataset_), firstMsg(-1)
+{
+	if (dirName.Empty() || dataset.config.Empty() || jsonSpec.Empty() || ! jsonSpec->IsObj()) return;
+	TStrV dummyErrors; TStr type, dataFileName;
+	if (! Json_GetObjStr(jsonSpec, "type", false, "", type, "dataSource", dummyErrors) || type != "file") return;
+	if (! Json_GetObjStr(jsonSpec, "fileName", false, "", dataFileName, "dataSource", dummyErrors)) return;
+	const int64_t fileLen = GetFileLen(dataFileName); TTm fileTime; 
+	if (fileLen < 0 || ! GetLastWriteTime(dataFileName, fileTime)) return;
+	const TModelConfig &config = *dataset.config;
+	TChA buf; 
+	buf += TStr::Fmt("layout: %d %d %d %d %d\n", int(sizeof(TFlt)), int(sizeof(TInt)), int(sizeof(TIntPr)), int(sizeof(TIntFltKd)), int(sizeof(TTimeStamp)));
+	buf += "dataSource: "; buf += TJsonVal::GetStrFromVal(jsonSpec); buf += "\n";
+	buf += TStr::Fmt("file: %lld %04d-%02d-%02d %02d:%02d:%02d.%03d\n", (long long) fileLen, 
+		fileTime.GetYear(), fileTime.GetMonth(), fileTime.GetDay(), fileTime.GetHour(), fileTime.GetMin(), fileTime.GetSec(), fileTime.GetMSec());
+	buf += TStr::Fmt("ignoreConversionErrors: %d\n", config.ignoreConversionErrors ? 1 : 0);
+	if (! config.seriesAttr.Empty()) buf += "seriesAttr: " + config.seriesAttr + "\n";
+	if (config.sortByTime || config.duplicateTimes != TDuplicateTimes::Keep) buf += TStr::Fmt("sortByTime: %d\nduplicateTimes: %d\n", config.sortByTime ? 1 : 0, int(config.duplicateTimes));
+	if (withDistWeights) buf += TStr::Fmt("distWeightOutliers: %.17g\ndistWeightSampleThreshold: %d\n", config.distWeightOutliers, config.distWeightSampleThreshold);
+	PJsonVal vAttrs = TJsonVal::NewArr();
+	for (const auto& attr : config.attrs) vAttrs->AddToArr(attr.SaveToJson());
+	buf += "attributes: "; buf += TJsonVal::GetStrFromVal(vAttrs); buf += "\n";
+	// An op that can't be saved to json can't be part of the key either.
+	PJsonVal vOps = TJsonVal::NewArr();
+	for (const auto& op : config.ops) { PJsonVal vOp = op->SaveToJson(); if (vOp.Empty()) return; vOps->AddToArr(vOp); }
+	buf += "ops: "; buf += TJsonVal::GetStrFromVal(vOps); buf += "\n";
+	if (! dataset.neededCols.Empty()) { 
+		buf += "neededCols:"; for (int colNo = 0; colNo < dataset.neededCols.Len(); ++colNo) if (dataset.neededCols[colNo]) buf += TStr::Fmt(" %d", colNo); 
+		buf += "\n"; }
+	key = buf; 
+	fileName = PathJoin(dirName, TStr::Fmt("%016llx.ss2snap", (unsigned long long) Fnv1a64(key.CStr(), key.Len())));
+}
+
+bool TDatasetSnapshot::Load(TStrV& errors)
+{
+	firstMsg = errors.Len();
+	if (fileName.Empty() || ! TFile::Exists(fileName)) return false;
+	TMappedFile file; if (! file.Open(fileName)) return false;
+	TSnapshotReader R { file.GetData(), file.Len() };
+	char magic[sizeof(SnapshotMagic)]; const char *fileKey; int nRows, nCols, nMsgs;
+	if (! R.ReadBytes(magic, sizeof(magic)) || memcmp(magic, SnapshotMagic, sizeof(magic)) != 0) return false;
+	if (! R.ReadStr(fileKey) || strcmp(key.CStr(), fileKey) != 0) return false; // a hash collision
+	if (! R.ReadVal(nRows) || ! R.ReadVal(nCols) || nRows < 0 || nCols != dataset.cols.Len()) return false;
+	// Read into a copy of the (still empty) columns so that 'dataset' stays unchanged if anything goes wrong.
+	TDataColumnV cols = dataset.cols;
+	for (TDataColumn &col : cols)
+	{
+		const char *name; int type, subType, timeType; double distWeight;
+		if (! R.ReadStr(name) || ! R.ReadVal(type) || ! R.ReadVal(subType) || ! R.ReadVal(timeType) || ! R.ReadVal(distWeight)) return false;
+		if (strcmp(col.name.CStr(), name) != 0 || type != int(col.type) || subType != int(col.subType) || timeType != int(col.timeType)) return false;
+		col.ClrVals(); col.timeVals.Clr(); col.distWeight = distWeight;
+		if (! R.ReadVec(col.fltVals) || ! R.ReadVec(col.intVals)) return false;
+		int nKeys; TIntV keys, counts; 
+		if (! R.ReadVec(keys) || ! R.ReadVec(counts) || keys.Len() != counts.Len()) return false;
+		for (int i = 0; i < keys.Len(); ++i) { 
+			if (col.intKeyMap.AddKey(keys[i]) != i) return false; 
+			col.intKeyMap[i] = counts[i]; }
+		if (! R.ReadLen(nKeys, 1)) return false;
+		for (int i = 0; i < nKeys; ++i) {
+			const char *key; int count; if (! R.ReadStr(key) || ! R.ReadVal(count)) return false;
+			if (col.strKeyMap.AddKey(key) != i) return false;
+			col.strKeyMap[i] = count; }
+		if (! R.ReadVec(col.sparseVecData) || ! R.ReadVec(col.sparseVecIndex) || ! R.ReadVec(col.timeVals)) return false;
+	}
+	TIntV inputRowMap; if (dataset.config->SortsRows() && ! R.ReadVec(inputRowMap)) return false;
+	for (int rowNo : inputRowMap) if (rowNo < 0 || rowNo >= nRows) return false;
+	if (! R.ReadLen(nMsgs, 1)) return false;
+	TStrV msgs; for (int i = 0; i < nMsgs; ++i) { msgs.Add(); if (! R.ReadStr(msgs.Last())) return false; }
+	if (R.p != R.end) return false;
+	dataset.cols.Swap(cols); dataset.nRows = nRows; errors.AddV(msgs);
+	dataset.inputRowMap.Swap(inputRowMap); dataset.FindSeriesStarts();
+	dataset.CalcCalendarCodes();
+	NotifyInfo("TDatasetSnapshot::Load: read %d rows from \"%s\".\n", nRows, fileName.CStr());
+	return true;
+}
+
+bool TDatasetSnapshot::Save_(const TStr& tmpFileName, const TStrV& errors) const
+{
+	// Our keyId-ordered copies of the key maps are only valid if the keyIds are contiguous.
+	// (This is always the case for a TStrHash, which doesn't support deleting keys.)
+	for (const TDataColumn &col : dataset.cols) 
+		for (int keyId = 0; keyId < col.intKeyMap.Len(); ++keyId) if (! col.intKeyMap.IsKeyId(keyId)) return false;
+	FILE *f = fopen(tmpFileName.CStr(), "wb"); if (! f) return false;
+	TSnapshotWriter W { f };
+	W.WriteBytes(SnapshotMagic, sizeof(SnapshotMagic)); W.WriteStr(key);
+	W.WriteVal<int>(dataset.nRows); W.WriteVal<int>(dataset.cols.Len());
+	for (const TDataColumn &col : dataset.cols)
+	{
+		W.WriteStr(col.name); W.WriteVal<int>(int(col.type)); W.WriteVal<int>(int(col.subType)); W.WriteVal<int>(int(col.timeType)); W.WriteVal<double>(col.distWeight);
+		W.WriteVec(col.fltVals); W.WriteVec(col.intVals);
+		TIntV keys, counts; for (int keyId = 0; keyId < col.intKeyMap.Len(); ++keyId) { keys.Add(col.intKeyMap.GetKey(keyId)); counts.Add(col.intKeyMap[keyId]); }
+		W.WriteVec(keys); W.WriteVec(counts);
+		W.WriteVal<int64_t>(col.strKeyMap.Len());
+		for (int keyId = 0; keyId < col.strKeyMap.Len(); ++keyId) { W.WriteStr(col.strKeyMap.GetKey(keyId)); W.WriteVal<int>(col.strKeyMap[keyId]); }
+		W.WriteVec(col.sparseVecData); W.WriteVec(col.sparseVecIndex); W.WriteVec(col.timeVals);
+	}
+	if (dataset.config->SortsRows()) W.WriteVec(dataset.inputRowMap);
+	W.WriteVal<int64_t>(errors.Len() - firstMsg);
+	for (int i = firstMsg; i < errors.Len(); ++i) W.WriteStr(errors[i]);
+	bool ok = W.ok; if (fclose(f) != 0) ok = false;
+	return ok;
+}
+
+void TDatasetSnapshot::Save(const TStrV& errors) const
+{
+	if (fileName.Empty() || firstMsg < 0) return;
+	// Write to a temporary file first so that a reader never sees a partially written snapshot.
+	TStr tmpFileName = fileName + ".tmp";
+	bool ok = Save_(tmpFileName, errors);
+#ifdef GLib_WIN
+	if (ok) { remove(fileName.CStr()); ok = (rename(tmpFileName.CStr(), fileName.CStr()) == 0); }
+#else
+	if (ok) ok = (rename(tmpFileName.CStr(), fileName.CStr()) == 0);
+#endif
+	if (ok) NotifyInfo("TDatasetSnapshot::Save: saved %d rows to \"%s\".\n", dataset.nRows, fileName.CStr());
+	else { remove(tmpFileName.CStr()); NotifyInfo("TDatasetSnapshot::Save: error saving \"%s\".\n", fileName.CStr()); }
+}
+
 //-----------------------------------------------------------------------------
 //
 // TCentroidComponent
@@ -1420,6 +4262,7 @@ double TDataset::CentrDist2(const TCentroidComponentV& centroid1, const TCentroi
 void TCentroidComponent::Add(const TDataColumn &col, const int rowNo, double coef)
 {
 	if (col.type == TAttrType::Categorical) {
+		denseVec2 = -1; denseVec2Valid = false;
 		int keyId = col.intVals[rowNo];
 		denseVec[keyId] += coef; }
 	else if (col.type == TAttrType::Numeric) {
@@ -1445,6 +4288,7 @@ void TCentroidComponent::Add(const TDataColumn &col, const int rowNo, double coe
 void TCentroidComponent::Add(const TDataColumn &col, const TCentroidComponent& other, double coef)
 {
 	if (col.type == TAttrType::Categorical) {
+		denseVec2 = -1; denseVec2Valid = false;
 		const int n = denseVec.Len(); IAssert(n == other.denseVec.Len());
 		for (int i = 0; i < n; ++i) denseVec[i].Val += coef * other.denseVec[i].Val; }
 	else if (col.type == TAttrType::Numeric) {
@@ -1474,6 +4318,7 @@ void TCentroidComponent::MulBy(double coef)
 	for (auto keyId = sparseVec.FFirstKeyId(); sparseVec.FNextKeyId(keyId); ) 
 		sparseVec[keyId].Val *= coef; 
 	if (sparseVec2Valid) sparseVec2 *= coef * coef;
+	if (denseVec2Valid) denseVec2 *= coef * coef;
 }
 
 double TCentroidComponent::GetSparseVec2() const
@@ -1486,6 +4331,15 @@ double TCentroidComponent::GetSparseVec2() const
 	return sparseVec2;
 }
 
+double TCentroidComponent::GetDenseVec2() const
+{
+	if (! denseVec2Valid) {
+		denseVec2 = 0; 
+		for (const TFlt& x : denseVec) denseVec2 += x.Val * x.Val;
+		denseVec2Valid = true; }
+	return denseVec2;
+}
+
 bool TCentroidComponent::InitFromJson(const TDataset& dataset, int& colNo, const PJsonVal& jsonVal, TStrV& errList)
 {
 	TStr whereForErrorMsg = "a centroid component";
@@ -1517,6 +4371,7 @@ bool TCentroidComponent::InitFromJson(const TDataset& dataset, int& colNo, const
 				denseVec[keyId] = val; }
 			else IAssert(false);
 		}
+		denseVec2Valid = false;
 	}
 	else if (col.type == TAttrType::Time)
 	{
@@ -1643,13 +4498,12 @@ void THistogram::Init(const TDataColumn& col, int nBuckets_, const TIntV& rowNos
 		{
 			dowFreqs.Gen(7); monthFreqs.Gen(12); hourFreqs.Gen(24);
 			dowFreqs.PutAll(0); monthFreqs.PutAll(0); hourFreqs.PutAll(0); 
+			const TCalendarCodes &cal = col.calendar; IAssert(cal.Len() == col.timeVals.Len());
 			for (const int rowNo : rowNos)
 			{
-				const TTimeStamp &ts = col.timeVals[rowNo];
-				TSecTm secTm(ts.type == TTimeType::Flt ? uint(floor(ts.flt)) : ts.sec);
-				dowFreqs[secTm.GetDayOfWeekN() - 1].Val += 1;
-				monthFreqs[secTm.GetMonthN() - 1].Val += 1;
-				hourFreqs[secTm.GetHourN()].Val += 1; ++freqSum;
+				dowFreqs[cal.dayOfWeek[rowNo]].Val += 1;
+				monthFreqs[cal.month[rowNo]].Val += 1;
+				hourFreqs[cal.hour[rowNo]].Val += 1; ++freqSum;
 			}
 		}
 	}
@@ -1786,8 +4640,8 @@ void TState::CalcLabel(const TDataset& dataset, int thisStateNo, const THistogra
 			for (int bucketNo = 0; bucketNo < hist.nBuckets; ++bucketNo)
 				if (bestLabel.SetIfBetter(hist.freqs[bucketNo], nStateMembers, totalHist.freqs[bucketNo], nAllInstances, eps, hist.freqs.Len())) {
 					bestLabel.label = col.userFriendlyLabel + " = "; 
-					if (col.subType == TAttrSubtype::String) bestLabel.label += col.strKeyMap[bucketNo];
-					else if (col.subType == TAttrSubtype::Int) bestLabel.label += TInt::GetStr(col.intKeyMap[bucketNo]);
+					if (col.subType == TAttrSubtype::String) bestLabel.label += col.strKeyMap.GetKey(bucketNo);
+					else if (col.subType == TAttrSubtype::Int) bestLabel.label += TInt::GetStr(col.intKeyMap.GetKey(bucketNo));
 					else IAssert(false); } 
 		}
 		else if (col.type == TAttrType::Time && col.timeType == TTimeType::Time)
@@ -1894,12 +4748,15 @@ void TModel::CalcTransMx(TFltV& statProbs, TFltVV& transMx) const
 {
 	const int n = initialStates.Len(), nRows = dataset->nRows; statProbs.Gen(n); statProbs.PutAll(0); 
 	transMx.Gen(n, n); transMx.PutAll(0);
-	for (int i = 0; i < nRows; ++i) {
-		int si = rowToInitialState[i];
-		statProbs[si].Val += 1;
-		if (i + 1 < nRows) { 
-			int sj = rowToInitialState[i + 1];
-			transMx(si, sj).Val += 1; } }
+	// There are no transitions from the last row of a series to the first row of the next one.
+	for (int seriesNo = 0; seriesNo < dataset->GetNumSeries(); ++seriesNo) {
+		const int endRowNo = dataset->GetSeriesEnd(seriesNo);
+		for (int i = dataset->GetSeriesStart(seriesNo); i < endRowNo; ++i) {
+			int si = rowToInitialState[i];
+			statProbs[si].Val += 1;
+			if (i + 1 < endRowNo) { 
+				int sj = rowToInitialState[i + 1];
+				transMx(si, sj).Val += 1; } } }
 	for (int i = 0; i < n; ++i) {
 		if (nRows > 0) statProbs[i].Val /= double(nRows);
 		double total = 0; for (int j = 0; j < n; ++j) total += transMx(i, j);
@@ -2180,65 +5037,24 @@ bool TModel::ClassifyInstances(const TDataset& otherDataset, const TIntV& rowNos
 			if (ourCol.subType != otherCol.subType) { errList.Add("The subType of the categorical attribute \"" + ourCol.name + "\" in the target dataset is different than in the model."); hasErrors = true; continue; } }
 	}
 	if (hasErrors) return false;
-	// Classify all the target rows listed in 'rowNos'.
+	// Classify all the target rows listed in 'rowNos', using their feature vectors in the layout of our dataset.
 	const int nTargets = rowNos.Len(); predictions.Gen(nTargets); predictions.PutAll(-1);
 	const int nInitialStates = initialStates.Len(); 
+	TFeatureMatrix features; features.Init(*dataset, otherDataset, ourColToOtherCol, rowNos);
+	TFeatureMatrix centroids; centroids.InitCentroids(*dataset, initialStates, &features); std::vector<double> dists(nInitialStates);
 	for (int targetNo = 0; targetNo < nTargets; ++targetNo)
 	{
 		const int rowNo = rowNos[targetNo];
+		features.Dist2ToCentroids(targetNo, centroids, dists.data());
 		int bestStateNo = -1; double bestDist = -1;
-		for (int stateNo = 0; stateNo < initialStates.Len(); ++stateNo)
+		for (int stateNo = 0; stateNo < nInitialStates; ++stateNo)
 		{
-			const TCentroidComponentV &centroid = initialStates[stateNo]->centroid;
-			double dist = 0;
-			for (int colNo = 0; colNo < nCols; ++colNo)
-			{
-				const TDataColumn &ourCol = dataset->cols[colNo];
-				int otherColNo = ourColToOtherCol[colNo];
-				if (ourCol.distWeight == 0 || otherColNo < 0) continue;
-				const TDataColumn &otherCol = otherDataset.cols[otherColNo];
-				const TCentroidComponent &comp = centroid[colNo];
-				//
-				double delta2 = 0;
-				if (otherCol.type == TAttrType::Numeric) {
-					if (otherCol.subType == TAttrSubtype::Flt) delta2 = otherCol.fltVals[rowNo] - comp.fltVal;
-					else if (otherCol.subType == TAttrSubtype::Int) delta2 = double(otherCol.intVals[rowNo]) - comp.fltVal;
-					else Assert(false); 
-					delta2 *= delta2; }
-				else if (otherCol.type == TAttrType::Categorical) {
-					// The keyId in otherCol.intVals refers to otherCol.{str|int}KeyMap.  Get the corresponding
-					// key and then look it up in ourCol.{str|int}KeyMap.
-					int otherKeyId = otherCol.intVals[rowNo], otherKeyIdMappedToOur = -1;
-					if (otherCol.subType == TAttrSubtype::String) otherKeyIdMappedToOur = ourCol.strKeyMap.GetKeyId(otherCol.strKeyMap.GetKey(otherKeyId));
-					else if (otherCol.subType == TAttrSubtype::Int) otherKeyIdMappedToOur = ourCol.intKeyMap.GetKeyId(otherCol.intKeyMap.GetKey(otherKeyId));
-					else IAssert(false); 
-					for (int keyId = 0; keyId < comp.denseVec.Len(); ++keyId) {
-						double d = (otherKeyIdMappedToOur == keyId ? 1 : 0) - comp.denseVec[keyId];
-						delta2 += d * d; } }
-				else if (otherCol.type == TAttrType::Text) {
-					// Map the feature IDs in 'otherCol.sparseVecData' to our feature IDs.
-					// ToDo: doing this once per state is inefficient, we could save the results somewhere.
-					const auto &V = otherCol.sparseVecData;
-					const auto &pr1 = otherCol.sparseVecIndex[rowNo]; const auto *from1 = V.begin() + pr1.Val1; const auto *to1 = from1 + pr1.Val2;
-					TIntFltKdV VM; VM.Reserve(pr1.Val2);
-					for (const auto *from1 = &V[pr1.Val1], *to1 = from1 + pr1.Val2; from1 < to1; ++from1) {
-						int otherKey = from1->Key; double dat = from1->Dat;
-						int otherKeyMappedToOur = otherKey; // ToDo: implement mapping here once we have better support for text attributes.
-						if (otherKeyMappedToOur < 0) continue;
-						VM.Add({otherKeyMappedToOur, dat}); }
-					VM.Sort();
-					//
-					double sum11 = 0, sum12 = 0, sum22 = comp.GetSparseVec2();
-					for (int i = 0; i < VM.Len(); ++i) {
-						auto key1 = VM[i].Key; auto dat1 = VM[i].Dat;
-						auto keyId2 = comp.sparseVec.GetKeyId(key1);
-						double dat2 = (keyId2 < 0) ? 0.0 : comp.sparseVec[keyId2].Val;
-						sum11 += dat1 * dat1; sum12 = dat1 * dat2; }
-					// sum_i (x_i - y_i)^2 = sum_i x_i^2 + sum_i y_i^2 - 2 sum_i x_i y_i
-					delta2 = sum11 + sum22 - sum12 - sum12; }
-				else Assert(false);
-				dist += ourCol.distWeight * delta2;
-			}
+			double dist = dists[stateNo] + features.CatDist2(targetNo, initialStates[stateNo]->centroid);
+			for (int colNo : features.textCols) {
+				// ToDo: map the feature IDs in 'otherCol.sparseVecData' to our feature IDs once we have better support for text attributes;
+				// for now they are assumed to be the same.
+				const TDataColumn &otherCol = otherDataset.cols[ourColToOtherCol[colNo]];
+				dist += dataset->cols[colNo].distWeight * TextDist2(otherCol, rowNo, initialStates[stateNo]->centroid[colNo]); }
 			if (bestStateNo < 0 || dist < bestDist) bestStateNo = stateNo, bestDist = dist;
 		}
 		predictions[targetNo] = bestStateNo;
@@ -2269,7 +5085,8 @@ void TKMeansRunner::SelectInitialCentroids(TIntV& dest)
 		double score = 0; for (int i = 0; i < nStates; ++i) {
 			bool first = true; double nNeigh = -1;
 			for (int j = 0; j < nStates; ++j) if (j != i) {
-				double dist = dataset.RowDist2(centroids[i], centroids[j]);
+				double dist = features.Dist2(centroids[i], centroids[j]) + features.CatDist2(centroids[i], centroids[j]);
+				if (! features.textCols.Empty()) dist += TextRowDist2(dataset, features.textCols, centroids[i], centroids[j]);
 				if (first || dist < nNeigh) first = false, nNeigh = dist; }
 			score += nNeigh; }
 		if (nTries == 0 || score > bestScore) bestScore = score, dest = centroids;
@@ -2278,6 +5095,8 @@ void TKMeansRunner::SelectInitialCentroids(TIntV& dest)
 
 void TKMeansRunner::Go()
 {
+	// All the distances below are computed on the feature matrix, plus the text attributes, if any.
+	features.Init(dataset); const bool hasText = ! features.textCols.Empty(), hasCat = ! features.catCols.Empty();
 	// Prepare the initial states with a random selection of centroids.
 	TIntV initialCentroids; SelectInitialCentroids(initialCentroids);
 	states.Gen(nStates); // distances.Gen(nRows, nStates);
@@ -2289,7 +5108,9 @@ void TKMeansRunner::Go()
 	for (int rowNo = 0; rowNo < nRows; ++rowNo) {
 		int bestState = -1; double bestDist = -1;
 		for (int stateNo = 0; stateNo < nStates; ++stateNo) {
-			double dist = dataset.RowDist2(rowNo, initialCentroids[stateNo]);
+			double dist = features.Dist2(rowNo, initialCentroids[stateNo]);
+			if (hasCat) dist += features.CatDist2(rowNo, initialCentroids[stateNo]);
+			if (hasText) dist += TextRowDist2(dataset, features.textCols, rowNo, initialCentroids[stateNo]);
 			if (bestState < 0 || dist < bestDist || rowNo == initialCentroids[stateNo]) {
 				bestState = stateNo, bestDist = dist;
 				// Make sure that if some row has been selected as the initial centroid of a state, it actually gets assigned to this state.  
@@ -2307,10 +5128,14 @@ void TKMeansRunner::Go()
 	{
 		double newQuality = 0; TIntV newMemberships(nRows); newMemberships.PutAll(-1);
 		// For each row, determine the nearest centroid.
+		TFeatureMatrix centroids; centroids.InitCentroids(dataset, states, &features); std::vector<double> dists(nStates);
 		for (int rowNo = 0; rowNo < nRows; ++rowNo) {
+			features.Dist2ToCentroids(rowNo, centroids, dists.data());
 			int bestState = -1; double bestDist = -1;
 			for (int stateNo = 0; stateNo < nStates; ++stateNo) {
-				double dist = dataset.RowCentrDist2(rowNo, states[stateNo]->centroid);
+				double dist = dists[stateNo];
+				if (hasCat) dist += features.CatDist2(rowNo, states[stateNo]->centroid);
+				if (hasText) dist += TextRowCentrDist2(dataset, features.textCols, rowNo, states[stateNo]->centroid);
 				if (bestState < 0 || dist < bestDist) bestState = stateNo, bestDist = dist; }
 			newQuality += sqrt(bestDist); newMemberships[rowNo] = bestState; }
 		// Clear the old membership and centroid info.
@@ -2596,11 +5421,14 @@ PStatePartition TStateAggregator::BuildInitialPartition()
 void TStateAggregator::CalcInitStateDist()
 {
 	initStateDist.Gen(nInitialStates, nInitialStates); 
+	TFeatureMatrix centroids; centroids.InitCentroids(dataset, model.initialStates);
 	for (int i = 0; i < nInitialStates; ++i)
 	{
 		for (int j = 0; j <= i; ++j)
 		{
-			double d = (i == j) ? 0.0 : dataset.CentrDist2(model.initialStates[i], model.initialStates[j]);
+			double d = (i == j) ? 0.0 : centroids.Dist2(i, j);
+			if (i != j && ! centroids.textCols.Empty()) d += TextCentrDist2(dataset, centroids.textCols, model.initialStates[i]->centroid, model.initialStates[j]->centroid);
+			if (i != j && ! centroids.catCols.Empty()) d += CatCentrDist2(dataset, centroids.catCols, model.initialStates[i]->centroid, model.initialStates[j]->centroid);
 			if (d <= 0) d = 0; else d = sqrt(d);
 			initStateDist(i, j) = d; initStateDist(j, i) = d;
 		}
@@ -2916,11 +5744,10 @@ void TDecTreeNode::SelectBestSplit(const TDataset& dataset, const TIntV& posList
 			if (col.timeType != TTimeType::Time) continue;
 			TIntPrV hourCounts(24), dowCounts(7), monthCounts(12);
 			hourCounts.PutAll({0, 0}); dowCounts.PutAll({0, 0}); monthCounts.PutAll({0, 0});
+			const TCalendarCodes &cal = col.calendar; IAssert(cal.Len() == col.timeVals.Len());
 			for (int pass = 1; pass <= 2; ++pass) for (int rowNo : (pass == 1 ? posList : negList))
 			{
-				const TTimeStamp &ts = col.timeVals[rowNo]; IAssert(ts.type == TTimeType::Time);
-				TSecTm secTm(ts.sec);
-				auto &hc = hourCounts[secTm.GetHourN()], &dc = dowCounts[secTm.GetDayOfWeekN() - 1], &mc = monthCounts[secTm.GetMonthN() - 1];
+				auto &hc = hourCounts[cal.hour[rowNo]], &dc = dowCounts[cal.dayOfWeek[rowNo]], &mc = monthCounts[cal.month[rowNo]];
 				if (pass == 1) hc.Val1 += 1, dc.Val1 += 1, mc.Val1 += 1; else hc.Val2 += 1, dc.Val2 += 1, mc.Val2 += 1;
 			}
 			double normInfGain; int th1, th2;
@@ -2982,12 +5809,11 @@ void TDecTreeNode::BuildSubtree(const TDataset& dataset, const TIntV& posList, c
 		else if (col.type == TAttrType::Time) 
 		{
 			IAssert(col.timeType == TTimeType::Time);
-			const TTimeStamp &ts = col.timeVals[rowNo]; IAssert(ts.type == TTimeType::Time);
-			TSecTm secTm(ts.sec);
+			const TCalendarCodes &cal = col.calendar; IAssert(cal.Len() == col.timeVals.Len());
 			int value = -1;
-			if (timeUnit == TDecTreeTimeUnit::Hour) value = secTm.GetHourN();
-			else if (timeUnit == TDecTreeTimeUnit::DayOfWeek) value = secTm.GetDayOfWeekN() - 1;
-			else if (timeUnit == TDecTreeTimeUnit::Month) value = secTm.GetMonthN() - 1;
+			if (timeUnit == TDecTreeTimeUnit::Hour) value = cal.hour[rowNo];
+			else if (timeUnit == TDecTreeTimeUnit::DayOfWeek) value = cal.dayOfWeek[rowNo];
+			else if (timeUnit == TDecTreeTimeUnit::Month) value = cal.month[rowNo];
 			else IAssert(false);
 			if (intThresh < intThresh2) childNo = (intThresh <= value && value < intThresh2) ? 0 : 1;
 			else childNo = (intThresh <= value || value < intThresh2) ? 0 : 1;
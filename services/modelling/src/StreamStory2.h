@@ -78,17 +78,29 @@ public:
 };
 
 enum class TOpType { LinMap, LinTo01, SetMeanAndStd, Standardize, SubtractMean, RestrictRange };
-enum class TTimeWindowOp { Shift, Delta, LinTrend };
+enum class TTimeWindowOp { Shift, Delta, LinTrend, Mean, Std, Min, Max, Count };
 enum class TTimeWindowType { Time, TimeNumeric, Samples };
 enum class TResampleType { SetTimeStep, SetNumSamples };
+enum class TResampleAggregation { Interpolate, Mean, Min, Max };
 enum class TTimeCategoricalUnit { Sec, Min, Hour, DayOfWeek, Month };
+enum class TDuplicateTimes { Keep, First, Last, Mean };
+enum class TPrecision { Float64, Float32 };
 
+class TColStats;
+
+// A number given either directly (type = Flt) or as a statistic of the values of an attribute.
 class TFltEx
 {
 public:
 	typedef enum { Flt, Min, Max, Avg, Std } Type;
 	Type type;
 	TFlt value;
+	TFltEx() : type(Flt), value(0) { }
+	TFltEx(double value_) : type(Flt), value(value_) { }
+	double Eval(const TColStats& stats) const;
+	// The JSON value can be a number or one of the strings "min", "max", "avg" (or "mean") and "std".
+	bool InitFromJson(const PJsonVal& jsonVal, const char *key, bool allowMissing, double defaultValue, const TStr& whereForErrorMsg, TStrV& errList);
+	PJsonVal SaveToJson() const;
 };
 
 class TOpDesc;
@@ -110,6 +122,11 @@ public:
 	virtual bool InitFromJson(const PJsonVal& jsonVal, TStrV& errList) { return true; }
 	virtual bool AddAttrsFromOps(TModelConfig& config, TStrV& errors) { return true; }
 	virtual bool Apply(TDataset& dataset, TStrV& errors) { return true; }
+	// Lists the attributes that Apply reads and writes; TDataset::ApplyOps uses this to apply independent ops concurrently.
+	// Returns false if the op may read or write any attribute (e.g. because it changes the number of rows).
+	virtual bool GetAttrDeps(TStrV& inAttrs, TStrV& outAttrs) const { return false; }
+	// Lists the attributes whose statistics (see TColStats) Apply needs; TDataset::ApplyOps computes them in advance.
+	virtual void GetStatsAttrs(TStrV& attrs) const { }
 	static POpDesc New(const PJsonVal& jsonVal, TStrV& errList);
 	static inline const TStr& WhereForErrMsg() { static const TStr s = "an op description"; return s; }
 	virtual PJsonVal SaveToJson() const { return {}; }
@@ -126,30 +143,72 @@ public:
 		if (! Json_GetObjStr(jsonVal, "inAttr", false, {}, inAttrName, WhereForErrMsg(), errList)) return false;
 		if (! Json_GetObjStr(jsonVal, "outAttr", true, inAttrName, outAttrName, WhereForErrMsg(), errList)) return false;
 		return true; }
+	bool GetAttrDeps(TStrV& inAttrs, TStrV& outAttrs) const override { inAttrs.Add(inAttrName); outAttrs.Add(outAttrName); return true; }
+protected:
+	PJsonVal SaveAttrsToJson(const TStr& opStr) const { 
+		PJsonVal jsonVal = TJsonVal::NewObj(); jsonVal->AddToObj("op", opStr); jsonVal->AddToObj("inAttr", inAttrName);
+		if (outAttrName != inAttrName) jsonVal->AddToObj("outAttr", outAttrName); 
+		return jsonVal; }
 };
 
+// Maps a time attribute (with timeType = Time) to a categorical attribute: the second, minute, hour, day of week or month.
 class TOpDesc_TimeCategorical : public TOpDesc_SingleAttrMap
 {
 public:
 	TTimeCategoricalUnit unit;
+	bool InitFromJson(const PJsonVal& jsonVal, TStrV& errList) override;
+	bool AddAttrsFromOps(TModelConfig& config, TStrV& errors) override;
+	bool Apply(TDataset& dataset, TStrV& errors) override;
+	PJsonVal SaveToJson() const override;
+};
+
+// The base class of the ops that map each value x of a numeric attribute to min(max(a * x + b, lo), hi),
+// where a, b, lo and hi may depend on the statistics of the input attribute.
+class TOpDesc_NumericAttrMap : public TOpDesc_SingleAttrMap
+{
+public:
+	bool AddAttrsFromOps(TModelConfig& config, TStrV& errors) override;
+	bool Apply(TDataset& dataset, TStrV& errors) override;
+	void GetStatsAttrs(TStrV& attrs) const override { if (NeedsStats()) attrs.Add(inAttrName); }
+protected:
+	virtual bool NeedsStats() const = 0;
+	virtual bool GetMap(const TColStats& stats, double& a, double& b, double& lo, double& hi, TStrV& errors) const = 0;
 };
 
-class TOpDesc_AttrLinMap : public TOpDesc_SingleAttrMap
+// Maps x1 to y1 and x2 to y2.
+class TOpDesc_AttrLinMap : public TOpDesc_NumericAttrMap
 {
 public:
 	TFltEx x1, y1, x2, y2; 
+	bool InitFromJson(const PJsonVal& jsonVal, TStrV& errList) override;
+	PJsonVal SaveToJson() const override;
+protected:
+	bool NeedsStats() const override { return x1.type != TFltEx::Flt || y1.type != TFltEx::Flt || x2.type != TFltEx::Flt || y2.type != TFltEx::Flt; }
+	bool GetMap(const TColStats& stats, double& a, double& b, double& lo, double& hi, TStrV& errors) const override;
 };
 
-class TOpDesc_AttrStdMap : public TOpDesc_SingleAttrMap
+// Shifts and scales the values so that their mean and standard deviation become newMean and newStd.
+class TOpDesc_AttrStdMap : public TOpDesc_NumericAttrMap
 {
 public:
 	TFltEx newMean, newStd; 
+	bool InitFromJson(const PJsonVal& jsonVal, TStrV& errList) override;
+	PJsonVal SaveToJson() const override;
+protected:
+	bool NeedsStats() const override { return true; }
+	bool GetMap(const TColStats& stats, double& a, double& b, double& lo, double& hi, TStrV& errors) const override;
 };
 
-class TOpDesc_AttrRestrictRange : public TOpDesc_SingleAttrMap
+// Clips the values to the range [newMin, newMax].
+class TOpDesc_AttrRestrictRange : public TOpDesc_NumericAttrMap
 {
 public:
 	TFltEx newMin, newMax; 
+	bool InitFromJson(const PJsonVal& jsonVal, TStrV& errList) override;
+	PJsonVal SaveToJson() const override;
+protected:
+	bool NeedsStats() const override { return newMin.type != TFltEx::Flt || newMax.type != TFltEx::Flt; }
+	bool GetMap(const TColStats& stats, double& a, double& b, double& lo, double& hi, TStrV& errors) const override;
 };
 
 class TOpDesc_TimeWindow : public TOpDesc
@@ -166,13 +225,33 @@ public:
 	bool AddAttrsFromOps(TModelConfig& config, TStrV& errors) override;
 	bool Apply(TDataset& dataset, TStrV& errors) override;
 	PJsonVal SaveToJson() const override;
+	bool GetAttrDeps(TStrV& inAttrs, TStrV& outAttrs) const override;
+	// Returns true if this op can be applied in the same pass as 'prev', which comes before it in 'config.ops':
+	// they must have the same time attribute and window, and this op must not overwrite the input or output of 'prev'.
+	bool CanSharePassWith(const TOpDesc_TimeWindow& prev) const;
+	// Applies 'ops', which must be pairwise compatible in the sense of CanSharePassWith, in a single pass over the rows.
+	// If the dataset consists of several series, the windows don't cross their boundaries, and the series are processed 
+	// in parallel using up to 'nThreads' threads.
+	static bool ApplyAll(TDataset& dataset, const TVec<TOpDesc_TimeWindow *>& ops, int nThreads, TStrV& errors);
 };
 
+// Replaces all the rows of the dataset with rows at regular intervals of 'timeAttr', starting with its first value.
+// The rows must be sorted by 'timeAttr'.  Numeric attributes are interpolated linearly at the new times or, with 
+// a Mean/Min/Max aggregation, aggregated over the rows from each new time up to the next one; other attributes
+// take the last value at or before the new time (or, with an aggregation, the last value before the next one).
 class TOpDesc_Resample : public TOpDesc
 {
+public:
+	TStr timeAttr; // default: use the first attribute whose type is 'time'
 	TResampleType resampleType;
-	TTimeStamp timeStep;
-	int numSamples; // = -1 to keep the existing number of samples
+	TTimeStamp timeStep; // for SetTimeStep; a number of seconds if the time attribute's timeType is Time, a number on its own scale otherwise
+	bool numericStep; // true if timeStep was given with timeUnit = "numeric"
+	int numSamples; // for SetNumSamples
+	TResampleAggregation aggregation;
+	bool InitFromJson(const PJsonVal& jsonVal, TStrV& errList) override;
+	bool AddAttrsFromOps(TModelConfig& config, TStrV& errors) override;
+	bool Apply(TDataset& dataset, TStrV& errors) override;
+	PJsonVal SaveToJson() const override;
 };
 
 /*
@@ -208,15 +287,23 @@ public:
 	int numInitialStates;
 	int numHistogramBuckets;
 	double distWeightOutliers;
+	int distWeightSampleThreshold; // 0 = always use all the values
 	bool ignoreConversionErrors;
+	int numThreads; // 0 = one per hardware thread
+	TStr seriesAttr; // if not empty: a categorical input attribute that identifies the series (e.g. a machine) to which each row belongs
+	bool sortByTime; // sort the rows by the first time attribute after reading them
+	TDuplicateTimes duplicateTimes; // what to do with rows that have the same time (and series) as the previous one; anything but Keep implies sorting
+	TPrecision precision; // of the feature vectors (TFeatureMatrix) used for clustering and classification; distances are always accumulated in double
 	bool includeHistograms, includeStateHistory, includeDecisionTrees;
 	TDecTreeConfig decTreeConfig;
-	void Clr() { ClrAll(attrs, ops); numInitialStates = -1; numHistogramBuckets = -1; decTreeConfig.Clr(); ignoreConversionErrors = true; distWeightOutliers = 0.05; includeHistograms = true; includeStateHistory = true; includeDecisionTrees = true; }
+	void Clr() { ClrAll(attrs, ops); numInitialStates = -1; numHistogramBuckets = -1; decTreeConfig.Clr(); ignoreConversionErrors = true; numThreads = 0; seriesAttr = ""; sortByTime = false; duplicateTimes = TDuplicateTimes::Keep; precision = TPrecision::Float64; distWeightOutliers = 0.05; distWeightSampleThreshold = 0; includeHistograms = true; includeStateHistory = true; includeDecisionTrees = true; }
 	bool InitFromJson(const PJsonVal& val, TStrV& errors);
 	PJsonVal SaveToJson() const;
 	int GetAttrIdx(const TStr& name) const { for (int i = 0; i < attrs.Len(); ++i) if (attrs[i].name == name) return i; return -1; }
 	bool HasAttr(const TStr& name) const { return GetAttrIdx(name) >= 0; }
 	TStr SuggestUniqueAttrName(const TStr &baseName) const;
+	// Returns true if TDataset::SortRows may reorder (or merge) the rows after reading them.
+	bool SortsRows() const { return ! seriesAttr.Empty() || sortByTime || duplicateTimes != TDuplicateTimes::Keep; }
 protected:
 	bool AddAttrsFromOps(TStrV& errors);
 };
@@ -224,6 +311,17 @@ protected:
 class TDataColumn;
 typedef TVec<TDataColumn> TDataColumnV;
 
+// Calendar fields of the values of a time column (with timeType = Time), computed once by TDataset::CalcCalendarCodes
+// so that the histograms, decision trees and timeCategorical ops don't have to convert each timestamp again.
+class TCalendarCodes
+{
+public:
+	TVec<uint8_t> hour, dayOfWeek, month; // 0..23; 0..6, where 0 = Sunday; 0..11, where 0 = January
+	void Clr() { ClrAll(hour, dayOfWeek, month); }
+	int Len() const { return hour.Len(); }
+	void Calc(const TTimeStampV& timeVals);
+};
+
 class TDataColumn
 {
 public:
@@ -255,7 +353,8 @@ public:
 	TIntFltKdV sparseVecData;  // type = text;  for each row, the keydats must be sorted by key
 	TIntPrV sparseVecIndex;    // (firstValue, nValues) pairs
 	TTimeStampV timeVals;      // type = time, any subtype and timetype
-	void ClrVals() { ClrAll(fltVals, intVals, intKeyMap, strKeyMap, sparseVecData, sparseVecIndex); }
+	TCalendarCodes calendar;   // type = time, timetype = time
+	void ClrVals() { ClrAll(fltVals, intVals, intKeyMap, strKeyMap, sparseVecData, sparseVecIndex, calendar); }
 	void Gen(int nRows) {  
 		ClrVals();
 		if (type == TAttrType::Numeric && subType == TAttrSubtype::Flt) fltVals.Gen(nRows);
@@ -265,11 +364,31 @@ public:
 		else IAssert(false);
 		// ToDO: more?
 	}
-	double GetDefaultDistWeight(double propOutliersToIgnore) const;
+	double GetDefaultDistWeight(double propOutliersToIgnore, int sampleThreshold, TStr& details) const;
+	// For categorical attributes: appends the keyId of 'key' to 'intVals' and increments the key's count
+	// in strKeyMap/intKeyMap, adding the key there if necessary.
+	void AddCatVal(const char *key) { 
+		int keyId = strKeyMap.GetKeyId(key);
+		if (! IsValidId(keyId)) { keyId = strKeyMap.AddKey(key); strKeyMap[keyId] = 1; } else ++strKeyMap[keyId].Val;
+		intVals.Add(keyId); }
+	void AddCatVal(int key) { 
+		int keyId = intKeyMap.GetKeyId(key);
+		if (! IsValidId(keyId)) { keyId = intKeyMap.AddKey(key); intKeyMap[keyId] = 1; } else ++intKeyMap[keyId].Val;
+		intVals.Add(keyId); }
 	template<typename T>
 	void PutNumVal(int rowNo, T value) { Assert(type == TAttrType::Numeric); if (subType == TAttrSubtype::Flt) fltVals[rowNo] = value; else if (subType == TAttrSubtype::Int) intVals[rowNo] = value; else Assert(false); }
 };
 
+// Statistics of the values of a numeric column.
+class TColStats
+{
+public:
+	bool valid = false;
+	double min = 0, max = 0, avg = 0, std = 0; // 'std' is the population standard deviation
+	// Computes all the statistics in a single pass over the values of 'col'.
+	void Calc(const TDataColumn& col);
+};
+
 class TCentroidComponent;
 typedef TVec<TCentroidComponent> TCentroidComponentV;
 
@@ -282,14 +401,22 @@ public:
 protected:
 	// 'sparseVec2' gets invalidated when 'Add' modifies 'sparseVec'.  Theoretically Add could
 	// update 'sparseVec2' suitably but it should be cheaper to just recalculate 'sparseVec2' from
-	// scratch once we're doine adding row vectors to the centroid.
-	mutable double sparseVec2; // sum of squares of 'sparseVec'
-	mutable bool sparseVec2Valid;
+	// scratch once we're doine adding row vectors to the centroid.  The same goes for 'denseVec2'.
+	mutable double sparseVec2 = 0; // sum of squares of 'sparseVec'
+	mutable bool sparseVec2Valid = false;
+	mutable double denseVec2 = 0; // sum of squares of 'denseVec'
+	mutable bool denseVec2Valid = false;
 public:
 	double GetSparseVec2() const;
+	double GetDenseVec2() const;
+	// Returns the squared distance between this (categorical) component and the one-hot vector of 'keyId',
+	// i.e. ||e_k - c||^2 = 1 - 2 c_k + ||c||^2, in O(1) time.  If keyId < 0 (an unknown key), the one-hot vector is 0.
+	double GetOneHotDist2(int keyId) const { 
+		const double norm2 = GetDenseVec2(); 
+		return (keyId >= 0 && keyId < denseVec.Len()) ? norm2 + 1 - 2 * denseVec[keyId].Val : norm2; }
 	void Clr(const TDataColumn &col) {
 		fltVal = 0; sparseVec.Clr();
-		sparseVec2 = 0; sparseVec2Valid = true;
+		sparseVec2 = 0; sparseVec2Valid = true; denseVec2 = 0; denseVec2Valid = true;
 		if (col.type == TAttrType::Categorical) { 
 			if (col.subType == TAttrSubtype::Int) denseVec.Gen(col.intKeyMap.Len());
 			else if (col.subType == TAttrSubtype::String) denseVec.Gen(col.strKeyMap.Len());
@@ -479,12 +606,56 @@ public:
 	int maxErrorsToReport = 30;
 	int nErrorsReported = 0, nErrorsSuppressed = 0;
 	int nRowsIgnored = 0;
+	int nRowsFiltered = 0; // rows dropped by TRowFilter
+	bool pastFilterEnd = false; // set after a row beyond the end of a sorted filter's time range; the rest of the data can be skipped
 	TConversionProgress(TStrV& errors_, bool ignoreErrors_) : errors(errors_), ignoreErrors(ignoreErrors_) { }
 };
 
-class TDataset;
+// The conditions from "dataSource.filter" that a row of the input data must satisfy to be added 
+// to the dataset: a time range [from, to) on a time attribute and comparisons of attribute values 
+// with constants.  The readers convert the attributes that have conditions on them first and 
+// drop a row as soon as one of its values fails a condition, without converting the rest.
+// If 'sorted' is set, the rows are promised to be in ascending order of 'timeCol', so the readers 
+// may stop at the first row after the time range, and CSV data is binary-searched for its start.
+class TRowFilter
+{
+public:
+	enum class TOp { Eq, Ne, Lt, Le, Gt, Ge };
+	class TCond { public: TOp op; double num; TStr str; }; // 'str' is used for categorical attributes with string keys, 'num' otherwise
+	typedef TVec<TCond> TCondV;
+protected:
+	TVec<TCondV> colConds; // index: the column index from 'dataset.cols'
+	template<typename T> static bool Compare(TOp op, const T& x, const T& y) {
+		switch (op) { 
+			case TOp::Eq: return x == y; case TOp::Ne: return ! (x == y); case TOp::Lt: return x < y; 
+			case TOp::Le: return ! (y < x); case TOp::Gt: return y < x; case TOp::Ge: return ! (x < y); 
+			default: Assert(false); return false; } }
+	static bool ParseOp(const TStr& s, TOp& op);
+	bool AddCond(const TDataset& dataset, int colNo, TOp op, const PJsonVal& vValue, const TStr& where, TStrV& errList);
+public:
+	int timeCol = -1; // -1 if there is no time range
+	double timeFrom = -std::numeric_limits<double>::infinity(), timeTo = std::numeric_limits<double>::infinity(); // as returned by TTimeStamp::GetFlt
+	bool sorted = false;
+	void Clr() { colConds.Clr(); timeCol = -1; timeFrom = -std::numeric_limits<double>::infinity(); timeTo = std::numeric_limits<double>::infinity(); sorted = false; }
+	bool Empty() const { return colConds.Empty(); }
+	bool InitFromJson(const TDataset& dataset, const PJsonVal& jsonVal, TStrV& errList);
+	bool HasConds(int colNo) const { return 0 <= colNo && colNo < colConds.Len() && ! colConds[colNo].Empty(); }
+	// Returns true if the value 'x' of column 'colNo' (its number, integer key, or TTimeStamp::GetFlt()) satisfies the conditions on it.
+	bool Accepts(int colNo, double x) const { for (const TCond& cond : colConds[colNo]) if (! Compare(cond.op, x, cond.num)) return false; return true; }
+	// Like the above, for a categorical value with a string key.
+	bool Accepts(int colNo, const char *s, int len) const { 
+		for (const TCond& cond : colConds[colNo]) if ((cond.str.Len() == len && memcmp(cond.str.CStr(), s, len) == 0) != (cond.op == TOp::Eq)) return false; 
+		return true; }
+	// Returns true if a row whose time (in 'timeCol') is 'x', and all the rows after it, are beyond the end of a sorted time range.
+	bool IsPastEnd(int colNo, double x) const { return sorted && colNo == timeCol && x >= timeTo; }
+	// Moves the columns that have conditions on them to the front of 'cols' (the time column first), keeping the order otherwise.
+	void OrderCols(TIntV& cols) const;
+};
+
 typedef TPt<TDataset> PDataset;
 
+class TTimeFormat;
+
 class TDataset
 {
 protected:
@@ -494,13 +665,43 @@ public:
 	int nRows;
 	TDataColumnV cols;
 	PModelConfig config;
+	TVec<TColStats> colStats; // colStats[colNo] = statistics of cols[colNo], if valid; only used while ApplyOps is running
+	// If not empty, ApplyOps only applies the ops needed to compute the columns with neededCols[colNo] = true; 
+	// the values of the other synthetic columns may stay empty.  Must be set before a TDatasetSnapshot is created.
+	TBoolV neededCols;
+	// If config->seriesAttr is set, the rows are grouped by series: seriesStarts[i] is the first row of the i'th series,
+	// and the last element is nRows.  If config->SortsRows(), inputRowMap[i] is the row that holds the i'th row of the input data
+	// (the row into which it was merged, if config->duplicateTimes merged it with others); it is cleared by ops that replace 
+	// the rows with new ones, such as resample.  Both are empty otherwise.
+	TIntV seriesStarts, inputRowMap;
+	TRowFilter rowFilter; // applied by the ReadDataFrom... functions; set from "dataSource.filter" by ReadDataFromJsonDataSourceSpec
 	void InitColsFromConfig(const PModelConfig& config_);
 	bool ReadDataFromJsonArray(const PJsonVal &jsonData, TConversionProgress &convProg);
-	bool ReadDataFromCsv(TSIn& SIn, const TStr& fieldSep, const TStr& fileName, TConversionProgress &convProg);
+	// Reads a JSON array of objects, one per row.  Unlike ReadDataFromJsonArray, this doesn't parse the whole array into a TJsonVal first.
+	bool ReadDataFromJson(const char *data, size_t len, const TStr& fileName, TConversionProgress &convProg);
+	// Like the above, but reads the data as it is being decompressed by 'source'.
+	bool ReadDataFromJson(TDecompressor& source, const TStr& fileName, TConversionProgress &convProg);
+	// Reads Arrow IPC data (file or stream format).  The columns refer to the top-level fields by name.
+	bool ReadDataFromArrow(const char *data, size_t len, const TStr& fileName, TConversionProgress &convProg);
+	// 'data' gets modified in place while parsing; there must be at least one writable byte after its end (at data[len]).
+	bool ReadDataFromCsv(char *data, size_t len, const TStr& fieldSep, const TStr& fileName, TConversionProgress &convProg);
+	// Like the above, but reads the data as it is being decompressed by 'source'.
+	bool ReadDataFromCsv(TDecompressor& source, const TStr& fieldSep, const TStr& fileName, TConversionProgress &convProg);
 	// jsonSpec must be a JSON object corresponding to the 'dataSource' attribute of a JSON request.
 	bool ReadDataFromJsonDataSourceSpec(const PJsonVal &jsonSpec, TStrV& errors);
+	// Called by ReadDataFromJsonDataSourceSpec.  Sorts the rows by config->seriesAttr (in the order in which the series 
+	// first appear) and/or by the first time attribute, as the config requires, keeping the order of rows with equal keys;
+	// then merges the rows with equal times according to config->duplicateTimes.  The rows are only reordered if they are
+	// not sorted yet.  If the config doesn't ask for sorting, reports a warning if the rows are not sorted by time.
+	void SortRows(TStrV& errors);
+	void FindSeriesStarts(); // sets seriesStarts from the values of config->seriesAttr, whose rows must already be grouped
+	int GetNumSeries() const { return seriesStarts.Empty() ? 1 : seriesStarts.Len() - 1; }
+	int GetSeriesStart(int seriesNo) const { return seriesStarts.Empty() ? 0 : seriesStarts[seriesNo].Val; }
+	int GetSeriesEnd(int seriesNo) const { return seriesStarts.Empty() ? nRows : seriesStarts[seriesNo + 1].Val; }
 	bool ApplyOps(TStrV& errors); // applies ops from 'config'
+	void GetOpsToApply(TVec<TOpDesc *>& ops) const; // the ops from 'config' that ApplyOps applies, given 'neededCols'
 	void CalcDefaultDistWeights(); // should be called after ApplyOps
+	void CalcCalendarCodes(); // for the time columns whose 'calendar' is missing; called by ApplyOps and TDatasetSnapshot::Load
 	double RowDist2(int row1, int row2) const;
 	double RowCentrDist2(int rowNo, const TCentroidComponentV& centroid) const;
 	double RowCentrDist2(int rowNo, const PState& state) const { return RowCentrDist2(rowNo, state->centroid); }
@@ -514,7 +715,102 @@ public:
 	const TDataColumn &GetCol(const TStr& name) const { return cols[GetColIdx(name)]; }
 	bool AdditionalInitFromJson(const PJsonVal &jsonVal, TStrV& errList);
 protected:
-	bool AddRowFromJson(const PJsonVal &jsonRow, int jsonRowIdx, TConversionProgress& convProg);
+	// Converts the columns in the order given by 'colOrder' (see TRowFilter::OrderCols).  timeFormats[colNo] 
+	// is the compiled format of cols[colNo], if it is a time column with string values.
+	bool AddRowFromJson(const PJsonVal &jsonRow, int jsonRowIdx, const TIntV& colOrder, TVec<TTimeFormat>& timeFormats, TConversionProgress& convProg);
+};
+
+// A dense view of the attributes that the distance function uses, for clustering and classification.
+// Each numeric attribute becomes one feature and each categorical attribute one feature per key (one-hot);
+// all of them are multiplied by sqrt(distWeight), so that the distance between two rows, or a row and a centroid,
+// is simply the squared Euclidean distance between their feature vectors.  Time attributes and attributes
+// with distWeight == 0 are left out; text attributes and categorical attributes with many keys are left out 
+// as well and listed in 'textCols' and 'catCols', so that the caller can add their part of the distance separately.  The rows are stored contiguously,
+// each padded with zeros to 'stride' features, and aligned to the cache line size.  The features are doubles or, if the config
+// asks for TPrecision::Float32, floats, which halves the memory and the bandwidth needed by the distance calculations.
+class TFeatureMatrix
+{
+public:
+	enum { Alignment = 64 }; // in bytes
+	TPrecision precision = TPrecision::Float64; // from the config of the dataset
+	int nRows = 0, nFeatures = 0, stride = 0; // stride = nFeatures rounded up to a multiple of Alignment / (the size of a feature), as the distance kernels require
+	TIntV firstFeature; // firstFeature[colNo] = the index of the first feature of the column, or -1 if it has none
+	TFltV scale; // scale[colNo] = sqrt(distWeight) for the columns that have features
+	// offset[colNo] is subtracted from the values of a numeric column before they are scaled, which doesn't change the distances.
+	// In Float32 mode it is the column's mean, so that a column whose mean is large relative to its spread doesn't lose 
+	// most of its precision in float; in Float64 mode it is 0.
+	TFltV offset;
+	TIntV textCols; // the text columns with distWeight != 0
+	// Categorical columns with more than MaxOneHotKeys keys aren't expanded either, since their one-hot features
+	// would be mostly zeros; the distance to a centroid is computed in O(1) instead, see CatDist2.
+	enum { MaxOneHotKeys = 64 };
+	TIntV catCols; // such categorical columns with distWeight != 0
+	TFltV catWeights; // catWeights[i] = the distWeight of catCols[i]
+protected:
+	// std::vectors since the number of elements can exceed the range of an int.  Only the one for 'precision' is used;
+	// 'data64' or 'data32' points to its first element that is aligned to Alignment bytes.
+	std::vector<double> buf64; std::vector<float> buf32; 
+	double *data64 = nullptr; float *data32 = nullptr;
+	std::vector<int> catKeys; // catKeys[GetCatOffset(rowNo) + i] = the keyId of the row's value in catCols[i], or -1 if the key is unknown
+	void InitLayout(const TDataset& dataset);
+	void GenRows(int nRows_);
+	size_t GetOffset(int rowNo) const { return size_t(rowNo) * stride; }
+	size_t GetCatOffset(int rowNo) const { return size_t(rowNo) * catCols.Len(); }
+	void PutFeature(int rowNo, int featureNo, double val) { 
+		const size_t i = GetOffset(rowNo) + featureNo; 
+		if (precision == TPrecision::Float32) data32[i] = float(val); else data64[i] = val; }
+public:
+	TFeatureMatrix() = default;
+	TFeatureMatrix(const TFeatureMatrix&) = delete; // 'data64' and 'data32' point into the buffers
+	TFeatureMatrix& operator=(const TFeatureMatrix&) = delete;
+	// Builds the matrix from all the rows of 'dataset'.
+	void Init(const TDataset& dataset);
+	// Builds the matrix, with the layout of 'layoutDataset' (e.g. the one a model was built from), from the rows 'rowNos' of 'dataset', 
+	// where colMap[colNo] is the column of 'dataset' that corresponds to layoutDataset.cols[colNo].  Keys of categorical
+	// attributes that 'layoutDataset' doesn't know have no features.  The offsets are the means of these rows.
+	void Init(const TDataset& layoutDataset, const TDataset& dataset, const TIntV& colMap, const TIntV& rowNos);
+	// Builds a matrix, with the layout of 'dataset', whose rows are the centroids of 'states'.  If 'rows' is given, the
+	// offsets are taken from it, so that its rows can be compared with these centroids; otherwise they are the means of the centroids.
+	void InitCentroids(const TDataset& dataset, const TStateV& states, const TFeatureMatrix *rows = nullptr);
+	// Returns the squared distance between two rows of this matrix.
+	double Dist2(int row1, int row2) const { 
+		const TDistKernels &kernels = TDistKernels::Get(); double d;
+		if (precision == TPrecision::Float32) kernels.dist2F32(data32 + GetOffset(row1), data32 + GetOffset(row2), 1, stride, &d);
+		else kernels.dist2F64(data64 + GetOffset(row1), data64 + GetOffset(row2), 1, stride, &d);
+		return d; }
+	// Sets dist2[j] to the squared distance between our row 'rowNo' and the j'th row of 'centroids' (a matrix 
+	// with the same layout, precision and offsets), for all the rows of 'centroids'.
+	void Dist2ToCentroids(int rowNo, const TFeatureMatrix& centroids, double *dist2) const { 
+		const TDistKernels &kernels = TDistKernels::Get(); Assert(centroids.precision == precision && centroids.stride == stride);
+		if (precision == TPrecision::Float32) kernels.dist2F32(data32 + GetOffset(rowNo), centroids.data32, centroids.nRows, stride, dist2);
+		else kernels.dist2F64(data64 + GetOffset(rowNo), centroids.data64, centroids.nRows, stride, dist2); }
+	// Return the part of the distance that is due to 'catCols', between two rows of this matrix,
+	// or between a row and a centroid (of a state of the dataset whose layout this matrix has).
+	double CatDist2(int row1, int row2) const;
+	double CatDist2(int rowNo, const TCentroidComponentV& centroid) const;
+};
+
+// An on-disk copy of a dataset as it is after reading the data source, applying the ops
+// and (optionally) calculating the default distance weights, together with the warnings
+// reported along the way.  The snapshot file name is a hash of everything that the prepared
+// dataset depends on: the data source spec, the size and modification time of the data file,
+// and the attributes and ops from the config.  Only data sources of type "file" are snapshotted.
+// Usage: if Load fails, prepare the dataset as usual and then call Save.
+class TDatasetSnapshot
+{
+public:
+	static TStr dirName; // empty = snapshots are disabled
+protected:
+	TDataset &dataset;
+	TStr key, fileName; // both empty if this dataset can't be snapshotted
+	int firstMsg; // index into 'errors' of the first message produced while preparing the dataset
+	bool Save_(const TStr& tmpFileName, const TStrV& errors) const;
+public:
+	TDatasetSnapshot(TDataset& dataset_, const PJsonVal& jsonSpec, bool withDistWeights);
+	// Returns false, without reporting an error, if there's no snapshot or it can't be read.
+	// Otherwise replaces the data in 'dataset' and appends the stored warnings to 'errors'.
+	bool Load(TStrV& errors);
+	void Save(const TStrV& errors) const;
 };
 
 class TModel;
@@ -561,6 +857,7 @@ protected:
 	TRnd rnd;
 	PModelConfig config;
 	TStateV &states; int nStates, nCols, nRows;
+	TFeatureMatrix features; // of all the rows of 'dataset'
 	// TFltVV distances; // distances(i, j) = distance of row i from the centroid of state j -- eh, we probably don't really need this
 	TKMeansRunner(TModel& model_) : dataset(*model_.dataset), model(model_), states(model_.initialStates), config(model_.dataset->config), rnd(123) { 
 		nStates = config->numInitialStates; nCols = dataset.cols.Len(); IAssert(nCols == config->attrs.Len()); 
@@ -625,6 +922,36 @@ bool Json_GetObjBool(const PJsonVal& jsonVal, const char *key, bool allowMissing
 bool Json_GetObjKey(const PJsonVal& jsonVal, const char *key, bool allowMissing, bool allowNull, PJsonVal& value, const TStr& whereForErrorMsg, TStrV& errList);
 bool Json_GetObjIntV(const PJsonVal& jsonVal, const char *key, bool allowMissing, bool allowNull, TIntV& value, const TStr& whereForErrorMsg, TStrV& errList);
 
+// A format string for StrPTime_HomeGrown, compiled into a sequence of steps so that parsing many
+// timestamps with the same format doesn't need to re-interpret the format string each time.
+// If the format begins with the date (e.g. "%Y-%m-%d %H:%M:%S"), Parse remembers the date part of
+// the previous timestamp; if the next one begins with the same characters, as is usual for time-sorted
+// data, only the rest of it needs to be parsed.  Since Parse updates this cache, a TTimeFormat 
+// shouldn't be used by several threads at the same time.
+class TTimeFormat
+{
+protected:
+	enum class TStepType { Char, Space, AmPm, Num };
+	class TStep { public: TStepType type; char c; int minDigits, maxDigits; }; // c = the character to match (for Char) or the format character (for Num)
+	TVec<TStep> steps;
+	bool valid;
+	int nDateSteps; // if > 0, steps[0..nDateSteps - 1] are the date prefix: Char steps and Num steps for the year, month or day, ending with a Num step
+	// The date prefix of the previous timestamp and the values parsed from it.
+	char prevDate[32]; int prevDateLen; bool prevDateShort; // prevDateShort = the last field had fewer than maxDigits digits
+	int prevYear, prevMonth, prevDay; int64_t prevDaySecs;
+	static bool IsDateField(char c) { return c == 'Y' || c == 'y' || c == 'm' || c == 'd'; }
+public:
+	TTimeFormat() { Compile(""); }
+	explicit TTimeFormat(const char *format) { Compile(format); }
+	void Compile(const char *format);
+	bool Parse(const char *s, TSecTm &secTm, int &ns);
+	// The number of days from 1970-01-01 to the given date in the proleptic Gregorian calendar.
+	static int64_t DaysFromCivil(int64_t year, int month, int day);
+	// Seconds from 1970-01-01 to the start of the given day.  Like timegm, this accepts 
+	// out-of-range months and days (e.g. month 13 is January of the next year).
+	static int64_t GetDayStartSecs(int year, int month, int day);
+};
+
 bool StrPTime_HomeGrown(const char *s, const char *format, TSecTm &secTm, int &ns);
 bool StrFTime_HomeGrown(TChA& dest, const char *format, const TSecTm &secTm, int ns, bool clrDest = false);
 TStr StrFTime_HomeGrown(const char *format, const TSecTm &secTm, int ns);
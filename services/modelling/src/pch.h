@@ -47,6 +47,8 @@
 // #include <libpq-fe.h>
 #include "Identifier.h"
 #include "JbUtils.h"
+#include "ArrowIpc.h"
+#include "DistKernels.h"
 #include "StreamStory2.h"
 
 #endif //PCH_H